@@ -0,0 +1,51 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * include/bcache.h
+ *
+ * Block cache
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	March 7 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <blockdev.h>
+
+#define BCACHE_SIZE 256		/* number of cached blocks */
+#define BCACHE_BUCKETS 64	/* hash buckets, must be a power of 2 */
+
+/*
+ * Cache statistics
+ */
+struct bcache_stats_t {
+	unsigned hits;		/* blocks found in the cache */
+	unsigned misses;	/* blocks that had to be read */
+	unsigned evictions;	/* blocks recycled to make room */
+	unsigned ra_blocks;	/* blocks brought in by readahead */
+	unsigned ra_hits;	/* readahead blocks that were later used */
+	unsigned ra_unused;	/* readahead blocks evicted without being used */
+	unsigned wb_blocks;	/* dirty blocks written back */
+	unsigned wb_requests;	/* write requests they took */
+};
+
+/* Function prototypes */
+void bcache_init(struct blockdev_t *dev);
+void *bcache_get(unsigned lba);
+void *bcache_pin(unsigned lba);
+void bcache_unpin(unsigned lba);
+int bcache_contains(unsigned lba);
+unsigned bcache_copy(unsigned lba, unsigned count, void *buf);
+int bcache_readahead(unsigned lba, unsigned count);
+int bcache_write(unsigned lba, unsigned count, const void *buf);
+void bcache_dirty(unsigned lba);
+int bcache_flush();
+void bcache_get_stats(struct bcache_stats_t *stats);
+
+#endif /* BCACHE_H */
@@ -0,0 +1,85 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * include/bio.h
+ *
+ * Block I/O request queue
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	April 4 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#ifndef BIO_H
+#define BIO_H
+
+#include <blockdev.h>
+#include <list.h>
+
+#define BIO_MAX_BLOCKS 64	/* largest merged command in blocks */
+#define BIO_DEADLINE 8		/* commands a request may be passed over by */
+
+/* request directions */
+#define BIO_READ 0
+#define BIO_WRITE 1
+
+struct bio_t;
+
+/*
+ * Completion callback, status is 0 or a negative error
+ * Note: callbacks may submit requests but must not wait for them
+ */
+typedef void (*bio_done_t)(struct bio_t *bio, int status);
+
+/*
+ * Block I/O request
+ */
+struct bio_t {
+	unsigned lba;			/* first block */
+	unsigned count;			/* number of blocks */
+	void *buf;			/* data to write or room for data read */
+	int dir;			/* BIO_READ or BIO_WRITE */
+	bio_done_t done;		/* completion callback or NULL */
+	void *priv;			/* for the submitter */
+	int pending;			/* 1 until the request completes */
+	int status;			/* result once complete */
+	unsigned deadline;		/* command count to start it by */
+	struct list_t sort_list;	/* pending requests in LBA order */
+	struct list_t fifo_list;	/* pending requests oldest first */
+};
+
+/*
+ * Queue statistics
+ */
+struct bio_stats_t {
+	unsigned submitted;	/* requests submitted */
+	unsigned reads;		/* read commands sent to the device */
+	unsigned writes;	/* write commands sent to the device */
+	unsigned merged;	/* requests that rode on another's command */
+	unsigned expired;	/* commands started out of order for a deadline */
+};
+
+/*
+ * Request queue of a block device
+ */
+struct bio_queue_t {
+	struct blockdev_t *dev;		/* device requests go to */
+	struct list_t sort_list;	/* pending requests in LBA order */
+	struct list_t fifo_list;	/* pending requests oldest first */
+	unsigned head;			/* block after the last command */
+	unsigned commands;		/* commands sent so far */
+	struct bio_stats_t stats;
+};
+
+/* Function prototypes */
+void bio_queue_init(struct bio_queue_t *queue, struct blockdev_t *dev);
+void bio_submit(struct bio_queue_t *queue, struct bio_t *bio);
+int bio_dispatch(struct bio_queue_t *queue);
+void bio_run(struct bio_queue_t *queue);
+int bio_wait(struct bio_queue_t *queue, struct bio_t *bio);
+void bio_get_stats(struct bio_queue_t *queue, struct bio_stats_t *stats);
+
+#endif /* BIO_H */
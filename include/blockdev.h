@@ -0,0 +1,68 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * include/blockdev.h
+ *
+ * Block device layer
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	February 28 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#ifndef BLOCKDEV_H
+#define BLOCKDEV_H
+
+#define BLOCKDEV_BLOCK_SIZE 512
+
+struct blockdev_t;
+
+/*
+ * Block device operations, each returns 0 or a negative error code
+ */
+struct blockdev_ops_t {
+	int (*read)(struct blockdev_t *dev, unsigned lba, unsigned count,
+			void *buf);
+	int (*write)(struct blockdev_t *dev, unsigned lba, unsigned count,
+			const void *buf);
+	int (*flush)(struct blockdev_t *dev);
+	int (*discard)(struct blockdev_t *dev, unsigned lba, unsigned count);
+};
+
+/*
+ * Block device statistics
+ */
+struct blockdev_stats_t {
+	unsigned reads;		/* read requests */
+	unsigned blocks_read;	/* blocks transferred by read requests */
+	unsigned writes;	/* write requests */
+	unsigned blocks_written;/* blocks transferred by write requests */
+	unsigned flushes;	/* flush requests */
+	unsigned discards;	/* discard requests */
+};
+
+/*
+ * Block device
+ */
+struct blockdev_t {
+	const char *name;			/* name for log messages */
+	const struct blockdev_ops_t *ops;	/* backend operations */
+	unsigned block_size;			/* size of block in bytes */
+	unsigned num_blocks;			/* size in blocks, 0 if unknown */
+	void *priv;				/* backend private data */
+	struct blockdev_stats_t stats;
+};
+
+/* Function prototypes */
+int blockdev_read(struct blockdev_t *dev, unsigned lba, unsigned count,
+		void *buf);
+int blockdev_write(struct blockdev_t *dev, unsigned lba, unsigned count,
+		const void *buf);
+int blockdev_flush(struct blockdev_t *dev);
+int blockdev_discard(struct blockdev_t *dev, unsigned lba, unsigned count);
+void blockdev_get_stats(struct blockdev_t *dev, struct blockdev_stats_t *stats);
+
+#endif /* BLOCKDEV_H */
@@ -0,0 +1,47 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * include/dcache.h
+ *
+ * Directory entry cache
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	February 14 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <filesystem.h>
+
+#define DCACHE_SIZE 64		/* number of cached names */
+#define DCACHE_BUCKETS 32	/* hash buckets, must be a power of 2 */
+
+/* dcache_lookup() results */
+#define DCACHE_MISS 0		/* name is not cached */
+#define DCACHE_HIT 1		/* name is cached, dirent filled in */
+#define DCACHE_NEGATIVE 2	/* name is cached as not existing */
+
+/*
+ * Cache statistics
+ */
+struct dcache_stats_t {
+	unsigned hits;		/* lookups answered with a dirent */
+	unsigned neg_hits;	/* lookups answered with 'no such file' */
+	unsigned misses;	/* lookups that had to go to disk */
+	unsigned evictions;	/* entries recycled to make room */
+};
+
+/* Function prototypes */
+void dcache_init();
+int dcache_lookup(unsigned parent, const char *name, struct dirent_t *dirent);
+void dcache_insert(unsigned parent, const char *name, struct dirent_t *dirent);
+void dcache_invalidate(unsigned parent, const char *name);
+void dcache_update(const struct dirent_t *dirent);
+void dcache_get_stats(struct dcache_stats_t *stats);
+
+#endif /* DCACHE_H */
@@ -0,0 +1,71 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * include/dma.h
+ *
+ * BCM2835 DMA controller
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	April 25 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#ifndef DMA_H
+#define DMA_H
+
+#include <types.h>
+
+#define DMA_CHANNELS 15		/* channels 0-14, 15 is not in the same block */
+
+/* peripherals that pace a transfer with DREQ */
+#define DMA_DREQ_EMMC 11
+
+/*
+ * Transfer information, the TI field of a control block
+ */
+#define DMA_TI_INTEN		0x1			/* interrupt when done */
+#define DMA_TI_WAIT_RESP	0x8			/* wait for write response */
+#define DMA_TI_DEST_INC		0x10		/* increment destination */
+#define DMA_TI_DEST_WIDTH	0x20		/* 128 bit destination writes */
+#define DMA_TI_DEST_DREQ	0x40		/* DREQ paces writes */
+#define DMA_TI_SRC_INC		0x100		/* increment source */
+#define DMA_TI_SRC_WIDTH	0x200		/* 128 bit source reads */
+#define DMA_TI_SRC_DREQ		0x400		/* DREQ paces reads */
+#define DMA_TI_PERMAP(x)	((x) << 16)	/* peripheral giving DREQ */
+
+/*
+ * Control block, read by the engine from memory
+ */
+struct dma_cb_t {
+	uint32_t ti;		/* transfer information */
+	uint32_t source_ad;	/* bus address of source */
+	uint32_t dest_ad;	/* bus address of destination */
+	uint32_t txfr_len;	/* bytes to move */
+	uint32_t stride;	/* 2D mode stride */
+	uint32_t nextconbk;	/* bus address of next block, 0 to stop */
+	uint32_t reserved[2];
+} __attribute__((aligned(32)));
+
+struct dma_stats_t {
+	unsigned transfers;	/* chains started */
+	unsigned control_blocks;	/* control blocks filled in */
+	unsigned bytes;		/* bytes they were given to move */
+	unsigned errors;	/* chains that failed or were aborted */
+};
+
+/* Function prototypes */
+int dma_init(int channel);
+uint32_t dma_bus_addr(const volatile void *addr);
+void dma_cb_init(struct dma_cb_t *cb, uint32_t ti, uint32_t source,
+		uint32_t dest, unsigned len);
+void dma_cb_link(struct dma_cb_t *cb, struct dma_cb_t *next);
+int dma_start(int channel, struct dma_cb_t *cb);
+int dma_busy(int channel);
+int dma_wait(int channel, int timeout);
+void dma_abort(int channel);
+void dma_get_stats(struct dma_stats_t *stats);
+
+#endif /* DMA_H */
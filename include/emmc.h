@@ -16,9 +16,50 @@
 #ifndef EMMC_H
 #define EMMC_H
 
-void emmc_init();
+struct blockdev_t;
+
+extern struct blockdev_t emmc_dev;
+
+/*
+ * Time spent waiting on the host, in us of the system timer, and the
+ * clock the card runs at
+ */
+struct emmc_stats_t {
+	unsigned commands;	/* commands completed */
+	unsigned command_us;	/* total wait for command done */
+	unsigned command_max_us;	/* longest wait for command done */
+	unsigned blocks;	/* blocks moved */
+	unsigned dma_blocks;	/* of those, blocks moved by DMA */
+	unsigned block_us;	/* total wait for the host buffer without DMA */
+	unsigned timeouts;	/* waits that gave up */
+	unsigned irqs;		/* interrupts serviced */
+	unsigned sleeps;	/* times the CPU slept waiting on the card */
+	unsigned clock_hz;	/* SD clock the divider gives */
+	unsigned clock_target_hz;	/* SD clock that was asked for */
+};
+
+/* run while a command or transfer is in flight */
+typedef void (*emmc_idle_t)(void);
+
+/*
+ * Part of a scatter-gather list
+ */
+struct emmc_sg_t {
+	void *buf;		/* where the blocks are in memory */
+	unsigned count;		/* number of blocks */
+};
+
+int emmc_init();
 int emmc_read_block(unsigned block, void *void_buf);
-void emmc_write_block();
+int emmc_write_block(unsigned block, const void *void_buf);
+int emmc_read_blocks(unsigned block, unsigned count, void *void_buf);
+int emmc_write_blocks(unsigned block, unsigned count, const void *void_buf);
+int emmc_read_sg(unsigned block, const struct emmc_sg_t *sg, unsigned nsg);
+int emmc_write_sg(unsigned block, const struct emmc_sg_t *sg, unsigned nsg);
+void emmc_set_dma(int enable);
 void emmc_dump_block(unsigned char *block);
+void emmc_dump_registers();
+void emmc_get_stats(struct emmc_stats_t *stats);
+void emmc_set_idle(emmc_idle_t idle);
 
 #endif /* EMMC_H */
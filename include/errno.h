@@ -18,6 +18,13 @@
 
 #define SUCCESS 0 /* succesful completion */
 
+#define ENOENT 2 /* no such file or directory */
+#define EIO 5 /* I/O error */
+#define EBADF 9 /* bad file descriptor */
+#define ENOTDIR 20 /* not a directory */
+#define EISDIR 21 /* is a directory */
 #define EINVAL 22 /* invalid argument */
+#define EMFILE 24 /* too many open files */
+#define ENOSPC 28 /* no space left on device */
 
 #endif /* ERRNO_H */
@@ -17,13 +17,41 @@
 #define FILESYSTEM_H
 
 #define FS_MAX_NAME 255
+#define FS_MAX_FILES 16
+#define FS_MAX_CLUSTERS (1 << 20)	/* clusters the free map can track */
+#define FS_FREE_UNKNOWN 0xFFFFFFFF	/* free cluster count not known */
 
+/* readahead window limits in sectors */
+#define FS_READAHEAD_MIN 8
+#define FS_READAHEAD_MAX 64
+
+/* fs_init() flags */
+#define FS_SCAN_DEFER 0x01	/* scan the FAT on first allocation, not at mount */
+
+/* FAT sectors read per request by the FAT scan */
+#define FS_SCAN_BLOCKS 64
+
+/* fs_seek origins */
+#define FS_SEEK_SET 0
+#define FS_SEEK_CUR 1
+#define FS_SEEK_END 2
+
+/* directory entry attributes */
+#define FS_ATTR_READ_ONLY 0x01
+#define FS_ATTR_HIDDEN 0x02
+#define FS_ATTR_SYSTEM 0x04
+#define FS_ATTR_VOLUME_ID 0x08
+#define FS_ATTR_DIRECTORY 0x10
+#define FS_ATTR_ARCHIVE 0x20
+
+#include <blockdev.h>
 #include <types.h>
 
 /*
  * FAT32 volume
  */
 struct vol_t {
+	struct blockdev_t *dev;	/* device holding the volume */
 	unsigned vol_lba;	/* LBA of volume */
 	unsigned size;		/* size of volume in sectors */
 	unsigned sector_size;	/* size of sector in bytes */
@@ -33,6 +61,9 @@ struct vol_t {
 	unsigned cluster_lba;	/* LBA of first cluster */
 	unsigned fat_lba;	/* LBA of first FAT */
 	unsigned root;	/* first cluster of root directory */
+	unsigned num_clusters;	/* number of data clusters */
+	unsigned free_clusters;	/* free clusters or FS_FREE_UNKNOWN */
+	unsigned fsinfo_lba;	/* LBA of FSInfo sector, 0 if none */
 };
 
 /*
@@ -41,14 +72,75 @@ struct vol_t {
 struct dirent_t {
 	char short_name[12];		/* FAT32 short name */
 	char long_name[FS_MAX_NAME+1];	/* FAT32 long name */
+	unsigned long_hash;		/* fs_long_hash() of long_name */
 	unsigned cluster;		/* first cluster */
 	unsigned size;
+	unsigned attributes;		/* FS_ATTR_* flags */
+	unsigned entry_lba;		/* sector holding the short entry */
+	unsigned entry_offset;		/* offset of the short entry in it */
+};
+
+/*
+ * Open directory
+ * Note: clusters can be as large as 32K, far too much to keep on the
+ * stack, so directories are streamed a sector at a time
+ */
+struct dir_t {
+	unsigned cluster;		/* current cluster, 0 at the end */
+	int sector;			/* sector of cluster held in buf */
+	unsigned offset;		/* offset of next entry in buf */
+	unsigned char buf[512];		/* current sector */
+};
+
+/*
+ * File read and write statistics
+ */
+struct fs_stats_t {
+	unsigned bytes_read;	/* bytes returned by fs_read_fd() */
+	unsigned bytes_copied;	/* bytes copied out of bounce buffers */
+	unsigned bytes_written;	/* bytes accepted by fs_write() */
+	unsigned bytes_streamed;	/* bytes handed out by fs_stream() */
+};
+
+/*
+ * Consumer of fs_stream(), gets len bytes at data and returns 0 to carry on
+ * Note: data is only good until the callback returns, and is never more
+ * than a sector
+ */
+typedef int (*fs_stream_callback_t)(void *ctx, const unsigned char *data,
+		unsigned len);
+
+/*
+ * What the FAT scan found
+ */
+struct fs_scan_t {
+	unsigned free;		/* free clusters */
+	unsigned used;		/* clusters in chains */
+	unsigned bad;		/* clusters marked bad */
+	unsigned broken;	/* links to clusters that do not exist */
+	unsigned chains;	/* chains, one per file or directory */
+	unsigned extents;	/* runs of contiguous clusters in the chains */
+	unsigned reads;		/* requests the scan took */
+	unsigned scan_us;	/* time the scan took */
 };
 
 /* Function Prototypes */
-void fs_init();
+void fs_init(struct blockdev_t *dev, unsigned flags);
 void fs_dump_part_table();
 int fs_read(const char *filename, unsigned char* buf, size_t off, size_t count);
+int fs_open(const char *filename);
+int fs_read_fd(int fd, unsigned char *buf, size_t count);
+int fs_stream(int fd, fs_stream_callback_t callback, void *ctx);
+int fs_create(const char *filename);
+int fs_write(int fd, const unsigned char *buf, size_t count);
+int fs_truncate(int fd, unsigned size);
+int fs_sync();
+void fs_get_stats(struct fs_stats_t *stats);
+int fs_get_scan(struct fs_scan_t *scan);
+int fs_seek(int fd, int off, int whence);
+int fs_close(int fd);
+int fs_opendir(const char *path, struct dir_t *dir);
+int fs_readdir_next(struct dir_t *dir, struct dirent_t *dirent);
 
 #endif /* FILESYSTEM_H */
 
@@ -3,10 +3,23 @@
 #ifndef IRQ_H
 #define IRQ_H
 
+/*
+ * Service routine positions: 0-31 are the basic pending bits, 32-95 are
+ * the 64 GPU interrupts of banks 1 and 2
+ */
+#define IRQ_MAILBOX	1		/* ARM mailbox has data */
+#define IRQ_GPU(n)	(32 + (n))
+#define IRQ_TIMER_1	IRQ_GPU(1)	/* system timer compare 1 */
+#define IRQ_EMMC	IRQ_GPU(62)	/* SD host controller */
+
 typedef void (*irq_service_routine_t)(void);
 
 void irq_init();
 void irq_register_service_routine(irq_service_routine_t isr, int pos);
+void irq_enable(int pos);
+void irq_disable(int pos);
+unsigned irq_save();
+void irq_restore(unsigned state);
+void irq_wait();
 
 #endif /* IRQ_H */
-
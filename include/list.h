@@ -13,6 +13,9 @@
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
  */
 
+#ifndef LIST_H
+#define LIST_H
+
 #include <types.h>
 
 struct list_t {
@@ -142,3 +145,5 @@ static inline int list_size(struct list_t *head)
 	}
 	return size;
 }
+
+#endif /* LIST_H */
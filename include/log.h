@@ -15,6 +15,8 @@
 
 typedef enum { DEBUG=0, INFO=1, WARN=2, ERROR=3, QUIET=4 } log_level_t;
 
+void _log(log_level_t level, const char *module, const char *format_str, ...);
+
 #ifndef LOGGING
 #define LOGGING QUIET
 #endif
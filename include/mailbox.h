@@ -27,8 +27,67 @@
 #define MBOX_PROP_OK	0x80000000
 #define MBOX_PROP_ERR	0x80000001
 
+/* Property tags */
+#define MBOX_TAG_BOARD_REV	0x10002
+#define MBOX_TAG_MAC_ADDR	0x10003
+#define MBOX_TAG_ARM_MEMORY	0x10005
+#define MBOX_TAG_VC_MEMORY	0x10006
+#define MBOX_TAG_CLOCK_STATE	0x30001
+#define MBOX_TAG_CLOCK_RATE	0x30002
+#define MBOX_TAG_SET_CLOCK_RATE	0x38002
+
+/* Clocks */
+#define MBOX_CLOCK_EMMC	0x1
+#define MBOX_CLOCK_UART	0x2
+#define MBOX_CLOCK_ARM	0x3
+#define MBOX_CLOCK_CORE	0x4
+
+#define MBOX_PROP_WORDS	64	/* largest property message */
+#define MBOX_QUEUE_LEN	8	/* answers or callbacks held per channel */
+
+/* called with the answer to a message sent by mailbox_write_async() */
+typedef void (*mailbox_callback_t)(int channel, uint32_t message, void *arg);
+
+/*
+ * A property message, any number of tags sent in one transaction
+ */
+struct mailbox_prop_t {
+	uint32_t buf[MBOX_PROP_WORDS];	/* the message, read by the VideoCore */
+	unsigned len;			/* words of buf taken by tags */
+} __attribute__((aligned(16)));
+
+struct mailbox_stats_t {
+	unsigned transactions;	/* property messages sent */
+	unsigned tags;		/* tags they carried */
+	unsigned us;		/* time spent waiting for answers */
+	unsigned irqs;		/* mailbox interrupts taken */
+	unsigned sleeps;	/* times a reader slept until an interrupt */
+	unsigned timeouts;	/* reads that gave up */
+	unsigned dropped;	/* answers with nowhere to go or too late */
+};
+
 /* Function prototypes */
+void mailbox_init();
 int mailbox_write(int channel, uint32_t message);
+int mailbox_write_async(int channel, uint32_t message, mailbox_callback_t done,
+		void *arg);
 int mailbox_read(int channel, uint32_t *message);
+void mailbox_prop_init(struct mailbox_prop_t *prop);
+int mailbox_prop_add(struct mailbox_prop_t *prop, uint32_t tag,
+		const uint32_t *args, unsigned nargs, unsigned size);
+int mailbox_prop_send(struct mailbox_prop_t *prop);
+int mailbox_prop_find(struct mailbox_prop_t *prop, uint32_t tag);
+uint32_t *mailbox_prop_value(struct mailbox_prop_t *prop, int handle,
+		unsigned *size);
+int mailbox_info_init();
+int mailbox_board_rev(uint32_t *rev);
+int mailbox_mac_addr(uint8_t *mac);
+int mailbox_arm_memory(uint32_t *base, uint32_t *size);
+int mailbox_vc_memory(uint32_t *base, uint32_t *size);
+int mailbox_clock_on(int clock);
+unsigned mailbox_clock_rate(int clock);
+unsigned mailbox_set_clock_rate(int clock, unsigned rate);
+void mailbox_clock_invalidate(int clock);
+void mailbox_get_stats(struct mailbox_stats_t *stats);
 
 #endif /* MAILBOX_H */
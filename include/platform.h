@@ -58,6 +58,26 @@ typedef struct __attribute__((packed)) {
 	uint32_t clear[2];		/* 0x28 */
 } gpio_reg_t;
 
+/* DMA controller, channel n is at DMA_BASE + n * DMA_CHAN_SIZE */
+#define DMA_BASE		PERIPHERAL_BASE + 0x7000
+#define DMA_CHAN_SIZE	0x100
+#define DMA_ENABLE		PERIPHERAL_BASE + 0x7FF0
+
+typedef struct __attribute__((packed)) {
+	uint32_t cs;		/* 0x00 - control and status */
+	uint32_t conblk_ad;	/* 0x04 - control block address */
+	uint32_t ti;		/* 0x08 - transfer information */
+	uint32_t source_ad;	/* 0x0C - source address */
+	uint32_t dest_ad;	/* 0x10 - destination address */
+	uint32_t txfr_len;	/* 0x14 - transfer length */
+	uint32_t stride;	/* 0x18 - 2D stride */
+	uint32_t nextconbk;	/* 0x1C - next control block address */
+	uint32_t debug;		/* 0x20 - debug */
+} dma_reg_t;
+
+/* peripherals as seen by the DMA engine and the VideoCore */
+#define PERIPHERAL_BUS_BASE	0x7E000000
+
 /* External mass media controller */
 #define EMMC_BASE		PERIPHERAL_BASE + 0x300000
 
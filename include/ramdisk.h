@@ -0,0 +1,24 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * include/ramdisk.h
+ *
+ * RAM disk
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	March 14 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include <blockdev.h>
+
+/* Function prototypes */
+void ramdisk_init(struct blockdev_t *dev, void *mem, unsigned num_blocks);
+
+#endif /* RAMDISK_H */
@@ -19,8 +19,14 @@ void *memcpy(void *dst, const void *src, unsigned long size);
 void *memset(void *dst, int c, unsigned long size);
 int strcmp(const char *str1, const char *str2);
 int strncmp(const char *str1, const char *str2, size_t n);
+int strcasecmp(const char *str1, const char *str2);
 char *strncpy(char *dst, const char *src, unsigned long n);
 size_t strlen(const char *str);
 int toupper(int c);
 
+#define STRHASH_INIT 2166136261u	/* FNV-1a offset basis */
+
+unsigned strhash_char(unsigned hash, int c);
+unsigned strhash(const char *str);
+
 #endif /* STRING_H */
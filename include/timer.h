@@ -14,7 +14,9 @@
 #define TIMER_H
 
 /* function prototypes */
+void timer_init();
 unsigned timer_read();
 void timer_wait(unsigned ticks);
+void timer_set_alarm(unsigned ticks);
 
 #endif /* TIMER_H */
@@ -0,0 +1,488 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * src/bcache.c
+ *
+ * Block cache
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	March 7 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * The block cache keeps copies of recently used disk blocks so that the
+ * filesystem does not go back to the card for metadata it just read (FAT
+ * sectors mostly) and so that file data can be fetched ahead of the
+ * reader.
+ *
+ * The cache is a fixed pool of BCACHE_SIZE blocks, chained into
+ * BCACHE_BUCKETS hash buckets by LBA and kept on an LRU list, most
+ * recently used first, just like the dentry cache. When the pool is
+ * exhausted the block at the tail of the LRU list is recycled.
+ *
+ * Blocks come and go through the device's request queue (see bio.c), one
+ * request per block; the queue merges neighbouring requests into single
+ * commands. bcache_readahead() queues a read for every block in a range
+ * that is not already cached and returns without waiting for them. The
+ * entries are hashed straight away but marked busy, and whoever wants
+ * one of them first runs the queue until it has arrived, which by then
+ * has usually brought the rest of the range in with the same command.
+ * Blocks that arrive this way are flagged until somebody reads them,
+ * which is what lets us tell how much of the readahead was worth doing.
+ *
+ * Writes are held in the cache too. bcache_write() and bcache_dirty() only
+ * mark blocks dirty; nothing goes to the device until bcache_flush() is
+ * called or a dirty block reaches the tail of the LRU list. Either way
+ * every dirty block is queued for writing at once, so that runs of
+ * neighbouring blocks leave in a single request. A program appending
+ * to a file therefore costs one large write per cache full of data rather
+ * than a write of the data block, the FAT sector and the directory entry
+ * for every call.
+ *
+ * A pointer from bcache_get() is only good until the next call into the
+ * cache. bcache_pin() hands out one that stays good until the block is
+ * unpinned; pinned blocks are passed over when a block is recycled.
+ * So are dirty blocks the device refused to take, they stay in the cache
+ * until a later flush gets them out, and a cache full of them makes
+ * further reads and writes fail rather than lose data.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#include <bcache.h>
+#include <bio.h>
+#include <blockdev.h>
+#include <errno.h>
+#include <list.h>
+#include <string.h>
+#include <types.h>
+
+/*
+ * Cached block
+ */
+struct bcache_entry_t {
+	unsigned lba;				/* block number */
+	int readahead;				/* 1 if prefetched and not yet used */
+	int dirty;				/* 1 if newer than the disk */
+	int busy;				/* 1 while a request is queued */
+	unsigned pins;				/* holders of pointers to data */
+	struct bio_t bio;			/* request for the block */
+	uint8_t data[BLOCKDEV_BLOCK_SIZE];	/* contents of block */
+	struct list_t hash_list;		/* bucket chain */
+	struct list_t lru_list;			/* LRU order or free list */
+};
+
+static struct bcache_entry_t entries[BCACHE_SIZE];
+static struct list_t buckets[BCACHE_BUCKETS];
+static struct list_t lru_list;
+static struct list_t free_list;
+static struct bcache_stats_t stats;
+static struct bio_queue_t queue;	/* requests to the cached device */
+static unsigned num_dirty;		/* number of dirty blocks */
+static int flush_status;		/* result of the write-back under way */
+
+#define BCACHE_BUCKET(lba) (&buckets[(lba) & (BCACHE_BUCKETS-1)])
+
+/*
+ * Find the entry for a block
+ */
+static struct bcache_entry_t *bcache_find(unsigned lba)
+{
+	struct bcache_entry_t *entry;
+
+	list_find_item(entry, BCACHE_BUCKET(lba), hash_list, entry->lba == lba);
+
+	return entry;
+}
+
+/*
+ * Move an entry to the front of the LRU list, counting readahead hits
+ */
+static void bcache_touch(struct bcache_entry_t *entry)
+{
+	list_remove(&entry->lru_list);
+	list_insert_after(&lru_list, &entry->lru_list);
+
+	if (entry->readahead) {
+		entry->readahead = 0;
+		++stats.ra_hits;
+	}
+}
+
+/*
+ * Mark an entry as newer than the disk
+ */
+static void bcache_set_dirty(struct bcache_entry_t *entry)
+{
+	if (!entry->dirty) {
+		entry->dirty = 1;
+		++num_dirty;
+	}
+}
+
+/*
+ * Find the least recently used entry that is not pinned, NULL if every
+ * entry is
+ */
+static struct bcache_entry_t *bcache_victim()
+{
+	struct bcache_entry_t *entry;
+
+	for (entry = list_item(lru_list.prev, struct bcache_entry_t, lru_list);
+			&entry->lru_list != &lru_list;
+			entry = list_prev_item(entry, lru_list))
+		if (entry->pins == 0)
+			return entry;
+
+	return NULL;
+}
+
+/*
+ * Find the least recently used entry that is neither pinned nor dirty,
+ * NULL if there is none
+ */
+static struct bcache_entry_t *bcache_clean_victim()
+{
+	struct bcache_entry_t *entry;
+
+	for (entry = list_item(lru_list.prev, struct bcache_entry_t, lru_list);
+			&entry->lru_list != &lru_list;
+			entry = list_prev_item(entry, lru_list))
+		if (entry->pins == 0 && !entry->dirty)
+			return entry;
+
+	return NULL;
+}
+
+/*
+ * Take a free entry or recycle the least recently used one and hash it
+ * under lba, the caller fills in the data
+ * Recycling a dirty block writes back every dirty block first. A block
+ * that could not be written is never recycled, returns NULL if every
+ * block we could take is such a block or is pinned.
+ */
+static struct bcache_entry_t *bcache_alloc(unsigned lba)
+{
+	struct bcache_entry_t *entry;
+
+	/* let queued reads land before their entry can be recycled */
+	if (list_empty(&free_list) && (entry = bcache_victim()) != NULL &&
+			entry->busy)
+		bio_run(&queue);
+
+	if (!list_empty(&free_list)) {
+		entry = list_item(free_list.next, struct bcache_entry_t, lru_list);
+		list_remove(&entry->lru_list);
+	} else {
+		if ((entry = bcache_victim()) == NULL)
+			return NULL;
+		if (entry->dirty && bcache_flush() != 0 &&
+				(entry = bcache_clean_victim()) == NULL)
+			return NULL;
+		list_remove(&entry->hash_list);
+		list_remove(&entry->lru_list);
+		if (entry->readahead)
+			++stats.ra_unused;
+		++stats.evictions;
+	}
+
+	entry->lba = lba;
+	entry->readahead = 0;
+	entry->dirty = 0;
+	entry->busy = 0;
+	entry->pins = 0;
+	list_insert_after(BCACHE_BUCKET(lba), &entry->hash_list);
+	list_insert_after(&lru_list, &entry->lru_list);
+
+	return entry;
+}
+
+/*
+ * Put an entry that could not be filled back on the free list
+ */
+static void bcache_free(struct bcache_entry_t *entry)
+{
+	list_remove(&entry->hash_list);
+	list_remove(&entry->lru_list);
+	list_insert_after(&free_list, &entry->lru_list);
+}
+
+/*
+ * Completion of a read, an entry that could not be filled is dropped
+ */
+static void bcache_read_done(struct bio_t *bio, int status)
+{
+	struct bcache_entry_t *entry = bio->priv;
+
+	entry->busy = 0;
+	if (status != 0)
+		bcache_free(entry);
+	else if (entry->readahead)
+		++stats.ra_blocks;
+}
+
+/*
+ * Completion of a write-back, blocks that could not be written stay dirty
+ */
+static void bcache_write_done(struct bio_t *bio, int status)
+{
+	struct bcache_entry_t *entry = bio->priv;
+
+	entry->busy = 0;
+	if (status != 0) {
+		flush_status = -EIO;
+		return;
+	}
+
+	entry->dirty = 0;
+	--num_dirty;
+	++stats.wb_blocks;
+}
+
+/*
+ * Queue a request for the block of an entry
+ */
+static void bcache_submit(struct bcache_entry_t *entry, int dir,
+		bio_done_t done)
+{
+	entry->busy = 1;
+	entry->bio.lba = entry->lba;
+	entry->bio.count = 1;
+	entry->bio.buf = entry->data;
+	entry->bio.dir = dir;
+	entry->bio.done = done;
+	entry->bio.priv = entry;
+	bio_submit(&queue, &entry->bio);
+}
+
+/*
+ * Find the entry for a block, waiting for it if it is still being read
+ */
+static struct bcache_entry_t *bcache_find_ready(unsigned lba)
+{
+	struct bcache_entry_t *entry = bcache_find(lba);
+
+	if (entry == NULL || !entry->busy)
+		return entry;
+
+	/* the entry is gone if the read failed */
+	bio_wait(&queue, &entry->bio);
+	return bcache_find(lba);
+}
+
+/*
+ * Empty the cache and start caching blocks of device
+ */
+void bcache_init(struct blockdev_t *device)
+{
+	int i;
+
+	list_init(&lru_list);
+	list_init(&free_list);
+	for (i=0; i<BCACHE_BUCKETS; i++)
+		list_init(&buckets[i]);
+	/* blocks of the last device that never made it out go with it */
+	for (i=0; i<BCACHE_SIZE; i++) {
+		entries[i].readahead = 0;
+		entries[i].dirty = 0;
+		entries[i].busy = 0;
+		entries[i].pins = 0;
+		list_insert_before(&free_list, &entries[i].lru_list);
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	bio_queue_init(&queue, device);
+	num_dirty = 0;
+}
+
+/*
+ * Find the entry for a block, reading it in if necessary
+ */
+static struct bcache_entry_t *bcache_load(unsigned lba)
+{
+	struct bcache_entry_t *entry;
+
+	if ((entry = bcache_find_ready(lba)) != NULL) {
+		++stats.hits;
+		bcache_touch(entry);
+		return entry;
+	}
+
+	++stats.misses;
+	if ((entry = bcache_alloc(lba)) == NULL)
+		return NULL;
+	bcache_submit(entry, BIO_READ, bcache_read_done);
+	if (bio_wait(&queue, &entry->bio) != 0)
+		return NULL;
+
+	return entry;
+}
+
+/*
+ * Return the cached copy of a block, reading it in if necessary
+ * Note: the pointer is only good until the next call into the cache
+ */
+void *bcache_get(unsigned lba)
+{
+	struct bcache_entry_t *entry = bcache_load(lba);
+
+	return entry == NULL ? NULL : entry->data;
+}
+
+/*
+ * Return the cached copy of a block like bcache_get() and keep it in the
+ * cache until bcache_unpin() is called for it
+ */
+void *bcache_pin(unsigned lba)
+{
+	struct bcache_entry_t *entry = bcache_load(lba);
+
+	if (entry == NULL)
+		return NULL;
+	++entry->pins;
+
+	return entry->data;
+}
+
+/*
+ * Let a pinned block be recycled again once every holder has unpinned it
+ */
+void bcache_unpin(unsigned lba)
+{
+	struct bcache_entry_t *entry = bcache_find(lba);
+
+	if (entry != NULL && entry->pins > 0)
+		--entry->pins;
+}
+
+/*
+ * Return true if the block is cached or on its way
+ */
+int bcache_contains(unsigned lba)
+{
+	return bcache_find(lba) != NULL;
+}
+
+/*
+ * Copy out the cached blocks at the start of a range
+ * Returns the number of blocks copied, stopping at the first block that is
+ * not cached.
+ */
+unsigned bcache_copy(unsigned lba, unsigned count, void *buf)
+{
+	unsigned i;
+	struct bcache_entry_t *entry;
+
+	for (i=0; i<count; i++) {
+		if ((entry = bcache_find_ready(lba + i)) == NULL)
+			break;
+		++stats.hits;
+		bcache_touch(entry);
+		memcpy((uint8_t *)buf + i*BLOCKDEV_BLOCK_SIZE, entry->data,
+				BLOCKDEV_BLOCK_SIZE);
+	}
+
+	return i;
+}
+
+/*
+ * Queue reads for every block in a range that is not cached, the blocks
+ * arrive when somebody asks for one of them
+ * Stops with -EIO when there is no entry left to read into.
+ */
+int bcache_readahead(unsigned lba, unsigned count)
+{
+	unsigned i;
+	struct bcache_entry_t *entry;
+
+	for (i=0; i<count; i++) {
+		if (bcache_find(lba + i) != NULL)
+			continue;
+		if ((entry = bcache_alloc(lba + i)) == NULL)
+			return -EIO;
+		entry->readahead = 1;
+		bcache_submit(entry, BIO_READ, bcache_read_done);
+	}
+
+	return 0;
+}
+
+/*
+ * Copy blocks into the cache and mark them dirty, a NULL buffer writes
+ * zeros
+ * The blocks are not read from the disk first since they are overwritten
+ * whole. Returns -EIO if there was no entry left to hold one of them.
+ */
+int bcache_write(unsigned lba, unsigned count, const void *buf)
+{
+	unsigned i;
+	struct bcache_entry_t *entry;
+
+	for (i=0; i<count; i++) {
+		/* a read still queued would land on top of the new data */
+		if ((entry = bcache_find_ready(lba + i)) != NULL) {
+			entry->readahead = 0;
+			list_remove(&entry->lru_list);
+			list_insert_after(&lru_list, &entry->lru_list);
+		} else if ((entry = bcache_alloc(lba + i)) == NULL) {
+			return -EIO;
+		}
+
+		if (buf == NULL)
+			memset(entry->data, 0, BLOCKDEV_BLOCK_SIZE);
+		else
+			memcpy(entry->data, (const uint8_t *)buf + i*BLOCKDEV_BLOCK_SIZE,
+					BLOCKDEV_BLOCK_SIZE);
+		bcache_set_dirty(entry);
+	}
+
+	return 0;
+}
+
+/*
+ * Mark a block changed through the pointer from bcache_get() dirty
+ */
+void bcache_dirty(unsigned lba)
+{
+	struct bcache_entry_t *entry = bcache_find(lba);
+
+	if (entry != NULL)
+		bcache_set_dirty(entry);
+}
+
+/*
+ * Write back every dirty block, neighbouring blocks in a single request,
+ * and finish the reads that are still queued
+ * Blocks that could not be written stay dirty.
+ */
+int bcache_flush()
+{
+	unsigned i;
+	struct bio_stats_t before, after;
+
+	if (num_dirty == 0) {
+		bio_run(&queue);
+		return 0;
+	}
+
+	bio_get_stats(&queue, &before);
+	flush_status = 0;
+	for (i=0; i<BCACHE_SIZE; i++)
+		if (entries[i].dirty)
+			bcache_submit(&entries[i], BIO_WRITE, bcache_write_done);
+	bio_run(&queue);
+	bio_get_stats(&queue, &after);
+	stats.wb_requests += after.writes - before.writes;
+
+	return flush_status;
+}
+
+/*
+ * Copy out the cache statistics
+ */
+void bcache_get_stats(struct bcache_stats_t *ret)
+{
+	memcpy(ret, &stats, sizeof(struct bcache_stats_t));
+}
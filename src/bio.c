@@ -0,0 +1,219 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * src/bio.c
+ *
+ * Block I/O request queue
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	April 4 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * bio_submit() queues a request and returns straight away; the request is
+ * carried out later, when somebody runs the queue, and its completion
+ * callback is called then. Callers that have several requests to make
+ * (readahead, write-back) submit them all and let the queue decide how to
+ * send them to the device.
+ *
+ * The queue is only run by bio_run() and bio_wait(), on the caller's
+ * time, so submitting a request does not overlap its transfer with
+ * anything; what queueing buys is fewer and larger commands. Nor can the
+ * queue be run from the routine given to emmc_set_idle(): that runs while
+ * the controller is busy with the command being waited on, and the card
+ * takes one command at a time.
+ *
+ * Pending requests are kept sorted by LBA. Each command is built around
+ * the first request at or after the block the last command ended on,
+ * sweeping up the disk and wrapping around to the lowest LBA (C-SCAN),
+ * and takes with it the requests in the same direction on either side
+ * that make a contiguous range, up to BIO_MAX_BLOCKS. Requests also sit on a
+ * FIFO list; one that has been passed over for BIO_DEADLINE commands is
+ * served next regardless of where the sweep is, so a busy region of the
+ * disk cannot starve the rest.
+ *
+ * Requests merged into one command whose buffers do not follow each other
+ * in memory are gathered into (or scattered from) a staging buffer. On an
+ * SD card the cost of a command dwarfs that of copying a few blocks.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#include <bio.h>
+#include <blockdev.h>
+#include <list.h>
+#include <string.h>
+#include <types.h>
+
+/*
+ * Staging buffer and the requests making up the command being sent
+ */
+static uint8_t staging[BIO_MAX_BLOCKS * BLOCKDEV_BLOCK_SIZE];
+static struct bio_t *command[BIO_MAX_BLOCKS];
+
+/*
+ * Start with an empty queue for device dev
+ */
+void bio_queue_init(struct bio_queue_t *queue, struct blockdev_t *dev)
+{
+	queue->dev = dev;
+	list_init(&queue->sort_list);
+	list_init(&queue->fifo_list);
+	queue->head = 0;
+	queue->commands = 0;
+	memset(&queue->stats, 0, sizeof(struct bio_stats_t));
+}
+
+/*
+ * Queue a request, it completes when the queue is run
+ */
+void bio_submit(struct bio_queue_t *queue, struct bio_t *bio)
+{
+	struct bio_t *next;
+
+	bio->pending = 1;
+	bio->status = 0;
+	bio->deadline = queue->commands + BIO_DEADLINE;
+
+	/* requests for the same block keep the order they came in */
+	list_find_item(next, &queue->sort_list, sort_list, next->lba > bio->lba);
+	list_insert_before(next == NULL ? &queue->sort_list : &next->sort_list,
+			&bio->sort_list);
+	list_insert_before(&queue->fifo_list, &bio->fifo_list);
+
+	++queue->stats.submitted;
+}
+
+/*
+ * Pick the request the next command starts with
+ */
+static struct bio_t *bio_next(struct bio_queue_t *queue)
+{
+	struct bio_t *bio;
+
+	bio = list_first_item(&queue->fifo_list, struct bio_t, fifo_list);
+	if ((int)(queue->commands - bio->deadline) >= 0) {
+		++queue->stats.expired;
+		return bio;
+	}
+
+	list_find_item(bio, &queue->sort_list, sort_list, bio->lba >= queue->head);
+	if (bio == NULL)
+		bio = list_first_item(&queue->sort_list, struct bio_t, sort_list);
+
+	return bio;
+}
+
+/*
+ * Send the next command to the device and complete the requests it was
+ * made of, returns the number of requests completed
+ */
+int bio_dispatch(struct bio_queue_t *queue)
+{
+	struct bio_t *bio, *prev, *next, *last;
+	unsigned n = 0, count, i, lba;
+	uint8_t *buf;
+	int direct = 1, status;
+
+	if (list_empty(&queue->sort_list))
+		return 0;
+
+	/* take in the requests that lead up to it */
+	bio = last = bio_next(queue);
+	count = bio->count;
+	while (&bio->sort_list != queue->sort_list.next) {
+		prev = list_prev_item(bio, sort_list);
+		if (prev->dir != bio->dir || prev->lba + prev->count != bio->lba ||
+				count + prev->count > BIO_MAX_BLOCKS)
+			break;
+		bio = prev;
+		count += prev->count;
+	}
+
+	/* and the requests that follow on */
+	while (&last->sort_list != queue->sort_list.prev) {
+		next = list_next_item(last, sort_list);
+		if (next->dir != last->dir || next->lba != last->lba + last->count ||
+				count + next->count > BIO_MAX_BLOCKS)
+			break;
+		last = next;
+		count += next->count;
+	}
+
+	lba = bio->lba;
+	command[n++] = bio;
+	while (bio != last) {
+		next = list_next_item(bio, sort_list);
+		if (next->buf != (uint8_t *)bio->buf + bio->count * BLOCKDEV_BLOCK_SIZE)
+			direct = 0;
+		command[n++] = bio = next;
+	}
+
+	/* requests whose buffers are not back to back go through staging */
+	buf = direct ? command[0]->buf : staging;
+	if (command[0]->dir == BIO_WRITE) {
+		for (i=0; !direct && i<n; i++) {
+			memcpy(buf, command[i]->buf, command[i]->count * BLOCKDEV_BLOCK_SIZE);
+			buf += command[i]->count * BLOCKDEV_BLOCK_SIZE;
+		}
+		status = blockdev_write(queue->dev, lba, count, direct ?
+				command[0]->buf : staging);
+		++queue->stats.writes;
+	} else {
+		status = blockdev_read(queue->dev, lba, count, buf);
+		for (i=0; !direct && status == 0 && i<n; i++) {
+			memcpy(command[i]->buf, buf, command[i]->count * BLOCKDEV_BLOCK_SIZE);
+			buf += command[i]->count * BLOCKDEV_BLOCK_SIZE;
+		}
+		++queue->stats.reads;
+	}
+
+	queue->head = lba + count;
+	++queue->commands;
+	queue->stats.merged += n - 1;
+
+	/* take them all off the queue before callbacks can submit more */
+	for (i=0; i<n; i++) {
+		list_remove(&command[i]->sort_list);
+		list_remove(&command[i]->fifo_list);
+	}
+	for (i=0; i<n; i++) {
+		bio = command[i];
+		bio->pending = 0;
+		bio->status = status;
+		if (bio->done != NULL)
+			bio->done(bio, status);
+	}
+
+	return n;
+}
+
+/*
+ * Send commands until the queue is empty
+ */
+void bio_run(struct bio_queue_t *queue)
+{
+	while (bio_dispatch(queue) > 0)
+		;
+}
+
+/*
+ * Send commands until a request has completed and return its status
+ */
+int bio_wait(struct bio_queue_t *queue, struct bio_t *bio)
+{
+	while (bio->pending && bio_dispatch(queue) > 0)
+		;
+
+	return bio->status;
+}
+
+/*
+ * Copy out the queue statistics
+ */
+void bio_get_stats(struct bio_queue_t *queue, struct bio_stats_t *ret)
+{
+	memcpy(ret, &queue->stats, sizeof(struct bio_stats_t));
+}
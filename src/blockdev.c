@@ -0,0 +1,122 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * src/blockdev.c
+ *
+ * Block device layer
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	February 28 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * The filesystem talks to a disk in terms of requests: read or write count
+ * consecutive blocks starting at lba. Describing a transfer as a single
+ * request rather than a string of single block transfers lets the backend
+ * stream the whole range in one go, which is where an SD card gets its
+ * bandwidth from.
+ *
+ * A disk is a struct blockdev_t: a table of operations plus its geometry.
+ * The SD card driver provides one (emmc_dev), the RAM disk turns any piece
+ * of memory into one and the host tests add one backed by an image file.
+ * Whoever mounts a filesystem picks the device, so the same filesystem and
+ * cache code can run on any of them.
+ *
+ * This layer checks requests against the size of the device and counts
+ * them per device so that the effect of coalescing can be measured.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#define MODULE BLOCKDEV
+
+#include <blockdev.h>
+#include <errno.h>
+#include <string.h>
+#include <log.h>
+
+/*
+ * Return true if the range does not fit on the device
+ */
+static int blockdev_out_of_range(struct blockdev_t *dev, unsigned lba,
+		unsigned count)
+{
+	return dev->num_blocks != 0 &&
+		(lba >= dev->num_blocks || count > dev->num_blocks - lba);
+}
+
+/*
+ * Read count blocks starting at lba into buf
+ */
+int blockdev_read(struct blockdev_t *dev, unsigned lba, unsigned count,
+		void *buf)
+{
+	int ret;
+
+	if (blockdev_out_of_range(dev, lba, count))
+		return -EINVAL;
+
+	++dev->stats.reads;
+	dev->stats.blocks_read += count;
+
+	if ((ret = dev->ops->read(dev, lba, count, buf)) != 0)
+		log(ERROR, "%s: error reading blocks 0x%x-0x%x", dev->name, lba,
+				lba + count - 1);
+
+	return ret;
+}
+
+/*
+ * Write count blocks from buf starting at lba
+ */
+int blockdev_write(struct blockdev_t *dev, unsigned lba, unsigned count,
+		const void *buf)
+{
+	int ret;
+
+	if (blockdev_out_of_range(dev, lba, count))
+		return -EINVAL;
+
+	++dev->stats.writes;
+	dev->stats.blocks_written += count;
+
+	if ((ret = dev->ops->write(dev, lba, count, buf)) != 0)
+		log(ERROR, "%s: error writing blocks 0x%x-0x%x", dev->name, lba,
+				lba + count - 1);
+
+	return ret;
+}
+
+/*
+ * Wait for every completed write to reach the medium
+ */
+int blockdev_flush(struct blockdev_t *dev)
+{
+	++dev->stats.flushes;
+
+	return dev->ops->flush ? dev->ops->flush(dev) : 0;
+}
+
+/*
+ * Tell the device a range of blocks is no longer in use
+ * Discarding is only a hint, devices that cannot do it ignore it.
+ */
+int blockdev_discard(struct blockdev_t *dev, unsigned lba, unsigned count)
+{
+	if (blockdev_out_of_range(dev, lba, count))
+		return -EINVAL;
+
+	++dev->stats.discards;
+
+	return dev->ops->discard ? dev->ops->discard(dev, lba, count) : 0;
+}
+
+/*
+ * Copy out the statistics of a device
+ */
+void blockdev_get_stats(struct blockdev_t *dev, struct blockdev_stats_t *ret)
+{
+	memcpy(ret, &dev->stats, sizeof(struct blockdev_stats_t));
+}
@@ -0,0 +1,223 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * src/dcache.c
+ *
+ * Directory entry cache
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	February 14 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * FAT directories are unsorted arrays of entries so finding a name means
+ * reading and decoding the directory until we stumble upon it. The dentry
+ * cache remembers the result of recent lookups so that opening a file we
+ * have already opened costs a hash probe instead of a directory scan.
+ *
+ * Entries are keyed by the first cluster of the directory they live in
+ * and the name that was looked up. FAT names are case insensitive so the
+ * name is normalised to upper case before it is hashed or compared. Each
+ * entry holds a copy of the directory entry, which carries both the short
+ * and the long name of the file. A lookup that found nothing is cached
+ * too (a 'negative' entry) so probing for a missing file is just as cheap
+ * as finding one that exists.
+ *
+ * The cache is a fixed pool of DCACHE_SIZE entries. Entries are chained
+ * into DCACHE_BUCKETS hash buckets and every entry also sits on an LRU
+ * list, most recently used first. When the pool is exhausted the entry at
+ * the tail of the LRU list is recycled.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#include <dcache.h>
+#include <list.h>
+#include <string.h>
+
+/*
+ * Cached name
+ */
+struct dcache_entry_t {
+	unsigned parent;		/* first cluster of parent directory */
+	unsigned hash;			/* hash of parent and name */
+	char name[FS_MAX_NAME+1];	/* normalised name */
+	int negative;			/* 1 if the name does not exist */
+	struct dirent_t dirent;		/* directory entry if positive */
+	struct list_t hash_list;	/* bucket chain */
+	struct list_t lru_list;		/* LRU order or free list */
+};
+
+static struct dcache_entry_t entries[DCACHE_SIZE];
+static struct list_t buckets[DCACHE_BUCKETS];
+static struct list_t lru_list;
+static struct list_t free_list;
+static struct dcache_stats_t stats;
+
+/*
+ * Copy name to buf in upper case, returns -1 if it does not fit
+ */
+static int dcache_normalise(char *buf, const char *name)
+{
+	int i;
+
+	for (i=0; name[i] != '\0'; i++) {
+		if (i == FS_MAX_NAME)
+			return -1;
+		buf[i] = toupper(name[i]);
+	}
+	buf[i] = '\0';
+
+	return 0;
+}
+
+/*
+ * FNV-1a hash of the normalised name mixed with the parent cluster
+ */
+static unsigned dcache_hash(unsigned parent, const char *name)
+{
+	return strhash(name) ^ (parent * 2654435761u);
+}
+
+/*
+ * Find the entry for a normalised name
+ */
+static struct dcache_entry_t *dcache_find(unsigned parent, const char *name,
+		unsigned hash)
+{
+	struct dcache_entry_t *entry;
+	struct list_t *bucket = &buckets[hash & (DCACHE_BUCKETS-1)];
+
+	list_find_item(entry, bucket, hash_list, entry->hash == hash &&
+			entry->parent == parent && !strcmp(entry->name, name));
+
+	return entry;
+}
+
+/*
+ * Empty the cache
+ */
+void dcache_init()
+{
+	int i;
+
+	list_init(&lru_list);
+	list_init(&free_list);
+	for (i=0; i<DCACHE_BUCKETS; i++)
+		list_init(&buckets[i]);
+	for (i=0; i<DCACHE_SIZE; i++)
+		list_insert_before(&free_list, &entries[i].lru_list);
+
+	memset(&stats, 0, sizeof(stats));
+}
+
+/*
+ * Look up name in directory parent
+ */
+int dcache_lookup(unsigned parent, const char *name, struct dirent_t *dirent)
+{
+	char norm[FS_MAX_NAME+1];
+	struct dcache_entry_t *entry;
+
+	if (dcache_normalise(norm, name) != 0 ||
+			(entry = dcache_find(parent, norm, dcache_hash(parent, norm))) == NULL) {
+		++stats.misses;
+		return DCACHE_MISS;
+	}
+
+	/* move to the front of the LRU list */
+	list_remove(&entry->lru_list);
+	list_insert_after(&lru_list, &entry->lru_list);
+
+	if (entry->negative) {
+		++stats.neg_hits;
+		return DCACHE_NEGATIVE;
+	}
+
+	++stats.hits;
+	memcpy(dirent, &entry->dirent, sizeof(struct dirent_t));
+
+	return DCACHE_HIT;
+}
+
+/*
+ * Remember the result of a lookup, a NULL dirent means the name does not
+ * exist
+ */
+void dcache_insert(unsigned parent, const char *name, struct dirent_t *dirent)
+{
+	char norm[FS_MAX_NAME+1];
+	unsigned hash;
+	struct dcache_entry_t *entry;
+
+	if (dcache_normalise(norm, name) != 0)
+		return;
+	hash = dcache_hash(parent, norm);
+
+	/* reuse an existing entry, a free one or the least recently used */
+	if ((entry = dcache_find(parent, norm, hash)) != NULL) {
+		list_remove(&entry->hash_list);
+		list_remove(&entry->lru_list);
+	} else if (!list_empty(&free_list)) {
+		entry = list_item(free_list.next, struct dcache_entry_t, lru_list);
+		list_remove(&entry->lru_list);
+	} else {
+		entry = list_item(lru_list.prev, struct dcache_entry_t, lru_list);
+		list_remove(&entry->hash_list);
+		list_remove(&entry->lru_list);
+		++stats.evictions;
+	}
+
+	entry->parent = parent;
+	entry->hash = hash;
+	strncpy(entry->name, norm, FS_MAX_NAME+1);
+	entry->negative = dirent == NULL;
+	if (dirent != NULL)
+		memcpy(&entry->dirent, dirent, sizeof(struct dirent_t));
+
+	list_insert_after(&buckets[hash & (DCACHE_BUCKETS-1)], &entry->hash_list);
+	list_insert_after(&lru_list, &entry->lru_list);
+}
+
+/*
+ * Forget a name, e.g. because it was created or removed
+ */
+void dcache_invalidate(unsigned parent, const char *name)
+{
+	char norm[FS_MAX_NAME+1];
+	struct dcache_entry_t *entry;
+
+	if (dcache_normalise(norm, name) != 0)
+		return;
+	if ((entry = dcache_find(parent, norm, dcache_hash(parent, norm))) == NULL)
+		return;
+
+	list_remove(&entry->hash_list);
+	list_remove(&entry->lru_list);
+	list_insert_after(&free_list, &entry->lru_list);
+}
+
+/*
+ * Refresh the cached copies of a directory entry that has changed on disk,
+ * e.g. because the file grew
+ */
+void dcache_update(const struct dirent_t *dirent)
+{
+	int i;
+
+	for (i=0; i<DCACHE_SIZE; i++)
+		if (!entries[i].negative &&
+				entries[i].dirent.entry_lba == dirent->entry_lba &&
+				entries[i].dirent.entry_offset == dirent->entry_offset)
+			memcpy(&entries[i].dirent, dirent, sizeof(struct dirent_t));
+}
+
+/*
+ * Copy out the cache statistics
+ */
+void dcache_get_stats(struct dcache_stats_t *ret)
+{
+	memcpy(ret, &stats, sizeof(struct dcache_stats_t));
+}
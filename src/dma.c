@@ -0,0 +1,234 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * src/dma.c
+ *
+ * BCM2835 DMA controller
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	April 25 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * The DMA controller has 16 channels, each of which works through a chain
+ * of control blocks in memory. A control block gives a source, destination
+ * and length along with the transfer information (TI) saying how to move
+ * the data: whether to increment each address, and whether a peripheral
+ * paces the reads or writes with its DREQ signal. A channel is started by
+ * writing the address of the first control block to CONBLK_AD and setting
+ * ACTIVE in CS. It loads each block in turn, following NEXTCONBK, and
+ * clears ACTIVE after the last.
+ *
+ *	DMA base: 0x20007000
+ *
+ *	offset		function
+ *	--------------------
+ *	0x00		CS (control and status)
+ *	0x04		CONBLK_AD (control block address)
+ *	0x08-0x1C	the control block being worked on
+ *	0x20		DEBUG
+ *
+ * Channel n is at DMA_BASE + n * 0x100, and a channel is turned on by
+ * setting its bit in the ENABLE register at 0x20007FF0.
+ *
+ * The engine sits on the VideoCore's bus, so every address in a control
+ * block is a bus address. Peripherals at 0x20xxxxxx are 0x7Exxxxxx on the
+ * bus, and memory is aliased at 0x40000000, the same alias the mailbox
+ * uses. The data cache is not turned on, so memory needs no cleaning or
+ * invalidating around a transfer.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#define MODULE DMA
+
+#include <dma.h>
+#include <errno.h>
+#include <log.h>
+#include <platform.h>
+#include <string.h>
+#include <timer.h>
+#include <util.h>
+
+/*
+ * Register access, on the host the controller is modelled by the
+ * simulator in test/dma_sim.c
+ */
+#ifdef DMA_SIM
+#include "dma_sim.h"
+static volatile dma_reg_t *dma_reg = dma_sim_reg;
+static volatile uint32_t *dma_enable = &dma_sim_enable;
+#define dma_read_reg(reg) dma_sim_read(reg)
+#define dma_write_reg(reg, val) dma_sim_write(reg, val)
+#else
+static volatile dma_reg_t *dma_reg = (dma_reg_t *)DMA_BASE;
+static volatile uint32_t *dma_enable = (uint32_t *)DMA_ENABLE;
+#define dma_read_reg(reg) (*(reg))
+#define dma_write_reg(reg, val) (*(reg) = (val))
+#endif
+
+#define DMA_CHAN(ch) ((volatile dma_reg_t *)((volatile char *)dma_reg + \
+			(ch) * DMA_CHAN_SIZE))
+#define DMA_READ(ch, field) dma_read_reg(&DMA_CHAN(ch)->field)
+#define DMA_WRITE(ch, field, val) dma_write_reg(&DMA_CHAN(ch)->field, val)
+
+/*
+ * CS register fields
+ */
+#define CS_ACTIVE	0x1			/* channel is working through blocks */
+#define CS_END		0x2			/* a transfer finished, write 1 to clear */
+#define CS_INT		0x4			/* interrupt raised, write 1 to clear */
+#define CS_ERROR	0x100		/* channel has an error */
+#define CS_WAIT_WRITES	0x10000000	/* wait for outstanding writes */
+#define CS_ABORT	0x40000000	/* abort the current block */
+#define CS_RESET	0x80000000	/* reset the channel */
+
+/*
+ * DEBUG register fields, write 1 to clear
+ */
+#define DEBUG_ERRORS	0x7			/* read, FIFO and last signal errors */
+
+#define MEM_BUS_BASE	0x40000000	/* L2 coherent alias of memory */
+#define PERIPHERAL_END	(PERIPHERAL_BASE + 0x1000000)
+
+#define POLL_MIN	1			/* first delay between polls in us */
+#define POLL_MAX	256			/* longest delay between polls in us */
+
+static struct dma_stats_t stats;
+
+/*
+ * Turn on and reset a channel
+ */
+int dma_init(int channel)
+{
+	if (channel < 0 || channel >= DMA_CHANNELS)
+		return -EINVAL;
+
+	dma_write_reg(dma_enable, dma_read_reg(dma_enable) | (1 << channel));
+	DMA_WRITE(channel, cs, CS_RESET);
+	DMA_WRITE(channel, cs, CS_END | CS_INT);
+	DMA_WRITE(channel, debug, DEBUG_ERRORS);
+
+	return 0;
+}
+
+/*
+ * Translate an ARM address of memory or a peripheral to a bus address
+ */
+uint32_t dma_bus_addr(const volatile void *addr)
+{
+#ifdef DMA_SIM
+	return dma_sim_bus_addr(addr);
+#else
+	uint32_t a = (uint32_t)addr;
+
+	if (a >= PERIPHERAL_BASE && a < PERIPHERAL_END)
+		return a - PERIPHERAL_BASE + PERIPHERAL_BUS_BASE;
+	return a | MEM_BUS_BASE;
+#endif
+}
+
+/*
+ * Fill in a control block that ends its chain
+ */
+void dma_cb_init(struct dma_cb_t *cb, uint32_t ti, uint32_t source,
+		uint32_t dest, unsigned len)
+{
+	++stats.control_blocks;
+	stats.bytes += len;
+	cb->ti = ti;
+	cb->source_ad = source;
+	cb->dest_ad = dest;
+	cb->txfr_len = len;
+	cb->stride = 0;
+	cb->nextconbk = 0;
+}
+
+/*
+ * Have the engine go on to next after cb
+ */
+void dma_cb_link(struct dma_cb_t *cb, struct dma_cb_t *next)
+{
+	cb->nextconbk = dma_bus_addr(next);
+}
+
+/*
+ * Start a channel on a chain of control blocks
+ */
+int dma_start(int channel, struct dma_cb_t *cb)
+{
+	if (channel < 0 || channel >= DMA_CHANNELS)
+		return -EINVAL;
+	if (dma_busy(channel))
+		return -EINVAL;
+
+	++stats.transfers;
+	DMA_WRITE(channel, cs, CS_END | CS_INT);
+	DMA_WRITE(channel, conblk_ad, dma_bus_addr(cb));
+	DMA_WRITE(channel, cs, CS_ACTIVE | CS_WAIT_WRITES);
+
+	return 0;
+}
+
+/*
+ * Return true while a channel still has blocks to work through
+ */
+int dma_busy(int channel)
+{
+	return (DMA_READ(channel, cs) & CS_ACTIVE) != 0;
+}
+
+/*
+ * Wait for a channel to finish with timeout (in ms)
+ */
+int dma_wait(int channel, int timeout)
+{
+	unsigned start, delay = 0, cs;
+
+	start = timer_read();
+	while ((cs = DMA_READ(channel, cs)) & CS_ACTIVE) {
+		if (cs & CS_ERROR)
+			break;
+		if (timer_read() - start >= timeout * 1000) {
+			log(ERROR, "timed out waiting for channel %d", channel);
+			dma_abort(channel);
+			return -EIO;
+		}
+
+		/* the last few words are usually close behind */
+		if (delay > 0)
+			timer_wait(delay);
+		delay = delay == 0 ? POLL_MIN : MIN(2 * delay, POLL_MAX);
+	}
+
+	if (cs & CS_ERROR) {
+		log(ERROR, "channel %d error, DEBUG: 0x%x", channel,
+				DMA_READ(channel, debug));
+		dma_abort(channel);
+		return -EIO;
+	}
+
+	DMA_WRITE(channel, cs, CS_END | CS_INT);
+	return 0;
+}
+
+/*
+ * Stop a channel and drop the rest of its chain
+ */
+void dma_abort(int channel)
+{
+	++stats.errors;
+	DMA_WRITE(channel, cs, CS_RESET);
+	DMA_WRITE(channel, cs, CS_END | CS_INT);
+	DMA_WRITE(channel, debug, DEBUG_ERRORS);
+}
+
+/*
+ * Copy out what the engine has done
+ */
+void dma_get_stats(struct dma_stats_t *ret)
+{
+	memcpy(ret, &stats, sizeof(struct dma_stats_t));
+}
@@ -15,8 +15,7 @@
  * The Raspberry Pi's EMMC implements the MMCA 4.4 and SDHCI 3.0
  * specifications, however this driver only supports SD (mostly because I
  * don't have an mmc card). The driver is exceedingly simple, providing
- * functions to initialize an SD card and perform single block reads and
- * writes.
+ * functions to initialize an SD card and read and write blocks.
  *
  * The (SD) host controller must be reset and initialized at start up and
  * each time a card is inserted. We have to:
@@ -32,28 +31,85 @@
  *	4. send the host's OCR register with SD_SEND_OP_COND (ACMD41)
  *	5. get the card's CID register with ALL_SEND_CID (CMD2)
  *	6. get the card's RCA with SEND_RELATIVE_ADDR (CMD3)
- *	7. select the card with SELECT_CARD (CMD7)
+ *	7. get the card's CSD register with SEND_CSD (CMD9)
+ *	8. select the card with SELECT_CARD (CMD7)
  * 
  * The card is now ready for data transfer operations. The default block
  * length for transfers is 512 bytes.
  *
+ * The card starts out on a 1 bit bus at no more than 25 MHz. We read its
+ * SCR register with SEND_SCR (ACMD51) to find whether it has 4 data lines
+ * and whether it knows SWITCH_FUNC (CMD6), then:
+ *	1. widen the bus with SET_BUS_WIDTH (ACMD6) and the host's DWIDTH bit
+ *	2. ask SWITCH_FUNC whether the card has high speed mode and switch
+ *	   to it, then set the host's HS_EN bit and run the clock at 50 MHz
+ * Each step is checked by reading the SCR again over the new bus and
+ * undone if that fails, so a card or board that cannot keep up is left
+ * at the fastest setting that works. A card without high speed mode runs
+ * at the rate its CSD gives, up to 25 MHz.
+ *
+ * A run of blocks is moved with a single READ_MULTIPLE_BLOCK (CMD18) or
+ * WRITE_MULTIPLE_BLOCK (CMD25). The host's block counter is loaded with
+ * the length of the run and the host sends STOP_TRANSMISSION (CMD12) on
+ * its own once the counter runs out (auto CMD12), so a run costs one
+ * command instead of one per block. We do not use SET_BLOCK_COUNT (CMD23)
+ * since SD cards are not required to support it.
+ *
+ * Command and transfer completion is signalled by interrupt. The host
+ * raises IRQ_EMMC for every flag enabled in INT_EN, and the service
+ * routine moves the flags into emmc_events and acknowledges them. A caller
+ * waiting on a flag sleeps until the next interrupt, or runs the routine
+ * given to emmc_set_idle() so it can get on with other work, with the
+ * system timer set to wake it at the deadline. Waits on STATUS and
+ * CONTROL1, which raise no interrupt, spin on the register backing off
+ * from 1 us to POLL_MAX us between reads. emmc_get_stats() reports how
+ * long the waits take.
+ *
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
  */
 
 #define MODULE EMMC
 
+#include <blockdev.h>
+#include <dma.h>
+#include <emmc.h>
+#include <errno.h>
+#include <irq.h>
 #include <mailbox.h>
 #include <platform.h>
+#include <string.h>
 #include <timer.h>
 #include <util.h>
 #include <log.h>
 
+/*
+ * Register access, on the host the registers are modelled by the
+ * simulator in test/emmc_sim.c
+ */
+#ifdef EMMC_SIM
+#include "emmc_sim.h"
+static volatile emmc_reg_t *emmc_reg = &emmc_sim_reg;
+#define emmc_read_reg(reg) emmc_sim_read(reg)
+#define emmc_write_reg(reg, val) emmc_sim_write(reg, val)
+#else
 static volatile emmc_reg_t *emmc_reg = (emmc_reg_t *)EMMC_BASE;
+#define emmc_read_reg(reg) (*(reg))
+#define emmc_write_reg(reg, val) (*(reg) = (val))
+#endif
+
+#define EMMC_READ(field) emmc_read_reg(&emmc_reg->field)
+#define EMMC_WRITE(field, val) emmc_write_reg(&emmc_reg->field, val)
 
 #define IDENT_FREQ	400000		/* clock frequency during initialization */
-#define OPER_FREQ	20000000	/* clock frequency during normal operation */
+#define OPER_FREQ	20000000	/* clock frequency if the CSD gives none */
+#define DEFAULT_FREQ	25000000	/* fastest clock in default speed mode */
+#define HS_FREQ		50000000	/* clock frequency in high speed mode */
 #define BLOCK_SIZE	512			/* block size in bytes */
 #define TIMEOUT		100			/* default timeout in ms */
+#define POLL_MIN	1			/* first delay between polls in us */
+#define POLL_MAX	256			/* longest delay between polls in us */
+#define EMMC_DMA_CHANNEL	4	/* DMA channel for data transfers */
+#define EMMC_DMA_CBS		32	/* control blocks in a transfer */
  
 /*
  * MMC/SD commands (defined by MMCA 4.4 and SDHCI 3.0)
@@ -61,14 +117,21 @@ static volatile emmc_reg_t *emmc_reg = (emmc_reg_t *)EMMC_BASE;
 #define GO_IDLE_STATE		0	/* reset the card to idle state */
 #define ALL_SEND_CID		2	/* request CID */
 #define SEND_RELATIVE_ADDR	3	/* request RCA */
+#define SWITCH_FUNC			6	/* check or switch card function */
 #define SELECT_CARD			7	/* select a card by RCA */
 #define SD_SEND_IF_COND		8	/* get card voltage */
+#define SEND_CSD			9	/* request CSD */
 #define SET_BLOCKLEN		16	/* set block length (SDSC only) */
+#define STOP_TRANSMISSION	12	/* end a multiple block transfer */
 #define READ_SINGLE_BLOCK	17	/* read a single block of data */
+#define READ_MULTIPLE_BLOCK	18	/* read blocks until stopped */
 #define WRITE_BLOCK			24	/* write a single block of data */
+#define WRITE_MULTIPLE_BLOCK	25	/* write blocks until stopped */
 
 #define APP_CMD				55	/* next command is application specific */
 #define	SD_SEND_OP_COND		41	/* get OCR register from SD card */
+#define SET_BUS_WIDTH		6	/* set data bus width */
+#define SEND_SCR			51	/* request SCR */
 
 /*
  * bitmasks for the CMDTM register
@@ -95,7 +158,7 @@ static volatile emmc_reg_t *emmc_reg = (emmc_reg_t *)EMMC_BASE;
 #define CMD_INDEX	0x1F00000	/* command index */
 
 #define CMD_MASK	0xFF000000	/* mask command index */
-#define CMD_SHIFT(x) (x << 24)	/* shift value for command index */
+#define CMD_SHIFT(x) ((x) << 24)	/* shift value for command index */
 
 /*
  * bitmasks for the control registers
@@ -109,8 +172,17 @@ static volatile emmc_reg_t *emmc_reg = (emmc_reg_t *)EMMC_BASE;
 #define CTRL_CLK_EN		0x4			/* enable the clock */
 #define CTRL_CLK_GEN	0x20		/* clock generation mode */
 
+/*
+ * CONTROL0 register fields
+ */
+#define C0_HCTL_DWIDTH	0x2			/* use 4 data lines */
+#define C0_HCTL_HS_EN	0x4			/* high speed mode timing */
+
 #define SHIFT_TIMEOUT(x) (x << 0x10)
-#define SHIFT_CLK_GEN(x) ((x & 0xFF) << 0x8 | (x & 0x300) << 0x2)
+#define SHIFT_BLKCNT(x) (x << 0x10)
+#define MAX_BLKCNT	0xFFFF		/* largest count of the block counter */
+#define SHIFT_CLK_GEN(x) (((x) & 0xFF) << 0x8 | ((x) & 0x300) >> 0x2)
+#define MAX_CLK_DIV	0x3FF		/* largest 10 bit clock divider */
 
 /*
  * bitmasks for the status register
@@ -147,6 +219,7 @@ static volatile emmc_reg_t *emmc_reg = (emmc_reg_t *)EMMC_BASE;
 #define INT_DEND_ERR	0x400000	/* end bit on DAT not 1 */
 #define INT_ACMD_ERR	0x1000000	/* auto command error */
 #define INT_MASK_ALL	0x017F7137	/* mask all supported interrupts */
+#define INT_ERR_ALL		0xFFFF8000	/* error and its causes */
 
 /*
  * OCR fields
@@ -162,101 +235,183 @@ static volatile emmc_reg_t *emmc_reg = (emmc_reg_t *)EMMC_BASE;
  */
 #define R1_ERRORS		0xFFF90000	/* mask all error bits */
 
+/*
+ * card registers, numbered from the first byte the card sends
+ */
+#define SCR_SIZE		8			/* bytes in the SCR */
+#define SCR_SD_SPEC(scr)	((scr)[0] & 0xF)	/* 0 for SD 1.0 and 1.01 */
+#define SCR_BUS_4BIT(scr)	((scr)[1] & 0x4)	/* card has 4 data lines */
+#define SWITCH_SIZE		64			/* bytes of SWITCH_FUNC status */
+#define SWITCH_HS(st)	((st)[13] & 0x2)	/* group 1 has high speed */
+#define SWITCH_FN1(st)	((st)[16] & 0xF)	/* group 1 function, 0xF if none */
+#define SWITCH_CHECK	0x00FFFFF1	/* check for high speed, no change */
+#define SWITCH_SET		0x80FFFFF1	/* switch to high speed */
+#define CSD_TRAN_SPEED(resp2)	((resp2) >> 24)	/* CSD[103:96] */
+
+/* TRAN_SPEED is a time value scaled by a unit, both in tenths */
+static const unsigned tran_unit[4] = { 10000, 100000, 1000000, 10000000 };
+static const unsigned tran_value[16] = {
+	0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80
+};
+
 static int capacity;
 static int rca;
+static struct emmc_stats_t stats;
+
+static volatile uint32_t emmc_events;	/* flags taken from INTERRUPT */
+static emmc_idle_t emmc_idle;		/* run while waiting, if set */
+static uint32_t emmc_int_mask;		/* flags enabled in INT_MASK, INT_EN */
+
+static int emmc_dma_ready;		/* the DMA channel is set up */
+static int emmc_dma;			/* use it */
+static struct dma_cb_t emmc_dma_cbs[EMMC_DMA_CBS];
 
 /*
- * get EMMC clock state from VideoCore
+ * get EMMC clock base rate from VideoCore, returns 0 if the clock is not
+ * running; the VideoCore is only asked once per boot
  */
-static unsigned emmc_get_clock_state()
+static unsigned emmc_get_clock()
 {
-	unsigned buf[8] __attribute__ ((aligned (16)));
-
-	/* property tag buffer */
-	buf[0] = 32;		/* size of buffer */
-	buf[1] = 0;			/* this is a request buffer */
-	/* begin tag */
-	buf[2] = 0x30001;	/* request clock state */
-	buf[3] = 8;			/* total size of value buffer */
-	buf[4] = 4;			/* size of request value buffer */
-	/* value buffer */
-	buf[5] = 1;			/* EMMC clock ID */
-	buf[6] = 0;			/* leave room for response */
-	/* end tag */
-	buf[7] = 0;	
-
-	mailbox_write(MBOX_CHAN_PROP, (unsigned)buf);
-	mailbox_read(MBOX_CHAN_PROP, buf);
+	unsigned rate;
+	int on;
 
-	if (buf[1] != MBOX_PROP_OK) {
+	on = mailbox_clock_on(MBOX_CLOCK_EMMC);
+	if (on == -EIO) {
 		log(ERROR, "bad response from mailbox");
-		return -1;
-	} else if (buf[6] & 2) {
+		return 0;
+	} else if (on < 0) {
 		log(ERROR, "clock not found");
-		return -1;
-	} else if (!(buf[6] & 1)) {
+		return 0;
+	} else if (!on) {
 		log(ERROR, "clock not on");
-		return -1;
+		return 0;
+	}
+
+	if ((rate = mailbox_clock_rate(MBOX_CLOCK_EMMC)) == 0) {
+		log(ERROR, "clock not found");
+		return 0;
 	}
 
-	log(DEBUG, "clock is on");
+	log(DEBUG, "clock base rate is %u Hz", rate);
 
-	return 0;
+	return rate;
 }
 
 /*
- * get EMMC clock rate from VideoCore
+ * busy wait with timeout (in ms), returns the time waited in us
  */
-static unsigned emmc_get_clock_rate()
+static int emmc_timeout(volatile uint32_t *reg, unsigned mask, unsigned cond, int timeout)
 {
-	unsigned buf[8] __attribute__ ((aligned (16)));
+	unsigned start, elapsed, delay = 0;
 
-	/* property tag buffer */
-	buf[0] = 32;		/* size of buffer */
-	buf[1] = 0;			/* this is a request buffer */
-	/* begin tag */
-	buf[2] = 0x30002;	/* request clock state */
-	buf[3] = 8;			/* total size of value buffer */
-	buf[4] = 4;			/* size of request value buffer */
-	/* value buffer */
-	buf[5] = 1;			/* EMMC clock ID */
-	buf[6] = 0;			/* leave room for response */
-	/* end tag */
-	buf[7] = 0;	
+	start = timer_read();
 
-	mailbox_write(MBOX_CHAN_PROP, (unsigned)buf);
-	mailbox_read(MBOX_CHAN_PROP, buf);
+	/* loop until the masked register equals the condition */
+	while ((emmc_read_reg(reg) & mask) != cond) {
+		elapsed = timer_read() - start;
+		if (elapsed >= timeout * 1000) {
+			++stats.timeouts;
+			return -1;
+		}
 
-	if (buf[1] != MBOX_PROP_OK) {
-		log(ERROR, "bad response from mailbox");
-		return 0;
-	} else if (buf[6] == 0) {
-		log(ERROR, "clock not found");
-		return 0;
+		/* spin, then back off so a slow card is not hammered */
+		if (delay > 0)
+			timer_wait(delay);
+		delay = delay == 0 ? POLL_MIN : MIN(2 * delay, POLL_MAX);
 	}
 
-	log(DEBUG, "clock base rate is %u Hz", buf[6]);
+	return timer_read() - start;
+}
+
+/*
+ * move flags raised by the host into emmc_events and acknowledge them
+ */
+static void emmc_collect_events()
+{
+	uint32_t reg;
+
+	reg = EMMC_READ(interrupt);
+	if (reg) {
+		EMMC_WRITE(interrupt, reg);
+		emmc_events |= reg;
+	}
+}
 
-	return buf[6];
+/*
+ * EMMC interrupt service routine
+ */
+static void emmc_service_irq()
+{
+	++stats.irqs;
+	emmc_collect_events();
 }
 
 /*
- * busy wait with timeout (in ms)
+ * take flags out of emmc_events, returning those that were set
  */
-static int emmc_timeout(volatile uint32_t *reg, unsigned mask, unsigned cond, int timeout)
+static uint32_t emmc_take_events(uint32_t mask)
 {
-	int i = 0;
+	uint32_t ret;
+	unsigned state;
 
-	/* loop until the masked register equals the condition */
-	while ((*reg & mask) != cond) {
-		if (i++ >= timeout)
-			return -1;
+	state = irq_save();
+	ret = emmc_events & mask;
+	emmc_events &= ~mask;
+	irq_restore(state);
 
-		/* delay 1 ms */
-		timer_wait(1000);
+	return ret;
+}
+
+/*
+ * wait for any of the flags in mask, or an error, to be raised with
+ * timeout (in ms), returns the time waited in us
+ *
+ * The flags are consumed, an error is left in emmc_events for the caller.
+ * Between checks the idle routine runs if there is one, otherwise the CPU
+ * sleeps until an interrupt, with the system timer set to wake it at the
+ * deadline.
+ */
+static int emmc_wait(uint32_t mask, int timeout)
+{
+	unsigned start, deadline, state;
+
+	start = timer_read();
+	deadline = start + timeout * 1000;
+
+	for (;;) {
+		state = irq_save();
+		if (emmc_events & (mask | INT_ERROR)) {
+			emmc_events &= ~mask;
+			irq_restore(state);
+			return emmc_events & INT_ERROR ? -1 : timer_read() - start;
+		}
+		if (timer_read() - start >= timeout * 1000) {
+			irq_restore(state);
+			++stats.timeouts;
+			return -1;
+		}
+
+		if (emmc_idle) {
+			irq_restore(state);
+			emmc_idle();
+			continue;
+		}
+
+		/* sleep, the interrupt is taken once IRQs are restored */
+		++stats.sleeps;
+		timer_set_alarm(deadline);
+		if (timer_read() - start < timeout * 1000)
+			irq_wait();
+		irq_restore(state);
 	}
+}
 
-	return i;
+/*
+ * run a routine instead of sleeping while waiting on the card
+ */
+void emmc_set_idle(emmc_idle_t idle)
+{
+	emmc_idle = idle;
 }
 
 /*
@@ -265,11 +420,10 @@ static int emmc_timeout(volatile uint32_t *reg, unsigned mask, unsigned cond, in
 static int emmc_host_reset()
 {
 	unsigned reg;
-	int i = 0;
 
 	/* set the software reset bits */
 	log(DEBUG, "writing 0x%x to CTRL1 (software reset)", reg);
-	emmc_reg->ctrl_1 |= CTRL_RESET_ALL;
+	EMMC_WRITE(ctrl_1, EMMC_READ(ctrl_1) | CTRL_RESET_ALL);
 
 	/* host will clear the reset bit when it is done */
 	if (emmc_timeout(&emmc_reg->ctrl_1, CTRL_RESET_ALL, 0, TIMEOUT) < 0) {
@@ -288,28 +442,28 @@ static int emmc_host_reset()
 static int emmc_set_clock(unsigned base, unsigned freq)
 {
 	unsigned reg, div;
-	int i = 0;
 
 	/* turn off the clock */
-	reg = emmc_reg->ctrl_1;
+	reg = EMMC_READ(ctrl_1);
 	reg &= ~CTRL_CLK_MASK;
 	log(DEBUG, "writing 0x%x to CTRL1 (disable clock)", reg);
-	emmc_reg->ctrl_1 = reg;
+	EMMC_WRITE(ctrl_1, reg);
 
-	/* approximate the desired clock frequency */
+	/* in divided mode freq = base / (2 * div), take the smallest div that
+	 * does not run the card faster than asked */
 	if (freq >= base) {
 		div = 0;
 	} else {
-		div = 1;
-		/* ARM does not have integer division so... */
-		/*while (freq < base / (2 * div))*/
-			/*++div;*/
-		while (freq < (base >> div))
-			++div;
-		/* in divided mode freq = base / (2 * div) so add one back to div */
-		div = 1 << (div-2);
+		div = (base + 2 * freq - 1) / (2 * freq);
+		if (div > MAX_CLK_DIV) {
+			log(ERROR, "cannot divide %u Hz down to %u Hz", base, freq);
+			div = MAX_CLK_DIV;
+		}
 		log(DEBUG, "frequency divider = %u", div);
 	}
+	stats.clock_hz = div ? base / (2 * div) : base;
+	stats.clock_target_hz = freq;
+	log(INFO, "clock %u Hz, asked for %u Hz", stats.clock_hz, freq);
 
 	/* set the clock frequency in 'divided clock' mode */
 	reg &= ~CTRL_CLK_GEN;
@@ -320,12 +474,12 @@ static int emmc_set_clock(unsigned base, unsigned freq)
 	reg |= SHIFT_TIMEOUT(0x7);
 
 	/* write clock parameters to EMMC */
-	emmc_reg->ctrl_1 = reg;
+	EMMC_WRITE(ctrl_1, reg);
 
 	/* enable internal clock */
 	reg |= CTRL_INTCLK_EN;
 	log(DEBUG, "writing 0x%x to CTRL1 (enable internal clock)", reg);
-	emmc_reg->ctrl_1 = reg;
+	EMMC_WRITE(ctrl_1, reg);
 
 	/* host will set the stable bit when the clock is ready */
 	if (emmc_timeout(&emmc_reg->ctrl_1, CTRL_STABLE, CTRL_STABLE, TIMEOUT) < 0) {
@@ -337,7 +491,7 @@ static int emmc_set_clock(unsigned base, unsigned freq)
 
 	/* enable clock on the bus */
 	log(DEBUG, "writing 0x%x to CTRL1 (enable bus clock)", reg);
-	emmc_reg->ctrl_1 |= CTRL_CLK_EN;
+	EMMC_WRITE(ctrl_1, EMMC_READ(ctrl_1) | CTRL_CLK_EN);
 
 	log(INFO, "clock enabled");
 
@@ -350,6 +504,7 @@ static int emmc_set_clock(unsigned base, unsigned freq)
 static int emmc_send_command(unsigned cmd, unsigned arg)
 {
 	unsigned reg;
+	int wait;
 
 	/* wait for CMD line */
 	if (emmc_timeout(&emmc_reg->status, ST_CMD_BUSY, 0, TIMEOUT) < 0) {
@@ -357,37 +512,38 @@ static int emmc_send_command(unsigned cmd, unsigned arg)
 		return -1;
 	}
 
-	/* TODO: handle busy and abort commands */
+	/* TODO: handle busy commands */
 
-	/* wait for DAT line */
-	if (emmc_timeout(&emmc_reg->status, ST_DAT_BUSY, 0, TIMEOUT) < 0) {
+	/* wait for DAT line, an abort command is sent to free it */
+	if ((cmd & CMD_TYPE) != CMD_ABORT &&
+			emmc_timeout(&emmc_reg->status, ST_DAT_BUSY, 0, TIMEOUT) < 0) {
 		log(ERROR, "timed out waiting for DAT line");
 		return -1;
 	}
 
 	/* set the argument */
 	log(DEBUG, "writing 0x%x to ARG1", arg);
-	emmc_reg->arg_1 = arg;
+	EMMC_WRITE(arg_1, arg);
 
 	/* prepare and send the command */
 	/**(unsigned *)(EMMC_CMDTM) = cmd & ~CMD_MASK;*/
 	log(DEBUG, "writing 0x%x to CMDTM", cmd);
-	emmc_reg->cmd_tm = cmd;
+	EMMC_WRITE(cmd_tm, cmd);
 
 	/* wait for command done interrupt */
-	emmc_timeout(&emmc_reg->interrupt, INT_CMD_DONE, INT_CMD_DONE, TIMEOUT);
-
-	/* TODO: error check */
-	if (emmc_reg->interrupt & INT_ERROR) {
+	wait = emmc_wait(INT_CMD_DONE, TIMEOUT);
+	if (wait < 0) {
+		/* the error was acknowledged when it was collected */
+		reg = emmc_take_events(INT_ERR_ALL | INT_CMD_DONE);
 		log(ERROR, "error sending command. INTERRUPT: 0x%x", reg);
 		return -1;
 	}
 
+	++stats.commands;
+	stats.command_us += wait;
+	stats.command_max_us = MAX(stats.command_max_us, wait);
 	log(DEBUG, "command sent successfully");
 
-	/* clear command done interrupt */
-	emmc_reg->interrupt = INT_CMD_DONE;
-
 	return 0;
 }
 
@@ -417,17 +573,176 @@ static int emmc_send_app_command(unsigned acmd, unsigned arg)
 	return 0;
 }
 
+/*
+ * read a register of fewer than 512 bytes that the card sends on the DAT
+ * lines (SCR, SWITCH_FUNC status) with the CPU
+ */
+static int emmc_read_card_reg(unsigned cmd, unsigned arg, int app,
+		unsigned *buf, unsigned len)
+{
+	unsigned i, resp;
+	int ret;
+
+	EMMC_WRITE(blksizcnt, SHIFT_BLKCNT(1) | len);
+	cmd |= TM_DATDIR | CMD_SHORT | CMD_CRC_CK | CMD_I_CK | CMD_DATA;
+	ret = app ? emmc_send_app_command(cmd, arg) : emmc_send_command(cmd, arg);
+	if (ret < 0)
+		return -1;
+
+	resp = EMMC_READ(resp_0);
+	if (resp & R1_ERRORS) {
+		log(ERROR, "card refused command - bad response: 0x%x", resp);
+		return -1;
+	}
+
+	if (emmc_wait(INT_RD_READY, TIMEOUT) < 0)
+		goto fail;
+	for (i=0; i<len; i+=4)
+		*buf++ = EMMC_READ(data);
+	if (emmc_wait(INT_DAT_DONE, TIMEOUT) < 0)
+		goto fail;
+
+	return 0;
+
+fail:
+	log(ERROR, "error reading card register. INTERRUPT: 0x%x",
+			emmc_take_events(INT_ERR_ALL));
+	EMMC_WRITE(ctrl_1, EMMC_READ(ctrl_1) | CTRL_RESET_DAT);
+	emmc_timeout(&emmc_reg->ctrl_1, CTRL_RESET_DAT, 0, TIMEOUT);
+	emmc_take_events(INT_RD_READY | INT_DAT_DONE);
+	return -1;
+}
+
+/*
+ * read the SCR again and check that it came through unchanged, which it
+ * will not if the card and host disagree about the bus
+ */
+static int emmc_check_bus(const unsigned *scr)
+{
+	unsigned check[SCR_SIZE / 4];
+
+	if (emmc_read_card_reg(CMD_SHIFT(SEND_SCR), 0, 1, check, SCR_SIZE) < 0)
+		return -1;
+	return check[0] == scr[0] && check[1] == scr[1] ? 0 : -1;
+}
+
+/*
+ * tell the card and then the host to use 1 or 4 data lines
+ */
+static int emmc_set_bus_width(int four)
+{
+	unsigned cmd, reg;
+
+	cmd = CMD_SHIFT(SET_BUS_WIDTH) | CMD_SHORT | CMD_CRC_CK | CMD_I_CK;
+	log(DEBUG, "sending SET_BUS_WIDTH to card");
+	if (emmc_send_app_command(cmd, four ? 2 : 0) < 0)
+		return -1;
+	if (EMMC_READ(resp_0) & R1_ERRORS) {
+		log(ERROR, "card refused bus width. RESP0: 0x%x", EMMC_READ(resp_0));
+		return -1;
+	}
+
+	reg = EMMC_READ(ctrl_0) & ~C0_HCTL_DWIDTH;
+	EMMC_WRITE(ctrl_0, reg | (four ? C0_HCTL_DWIDTH : 0));
+
+	return 0;
+}
+
+/*
+ * switch the card to high speed mode if it has it
+ */
+static int emmc_switch_high_speed()
+{
+	unsigned status[SWITCH_SIZE / 4];
+	unsigned char *st = (unsigned char *)status;
+	unsigned cmd;
+
+	cmd = CMD_SHIFT(SWITCH_FUNC);
+	log(DEBUG, "sending SWITCH_FUNC (check) to card");
+	if (emmc_read_card_reg(cmd, SWITCH_CHECK, 0, status, SWITCH_SIZE) < 0)
+		return -1;
+	if (!SWITCH_HS(st) || SWITCH_FN1(st) != 1) {
+		log(INFO, "card does not have high speed mode");
+		return -1;
+	}
+
+	log(DEBUG, "sending SWITCH_FUNC (switch) to card");
+	if (emmc_read_card_reg(cmd, SWITCH_SET, 0, status, SWITCH_SIZE) < 0)
+		return -1;
+	if (SWITCH_FN1(st) != 1) {
+		log(ERROR, "card did not switch to high speed mode");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * get the fastest default speed clock frequency from the CSD, in Hz
+ */
+static unsigned emmc_csd_freq(unsigned resp2)
+{
+	unsigned speed, freq;
+
+	speed = CSD_TRAN_SPEED(resp2);
+	freq = tran_unit[speed & 0x3] * tran_value[(speed >> 3) & 0xF];
+	if (freq == 0 || speed & 0x4)
+		return OPER_FREQ;
+	return MIN(freq, DEFAULT_FREQ);
+}
+
+/*
+ * move the card from a 1 bit bus at identification speed to the widest
+ * bus and fastest clock that both it and the host can manage
+ */
+static void emmc_configure_bus(unsigned base, unsigned freq)
+{
+	unsigned scr[SCR_SIZE / 4];
+	unsigned char *sc = (unsigned char *)scr;
+	int four = 0, hs;
+
+	emmc_set_clock(base, freq);
+
+	log(DEBUG, "sending SEND_SCR to card");
+	if (emmc_read_card_reg(CMD_SHIFT(SEND_SCR), 0, 1, scr, SCR_SIZE) < 0) {
+		log(ERROR, "could not read SCR, staying on 1 bit bus");
+		return;
+	}
+
+	/* widen the bus */
+	if (SCR_BUS_4BIT(sc) && emmc_set_bus_width(1) == 0) {
+		four = emmc_check_bus(scr) == 0;
+		if (!four) {
+			log(ERROR, "4 bit bus failed, going back to 1 bit");
+			emmc_set_bus_width(0);
+		}
+	}
+
+	/* speed up the clock, SWITCH_FUNC is new in SD 1.10 */
+	if (SCR_SD_SPEC(sc) >= 1 && emmc_switch_high_speed() == 0) {
+		EMMC_WRITE(ctrl_0, EMMC_READ(ctrl_0) | C0_HCTL_HS_EN);
+		emmc_set_clock(base, HS_FREQ);
+		hs = emmc_check_bus(scr) == 0;
+		if (!hs) {
+			log(ERROR, "high speed mode failed, slowing down");
+			EMMC_WRITE(ctrl_0, EMMC_READ(ctrl_0) & ~C0_HCTL_HS_EN);
+			emmc_set_clock(base, freq);
+		}
+	}
+
+	log(INFO, "%d bit bus at %u Hz", four ? 4 : 1, stats.clock_hz);
+}
+
 /*
  * initialize EMMC host
  */
 int emmc_init()
 {
-	unsigned cmd, arg, reg, resp, base_freq;
+	unsigned cmd, arg, reg, resp, base_freq, freq;
 
 	/* get the EMMC clock base rate */
-	if (emmc_get_clock_state() != 0)
+	if ((base_freq = emmc_get_clock()) == 0)
 		return -1;
-	base_freq = emmc_get_clock_rate();
 
 	/* reset the EMMC */
 	emmc_host_reset();
@@ -443,14 +758,25 @@ int emmc_init()
 	emmc_set_clock(base_freq, IDENT_FREQ);
 
 	/* do not send interrupts to the ARM core */
-	emmc_reg->int_enbl = 0;
+	EMMC_WRITE(int_enbl, 0);
 
 	/* clear interrupt status register */
-	emmc_reg->interrupt = 0xFFFFFFFF;
+	EMMC_WRITE(interrupt, 0xFFFFFFFF);
+	emmc_take_events(0xFFFFFFFF);
 
 	/* send interrupts to the INTERRUPT register */
 	log(DEBUG, "writing 0x%x to INT_MASK (enable interrupt flags)", reg);
-	emmc_reg->int_mask = INT_MASK_ALL;
+	EMMC_WRITE(int_mask, INT_MASK_ALL);
+
+	/* and on to the ARM core */
+	irq_register_service_routine(emmc_service_irq, IRQ_EMMC);
+	irq_enable(IRQ_EMMC);
+	EMMC_WRITE(int_enbl, INT_MASK_ALL);
+	emmc_int_mask = INT_MASK_ALL;
+
+	/* data is moved by DMA if a channel can be had */
+	emmc_dma_ready = dma_init(EMMC_DMA_CHANNEL) == 0;
+	emmc_dma = emmc_dma_ready;
 
 	/* reset card with */
 	arg = 0;
@@ -467,11 +793,11 @@ int emmc_init()
 		return -1;
 
 	/* check whether card can run on host's supply voltage */
-	resp = emmc_reg->resp_0;
+	resp = EMMC_READ(resp_0);
 	if (!(resp & 0x100)) {
 		log(ERROR, "card voltage not supported. RESP0: 0x%x", resp);
 		return -1;
-	} else if (resp & 0xFF != 0xAA) {
+	} else if ((resp & 0xFF) != 0xAA) {
 		log(ERROR, "bad check pattern. Expected 0xAA, found 0x%x", resp);
 		return -1;
 	}
@@ -484,7 +810,7 @@ int emmc_init()
 		return -1;
 
 	/* get card capacity from OCR */
-	resp = emmc_reg->resp_0;
+	resp = EMMC_READ(resp_0);
 	if (resp & OCR_BUSY && resp & OCR_CAPACITY)
 		capacity = 1;
 	else
@@ -500,7 +826,7 @@ int emmc_init()
 		if (emmc_send_app_command(cmd, arg) < 0)
 			return -1;
 		timer_wait(10000);
-		resp = emmc_reg->resp_0;
+		resp = EMMC_READ(resp_0);
 	} while (!(resp & OCR_BUSY));
 	log(DEBUG, "card returned 0x%x", resp);
 
@@ -513,7 +839,7 @@ int emmc_init()
 	
 	/* check response to ALL_SEND_CID */
 	/* TODO: store CID? */
-	resp = emmc_reg->resp_0;
+	resp = EMMC_READ(resp_0);
 	log(DEBUG, "card returned 0x%x", resp);
 
 	/* request card's RCA */
@@ -524,9 +850,18 @@ int emmc_init()
 		return -1;
 	
 	/* retrieve RCA */
-	resp = emmc_reg->resp_0;
+	resp = EMMC_READ(resp_0);
 	rca = resp & 0xFFFF0000;
 	log(DEBUG, "card returned 0x%x", resp);
+
+	/* request card's CSD register for its clock rate */
+	cmd = CMD_SHIFT(SEND_CSD) | CMD_LONG | CMD_CRC_CK;
+	arg = rca;
+	log(DEBUG, "sending SEND_CSD to card");
+	if (emmc_send_command(cmd, arg) < 0)
+		return -1;
+	freq = emmc_csd_freq(EMMC_READ(resp_2));
+	log(DEBUG, "card returned 0x%x", EMMC_READ(resp_2));
 	
 	/* select card by RCA */
 	cmd = CMD_SHIFT(SELECT_CARD) | CMD_BUSY | CMD_CRC_CK | CMD_I_CK;
@@ -535,7 +870,7 @@ int emmc_init()
 		return -1;
 	
 	/* TODO: check card status */
-	resp = emmc_reg->resp_0;
+	resp = EMMC_READ(resp_0);
 	log(DEBUG, "card returned 0x%x", resp);
 
 	/* set the block length to 512 bytes (only affects SDSC) */
@@ -546,111 +881,361 @@ int emmc_init()
 		return -1;
 	
 	/* TODO: check response */
-	resp = emmc_reg->resp_0;
+	resp = EMMC_READ(resp_0);
 	log(DEBUG, "card returned 0x%x", resp);
 
-	/* set the clock to operating frequency */
-	emmc_set_clock(base_freq, OPER_FREQ);
+	/* set the bus width and clock to operating frequency */
+	emmc_configure_bus(base_freq, freq);
 
 	log(INFO, "SD card initialized");
 	return 0;
 }
 
 /*
- * read single block from card
+ * stop a multiple block transfer that went wrong
  */
-int emmc_read_block(unsigned block, void *void_buf)
+static void emmc_stop_transfer()
+{
+	unsigned cmd;
+
+	cmd = CMD_SHIFT(STOP_TRANSMISSION) | CMD_ABORT | CMD_BUSY | CMD_CRC_CK
+		| CMD_I_CK;
+	log(DEBUG, "sending STOP_TRANSMISSION to card");
+	emmc_send_command(cmd, 0);
+
+	/* drop whatever is left of the transfer */
+	EMMC_WRITE(ctrl_1, EMMC_READ(ctrl_1) | CTRL_RESET_DAT);
+	emmc_timeout(&emmc_reg->ctrl_1, CTRL_RESET_DAT, 0, TIMEOUT);
+	emmc_take_events(INT_RD_READY | INT_WR_READY | INT_DAT_DONE | INT_ERR_ALL);
+}
+
+/*
+ * start a transfer of count blocks, more than one block uses the multiple
+ * block command with the block counter and an automatic STOP_TRANSMISSION
+ */
+static int emmc_start_transfer(unsigned block, unsigned count, int write)
 {
-	unsigned cmd, resp, i;
-	unsigned *buf = (unsigned *)void_buf;
+	unsigned cmd, resp;
 
-	/* set the transfer block size */
-	emmc_reg->blksizcnt = BLOCK_SIZE; /* FIXME ??? */
+	/* set the transfer block size and count */
+	EMMC_WRITE(blksizcnt, SHIFT_BLKCNT(count) | BLOCK_SIZE);
 
-	/* prepare read command with block number as argument */
-	cmd = CMD_SHIFT(READ_SINGLE_BLOCK) | TM_DATDIR | CMD_SHORT | CMD_CRC_CK
-		| CMD_I_CK | CMD_DATA;
-	log(DEBUG, "sending READ_SINGLE_BLOCK to card");
-	emmc_send_command(cmd, block);
+	if (count == 1)
+		cmd = CMD_SHIFT(write ? WRITE_BLOCK : READ_SINGLE_BLOCK);
+	else
+		cmd = CMD_SHIFT(write ? WRITE_MULTIPLE_BLOCK : READ_MULTIPLE_BLOCK)
+			| TM_MULTIBLK | TM_BLKCNT | TM_CMD12;
+	cmd |= (write ? 0 : TM_DATDIR) | CMD_SHORT | CMD_CRC_CK | CMD_I_CK
+		| CMD_DATA;
+	log(DEBUG, "sending %s to card", write ? "WRITE_BLOCK" : "READ_BLOCK");
+	if (emmc_send_command(cmd, block) < 0)
+		return -1;
 
 	/* check response */
-	resp = emmc_reg->resp_0;
+	resp = EMMC_READ(resp_0);
 	if (resp & R1_ERRORS) {
-		log(ERROR, "error reading from SD card - bad response: 0x%x", resp);
+		log(ERROR, "error accessing SD card - bad response: 0x%x", resp);
+		if (count > 1)
+			emmc_stop_transfer();
 		return -1;
 	}
 
-	/* wait for read ready interrupt */
-	if (emmc_timeout(&emmc_reg->interrupt, INT_RD_READY, INT_RD_READY, TIMEOUT) < 0) {
-		log(ERROR, "error reading from SD card - timeout waiting for buffer");
+	return 0;
+}
+
+/*
+ * wait for the end of a transfer
+ */
+static int emmc_end_transfer(unsigned count)
+{
+	if (emmc_wait(INT_DAT_DONE, TIMEOUT) < 0) {
+		log(ERROR, "error accessing SD card - timeout waiting transfer");
+		if (count > 1)
+			emmc_stop_transfer();
+		emmc_take_events(INT_ERR_ALL);
 		return -1;
 	}
-	emmc_reg->interrupt = INT_RD_READY;
 
-	/* get data from host */
-	for (i=0; i<BLOCK_SIZE; i+=4)
-		*buf++ = emmc_reg->data;
+	return 0;
+}
 
-	/* wait for transfer complete interrupt */
-	if (emmc_timeout(&emmc_reg->interrupt, INT_DAT_DONE, INT_DAT_DONE, TIMEOUT) < 0) {
-		log(ERROR, "error reading from SD card - timeout waiting transfer");
-		return -1;
+/*
+ * send interrupts for READ_RDY and WRITE_RDY, not wanted when DMA moves
+ * the data
+ */
+static void emmc_data_irqs(int on)
+{
+	uint32_t mask;
+
+	mask = on ? INT_MASK_ALL : INT_MASK_ALL & ~(INT_RD_READY | INT_WR_READY);
+	if (mask != emmc_int_mask) {
+		EMMC_WRITE(int_mask, mask);
+		EMMC_WRITE(int_enbl, mask);
+		emmc_int_mask = mask;
+	}
+}
+
+/*
+ * move to the next block of a scatter-gather list
+ */
+static void emmc_sg_next(const struct emmc_sg_t *sg, unsigned *seg, unsigned *off,
+		unsigned count)
+{
+	*off += count;
+	if (*off == sg[*seg].count) {
+		++*seg;
+		*off = 0;
 	}
-	emmc_reg->interrupt = INT_DAT_DONE;
+}
 
-	log(DEBUG, "successfully read block 0x%x", block);
+/*
+ * move n blocks through the DATA register
+ */
+static int emmc_pio_data(const struct emmc_sg_t *sg, unsigned *seg,
+		unsigned *off, unsigned n, int write)
+{
+	unsigned i, j, *buf;
+	int wait;
+
+	for (i=0; i<n; i++) {
+		/* the host raises read or write ready for every block */
+		wait = emmc_wait(write ? INT_WR_READY : INT_RD_READY, TIMEOUT);
+		if (wait < 0) {
+			log(ERROR, "error accessing SD card - timeout waiting for buffer");
+			return -1;
+		}
+		stats.block_us += wait;
+
+		while (sg[*seg].count == 0)
+			++*seg;
+		buf = (unsigned *)((char *)sg[*seg].buf + *off * BLOCK_SIZE);
+		if (write)
+			for (j=0; j<BLOCK_SIZE; j+=4)
+				EMMC_WRITE(data, *buf++);
+		else
+			for (j=0; j<BLOCK_SIZE; j+=4)
+				*buf++ = EMMC_READ(data);
+		emmc_sg_next(sg, seg, off, 1);
+	}
 
 	return 0;
 }
 
 /*
- * write single block to card
+ * fill in control blocks for up to max blocks of a scatter-gather list,
+ * returning the number of blocks they cover
  */
-int emmc_write_block(unsigned block, unsigned *buf)
+static unsigned emmc_dma_prepare(const struct emmc_sg_t *sg, unsigned nsg,
+		unsigned *seg, unsigned *off, unsigned max, int write)
 {
-	unsigned cmd, resp, i;
+	unsigned n = 0, k = 0, len;
+	char *p, *end = NULL;
+	uint32_t data, ti;
+
+	data = dma_bus_addr(&emmc_reg->data);
+	ti = DMA_TI_PERMAP(DMA_DREQ_EMMC) | (write ? DMA_TI_SRC_INC |
+			DMA_TI_DEST_DREQ | DMA_TI_WAIT_RESP : DMA_TI_SRC_DREQ |
+			DMA_TI_DEST_INC);
+
+	while (*seg < nsg && n < max) {
+		if (sg[*seg].count == 0) {
+			++*seg;
+			continue;
+		}
+		len = MIN(sg[*seg].count - *off, max - n);
+		p = (char *)sg[*seg].buf + *off * BLOCK_SIZE;
+
+		/* a segment that follows the last in memory shares its block */
+		if (p == end) {
+			emmc_dma_cbs[k-1].txfr_len += len * BLOCK_SIZE;
+		} else if (k == EMMC_DMA_CBS) {
+			break;
+		} else {
+			if (write)
+				dma_cb_init(&emmc_dma_cbs[k], ti, dma_bus_addr(p), data,
+						len * BLOCK_SIZE);
+			else
+				dma_cb_init(&emmc_dma_cbs[k], ti, data, dma_bus_addr(p),
+						len * BLOCK_SIZE);
+			if (k > 0)
+				dma_cb_link(&emmc_dma_cbs[k-1], &emmc_dma_cbs[k]);
+			++k;
+		}
+
+		end = p + len * BLOCK_SIZE;
+		n += len;
+		emmc_sg_next(sg, seg, off, len);
+	}
 
-	log(DEBUG, "entering emmc_write_block()");
+	return n;
+}
 
-	/* set the transfer block size */
-	emmc_reg->blksizcnt = BLOCK_SIZE;
+/*
+ * return true if DMA can move the blocks of a scatter-gather list
+ */
+static int emmc_dma_usable(const struct emmc_sg_t *sg, unsigned nsg)
+{
+	unsigned i;
 
-	/* prepare write command with block number as argument */
-	cmd = CMD_SHIFT(WRITE_BLOCK) | CMD_SHORT | CMD_CRC_CK
-		| CMD_I_CK | CMD_DATA;
-	log(DEBUG, "sending WRITE_BLOCK to card");
-	emmc_send_command(cmd, block);
+	if (!emmc_dma)
+		return 0;
+	for (i=0; i<nsg; i++)
+		if ((unsigned long)sg[i].buf & 0x3)
+			return 0;
+	return 1;
+}
 
-	/* check response */
-	resp = emmc_reg->resp_0;
-	if (resp & R1_ERRORS) {
-		log(ERROR, "error writing to SD card - bad response: 0x%x", resp);
-		return -1;
-	}
+/*
+ * move the blocks of a scatter-gather list, in as few commands as the
+ * block counter and control blocks allow
+ */
+static int emmc_transfer(unsigned block, const struct emmc_sg_t *sg,
+		unsigned nsg, int write)
+{
+	unsigned i, n, left = 0, seg = 0, off = 0;
+	int dma;
 
-	/* wait for write ready interrupt */
-	if (emmc_timeout(&emmc_reg->interrupt, INT_WR_READY, INT_WR_READY, TIMEOUT) < 0) {
-		log(ERROR, "error writing to SD card - timeout waiting for buffer");
-		return -1;
-	}
-	emmc_reg->interrupt = INT_WR_READY;
+	for (i=0; i<nsg; i++)
+		left += sg[i].count;
+	log(DEBUG, "%s %u blocks at 0x%x", write ? "writing" : "reading", left,
+			block);
 
-	/* get data from host */
-	for (i=0; i<BLOCK_SIZE; i+=4)
-		emmc_reg->data = *buf++;
+	dma = emmc_dma_usable(sg, nsg);
+	emmc_data_irqs(!dma);
 
-	/* wait for transfer complete interrupt */
-	if (emmc_timeout(&emmc_reg->interrupt, INT_DAT_DONE, INT_DAT_DONE, TIMEOUT) < 0) {
-		log(ERROR, "error reading from SD card - timeout waiting transfer");
-		return -1;
-	}
-	emmc_reg->interrupt = INT_DAT_DONE;
+	for (; left > 0; block += n, left -= n) {
+		n = MIN(left, MAX_BLKCNT);
+		if (dma)
+			n = emmc_dma_prepare(sg, nsg, &seg, &off, n, write);
+
+		if (emmc_start_transfer(block, n, write) < 0)
+			return -1;
+
+		if (dma) {
+			/* DREQ holds the engine back until the host is ready */
+			if (dma_start(EMMC_DMA_CHANNEL, emmc_dma_cbs) < 0) {
+				log(ERROR, "error starting DMA");
+				emmc_stop_transfer();
+				return -1;
+			}
+			stats.dma_blocks += n;
+		} else if (emmc_pio_data(sg, &seg, &off, n, write) < 0) {
+			if (n > 1)
+				emmc_stop_transfer();
+			emmc_take_events(INT_ERR_ALL);
+			return -1;
+		}
 
-	log(DEBUG, "successfully wrote to block 0x%x", block);
+		if (emmc_end_transfer(n) < 0) {
+			if (dma)
+				dma_abort(EMMC_DMA_CHANNEL);
+			return -1;
+		}
+		if (dma && dma_wait(EMMC_DMA_CHANNEL, TIMEOUT) < 0)
+			return -1;
+		stats.blocks += n;
+	}
 
 	return 0;
 }
 
+/*
+ * read blocks from card into a scatter-gather list
+ */
+int emmc_read_sg(unsigned block, const struct emmc_sg_t *sg, unsigned nsg)
+{
+	return emmc_transfer(block, sg, nsg, 0);
+}
+
+/*
+ * write blocks from a scatter-gather list to card
+ */
+int emmc_write_sg(unsigned block, const struct emmc_sg_t *sg, unsigned nsg)
+{
+	return emmc_transfer(block, sg, nsg, 1);
+}
+
+/*
+ * read blocks from card
+ */
+int emmc_read_blocks(unsigned block, unsigned count, void *void_buf)
+{
+	struct emmc_sg_t sg = { void_buf, count };
+
+	return emmc_transfer(block, &sg, 1, 0);
+}
+
+/*
+ * write blocks to card
+ */
+int emmc_write_blocks(unsigned block, unsigned count, const void *void_buf)
+{
+	struct emmc_sg_t sg = { (void *)void_buf, count };
+
+	return emmc_transfer(block, &sg, 1, 1);
+}
+
+/*
+ * move data with DMA when it can be, or always through DATA
+ */
+void emmc_set_dma(int enable)
+{
+	emmc_dma = enable && emmc_dma_ready;
+}
+
+/*
+ * read single block from card
+ */
+int emmc_read_block(unsigned block, void *void_buf)
+{
+	return emmc_read_blocks(block, 1, void_buf);
+}
+
+/*
+ * write single block to card
+ */
+int emmc_write_block(unsigned block, const void *void_buf)
+{
+	return emmc_write_blocks(block, 1, void_buf);
+}
+
+static int emmc_dev_read(struct blockdev_t *dev, unsigned lba, unsigned count,
+		void *buf)
+{
+	return emmc_read_blocks(lba, count, buf) < 0 ? -EIO : 0;
+}
+
+static int emmc_dev_write(struct blockdev_t *dev, unsigned lba, unsigned count,
+		const void *buf)
+{
+	return emmc_write_blocks(lba, count, buf) < 0 ? -EIO : 0;
+}
+
+static const struct blockdev_ops_t emmc_dev_ops = {
+	.read = emmc_dev_read,
+	.write = emmc_dev_write,
+	.flush = NULL,		/* writes complete before we return */
+	.discard = NULL,	/* no ERASE support */
+};
+
+/*
+ * The SD card as a block device
+ */
+struct blockdev_t emmc_dev = {
+	.name = "emmc",
+	.ops = &emmc_dev_ops,
+	.block_size = BLOCK_SIZE,
+	.num_blocks = 0,
+};
+
+/*
+ * Copy out command and transfer latencies
+ */
+void emmc_get_stats(struct emmc_stats_t *ret)
+{
+	memcpy(ret, &stats, sizeof(struct emmc_stats_t));
+}
+
 /*
  * print a block
  */
@@ -670,23 +1255,23 @@ void emmc_dump_block(unsigned char *block)
 /*
  * dump all EMMC registers
  */
-static void emmc_dump_registers()
+void emmc_dump_registers()
 {
 	kprintf("$>~~~~~ EMMC REGISTER DUMP ~~~~~<$\n");
 
 	kprintf("ARG2: %x, BLKSIZCNT: %x, ARG1: %x, CMDTM: %x\n",
-			emmc_reg->arg_2, emmc_reg->blksizcnt,
-			emmc_reg->arg_1, emmc_reg->cmd_tm);
+			EMMC_READ(arg_2), EMMC_READ(blksizcnt),
+			EMMC_READ(arg_1), EMMC_READ(cmd_tm));
 
 	kprintf("RESP0: %x, RESP1: %x, RESP2: %x, RESP3: %x\n",
-			emmc_reg->resp_0, emmc_reg->resp_1,
-			emmc_reg->resp_2, emmc_reg->resp_3);
+			EMMC_READ(resp_0), EMMC_READ(resp_1),
+			EMMC_READ(resp_2), EMMC_READ(resp_3));
 
 	kprintf("DATA: %x, STATUS: %x, CTRL0: %x, CTRL1: %x\n",
-			emmc_reg->data, emmc_reg->status,
-			emmc_reg->ctrl_0, emmc_reg->ctrl_1);
+			EMMC_READ(data), EMMC_READ(status),
+			EMMC_READ(ctrl_0), EMMC_READ(ctrl_1));
 
 	kprintf("INT_FLAG: %x, INT_MASK: %x, INT_ENBL: %x\n",
-			emmc_reg->interrupt, emmc_reg->int_mask,
-			emmc_reg->int_enbl);
+			EMMC_READ(interrupt), EMMC_READ(int_mask),
+			EMMC_READ(int_enbl));
 }
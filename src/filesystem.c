@@ -11,13 +11,49 @@
  * All rights reserved, see LICENSE.txt for details.
  *
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * Writes go through the block cache. Data sectors, FAT sectors (in every
+ * copy of the FAT) and directory entries are changed in the cache and
+ * marked dirty; the cache writes them back in LBA order when it needs the
+ * room or when fs_sync() is called. Until then a crash loses the writes
+ * but leaves the volume as it was at the last sync.
+ *
+ * Free clusters are tracked in a bitmap, one bit per cluster, so that
+ * allocating does not mean reading the FAT one sector at a time until a
+ * free entry turns up. The bitmap is filled in lazily: the first time an
+ * allocation looks at the clusters covered by a FAT sector that sector is
+ * read and its 128 entries are copied into the map. From then on the map
+ * is kept up to date by every change to the FAT. The free cluster count
+ * and the next free hint of the FSInfo sector are read at mount time and
+ * written back by fs_sync().
+ *
+ * Unless asked not to, fs_init() fills the whole map at mount by streaming
+ * the FAT FS_SCAN_BLOCKS sectors at a time. The same pass counts the
+ * clusters that are free, in use and bad, finds links to clusters that do
+ * not exist and counts the chains and the runs of contiguous clusters
+ * they are made of, which is how fragmented the files are. The FSInfo
+ * free count is only a hint, the scan replaces it with the real one. With
+ * FS_SCAN_DEFER the scan waits for the first allocation, keeping mount to
+ * a couple of reads.
+ *
+ * fs_stream() is for consumers that go through a file once, front to back
+ * (loaders, checksums). Rather than copying into their buffer it pins each
+ * sector in the block cache and passes them a pointer to it. Each run of
+ * contiguous clusters is queued for reading before the first of its
+ * sectors is handed over, so the run comes in as a few large requests.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
  */
 
 #define MODULE FS
 
-#include <emmc.h>
+#include <bcache.h>
+#include <blockdev.h>
+#include <dcache.h>
+#include <errno.h>
 #include <filesystem.h>
 #include <string.h>
+#include <timer.h>
 #include <types.h>
 #include <util.h>
 #include <log.h>
@@ -46,7 +82,10 @@
 #define FAT_MASK 0x0FFFFFFF
 #define FAT_TAIL 0x0FFFFFFF
 #define FAT_FREE 0x00000000
+#define FAT_BAD 0x0FFFFFF7
+#define FAT_END 0x0FFFFFF8	/* this and above end a chain */
 #define CLUSTER_SIZE (volume.cluster_size * volume.sector_size)
+#define LONG_PIECES ((FS_MAX_NAME + 12) / 13)	/* entries of the longest name */
 
 /*
  * On disk layout of MS DOS partition table entry
@@ -83,8 +122,26 @@ struct disk_bpb_t {
 	uint32_t fat_size;		/* size of FAT in sectors */
 	uint8_t _PAD3[4];
 	uint32_t root;			/* cluster containing root directory */
+	uint16_t fsinfo;		/* sector holding the FSInfo */
 } __attribute__((packed));
 
+/*
+ * On disk layout of FSInfo sector
+ */
+struct disk_fsinfo_t {
+	uint32_t lead_sig;		/* FSINFO_LEAD_SIG */
+	uint8_t _PAD1[480];
+	uint32_t struct_sig;		/* FSINFO_STRUCT_SIG */
+	uint32_t free_count;		/* last known free cluster count */
+	uint32_t next_free;		/* where to look for a free cluster */
+	uint8_t _PAD2[12];
+	uint32_t trail_sig;		/* FSINFO_TRAIL_SIG */
+} __attribute__((packed));
+
+#define FSINFO_LEAD_SIG 0x41615252
+#define FSINFO_STRUCT_SIG 0x61417272
+#define FSINFO_TRAIL_SIG 0xAA550000
+
 /*
  * On disk layout of long directory entry
  */
@@ -93,7 +150,7 @@ struct disk_long_dirent_t {
 	uint16_t name_1[5];		/* characters 1-5 in entry */
 	uint8_t attributes;		/* should always be 0x0F */
 	uint8_t type;			/* should always be 0x00 */
-	uint8_t checksum;		/* checksum of short name -- ignore */
+	uint8_t checksum;		/* checksum of short name */
 	uint16_t name_2[6];		/* characters 6-11 in entry */
 	uint8_t _PAD[2];
 	uint16_t name_3[2];		/* characters 12-13 in entry */
@@ -117,62 +174,376 @@ struct disk_short_dirent_t {
 	uint32_t size;		/* size of file in bytes */
 } __attribute__((packed));
 
+/*
+ * Open file
+ */
+struct file_t {
+	int used;		/* 1 if this handle is in use */
+	struct dirent_t dirent;	/* directory entry of the file */
+	unsigned pos;		/* current offset in bytes */
+	unsigned cluster;	/* cluster containing pos or 0 if unknown */
+	unsigned cluster_idx;	/* index of cluster in the chain */
+	unsigned ra_next;	/* position a sequential read would start at */
+	unsigned ra_end;	/* end of the data read ahead so far */
+	unsigned ra_window;	/* readahead window in sectors, 0 if off */
+};
+
 struct vol_t volume;
 
+static struct file_t files[FS_MAX_FILES];
+static struct fs_stats_t stats;
+static unsigned next_free;	/* where to start looking for a free cluster */
+
 /*
- * Load a cluster into a buffer
+ * Free cluster bitmap, a bit is set if the cluster is in use, and a second
+ * bitmap with a bit set for each FAT sector that has been copied into it
  */
-static void fs_get_cluster(unsigned cluster, unsigned char *buf)
+static uint32_t cluster_map[FS_MAX_CLUSTERS / 32];
+static uint32_t region_map[FS_MAX_CLUSTERS / 128 / 32];
+
+/*
+ * Result of the FAT scan and whether it still has to run
+ */
+static struct fs_scan_t scan;
+static int scan_pending;
+
+/*
+ * FAT sectors being scanned
+ */
+static uint32_t scan_buf[FS_SCAN_BLOCKS * 128];
+
+#define MAP_TEST(map, bit) ((map)[(bit) / 32] & (1u << ((bit) % 32)))
+#define MAP_SET(map, bit) ((map)[(bit) / 32] |= (1u << ((bit) % 32)))
+#define MAP_CLEAR(map, bit) ((map)[(bit) / 32] &= ~(1u << ((bit) % 32)))
+
+/*
+ * Bounce buffer for reads and writes that cover part of a sector
+ */
+static uint8_t bounce[512];
+
+/*
+ * Follow the FAT to the cluster after cluster
+ * Note: FAT sectors come from the block cache, a chain is walked in order
+ * so consecutive lookups almost always land in the same sector
+ */
+static unsigned fs_fat_next(unsigned cluster)
 {
-	int i;
-	unsigned lba = CLUSTER_LBA(cluster);
-	for (i=0; i<volume.cluster_size; i++)
-		emmc_read_block(lba+i, buf+i*volume.sector_size);
+	uint32_t *fat_sector = bcache_get(FAT_LBA(cluster));
+
+	if (fat_sector == NULL)
+		return FAT_BAD;
+
+	return fat_sector[cluster % 128] & FAT_MASK;
 }
 
 /*
- * Find the cluster corresponding to an offset
- * Note: returning 0 in case of failure is safe because there is no
- * dirent to pass in for the root directory (which occupies cluster 0)
+ * Point the FAT entry of cluster at next in every copy of the FAT
  */
-static unsigned fs_cluster_map(unsigned offset, struct dirent_t *dirent)
+static int fs_fat_set(unsigned cluster, unsigned next)
 {
-	unsigned sector[512];
-	unsigned cluster_cnt = offset / (volume.cluster_size * 512);
-	unsigned cluster_no = dirent->cluster;
-	unsigned lba, last_lba = 0;
+	unsigned i, lba;
+	uint32_t *fat_sector;
+
+	for (i=0; i<volume.num_fats; i++) {
+		lba = FAT_LBA(cluster) + i * volume.fat_size;
+		if ((fat_sector = bcache_get(lba)) == NULL)
+			return -EIO;
+		fat_sector[cluster % 128] = (fat_sector[cluster % 128] & ~FAT_MASK) | next;
+		bcache_dirty(lba);
+	}
+
+	if (next == FAT_FREE)
+		MAP_CLEAR(cluster_map, cluster);
+	else
+		MAP_SET(cluster_map, cluster);
+
+	return 0;
+}
 
-	if (offset >= dirent->size)
+/*
+ * Copy the FAT sector covering cluster into the free map if it is not
+ * there yet
+ */
+static int fs_map_region(unsigned cluster)
+{
+	unsigned region = cluster / 128, i;
+	uint32_t *fat_sector;
+
+	if (MAP_TEST(region_map, region))
 		return 0;
+	if ((fat_sector = bcache_get(volume.fat_lba + region)) == NULL)
+		return -EIO;
+
+	for (i=0; i<128; i++) {
+		if ((fat_sector[i] & FAT_MASK) == FAT_FREE)
+			MAP_CLEAR(cluster_map, region * 128 + i);
+		else
+			MAP_SET(cluster_map, region * 128 + i);
+	}
+	MAP_SET(region_map, region);
+
+	return 0;
+}
+
+/*
+ * Find the first run of count free clusters between start and end,
+ * returns its first cluster or 0 if there is none
+ * Whole words of clusters in use are skipped at once.
+ */
+static unsigned fs_map_find(unsigned start, unsigned end, unsigned count)
+{
+	unsigned cluster, run = 0;
+
+	for (cluster=start; cluster<end; cluster++) {
+		if ((cluster == start || cluster % 128 == 0) && fs_map_region(cluster) != 0)
+			return 0;
+		if (cluster % 32 == 0 && cluster_map[cluster / 32] == 0xFFFFFFFF &&
+				cluster + 32 <= end) {
+			cluster += 31;
+			run = 0;
+			continue;
+		}
+		if (MAP_TEST(cluster_map, cluster)) {
+			run = 0;
+			continue;
+		}
+		if (++run == count)
+			return cluster + 1 - count;
+	}
+
+	return 0;
+}
+
+/*
+ * Stream the whole FAT into the free map, counting what is in it
+ * FAT sectors that are dirty in the block cache are newer than the disk
+ * and are taken from the cache instead. A scan that fails part of the way
+ * stays pending, the counts it left behind are not the whole FAT.
+ */
+static int fs_scan()
+{
+	unsigned start = timer_read(), end = volume.num_clusters + 2;
+	unsigned sector, count, i, cluster, next;
+	struct blockdev_stats_t before, after;
+
+	memset(&scan, 0, sizeof(scan));
+	blockdev_get_stats(volume.dev, &before);
+
+	for (sector=0; sector<(end + 127) / 128; sector+=count) {
+		count = MIN(FS_SCAN_BLOCKS, (end + 127) / 128 - sector);
+		if (blockdev_read(volume.dev, volume.fat_lba + sector, count,
+					scan_buf) != 0)
+			return -EIO;
+		for (i=0; i<count; i++)
+			bcache_copy(volume.fat_lba + sector + i, 1, &scan_buf[i * 128]);
+
+		for (i=0; i<count*128; i++) {
+			cluster = sector * 128 + i;
+			next = scan_buf[i] & FAT_MASK;
+			if (cluster < 2 || cluster >= end)
+				continue;
+
+			if (next == FAT_FREE) {
+				MAP_CLEAR(cluster_map, cluster);
+				++scan.free;
+				continue;
+			}
+			MAP_SET(cluster_map, cluster);
+
+			if (next == FAT_BAD) {
+				++scan.bad;
+			} else if (next >= FAT_END) {
+				++scan.used;
+				++scan.chains;
+				++scan.extents;
+			} else if (next < 2 || next >= end) {
+				++scan.used;
+				++scan.broken;
+			} else {
+				++scan.used;
+				if (next != cluster + 1)
+					++scan.extents;
+			}
+		}
+		for (i=0; i<count; i++)
+			MAP_SET(region_map, sector + i);
+	}
+
+	scan_pending = 0;
+	blockdev_get_stats(volume.dev, &after);
+	scan.reads = after.reads - before.reads;
+	scan.scan_us = timer_read() - start;
+
+	if (volume.free_clusters != scan.free) {
+		if (volume.free_clusters != FS_FREE_UNKNOWN)
+			log(WARN, "FSInfo says %u free clusters, there are %u",
+					volume.free_clusters, scan.free);
+		volume.free_clusters = scan.free;
+	}
+	if (scan.broken != 0)
+		log(WARN, "%u links to clusters that do not exist", scan.broken);
+
+	return 0;
+}
+
+/*
+ * Allocate a chain of up to count clusters and link it after prev, unless
+ * prev is 0
+ * A run of count free clusters right after prev is taken first, so that a
+ * growing file stays in one piece, then the first run of count free
+ * clusters after the next free hint. If there is no such run the clusters
+ * are picked one by one, each right after the last where possible.
+ * Returns the first cluster of the chain or 0 if the volume is full.
+ */
+static unsigned fs_alloc_cluster(unsigned count, unsigned prev)
+{
+	unsigned end = volume.num_clusters + 2, run = 0, first = 0, cluster;
+	unsigned last = prev, i;
+
+	/* until a scan gets through, the map is filled in lazily */
+	if (scan_pending)
+		fs_scan();
+
+	if (prev != 0 && prev + count < end)
+		run = fs_map_find(prev + 1, prev + 1 + count, count);
+	if (run == 0)
+		run = fs_map_find(next_free, end, count);
+	if (run == 0)
+		run = fs_map_find(2, MIN(next_free + count, end), count);
+
+	for (i=0; i<count; i++) {
+		if (run != 0)
+			cluster = run + i;
+		else if ((last == 0 || (cluster = fs_map_find(last + 1,
+						MIN(last + 2, end), 1)) == 0) &&
+				(cluster = fs_map_find(next_free, end, 1)) == 0 &&
+				(cluster = fs_map_find(2, end, 1)) == 0)
+			break;
+
+		if (fs_fat_set(cluster, FAT_TAIL) != 0 ||
+				(last != 0 && fs_fat_set(last, cluster) != 0))
+			break;
+		if (volume.free_clusters != FS_FREE_UNKNOWN)
+			--volume.free_clusters;
+		if (last == prev)
+			first = cluster;
+		last = cluster;
+	}
+
+	if (last == prev)
+		return 0;
+	next_free = last + 1 < end ? last + 1 : 2;
+
+	return first;
+}
+
+/*
+ * Free the chain of clusters starting at cluster
+ */
+static int fs_fat_free(unsigned cluster)
+{
+	unsigned next;
+
+	while (cluster >= 2 && cluster < volume.num_clusters + 2) {
+		next = fs_fat_next(cluster);
+		if (fs_fat_set(cluster, FAT_FREE) != 0)
+			return -EIO;
+		if (volume.free_clusters != FS_FREE_UNKNOWN)
+			++volume.free_clusters;
+		if (cluster < next_free)
+			next_free = cluster;
+		cluster = next;
+	}
+
+	return 0;
+}
+
+/*
+ * Point the file's cached cluster at the cluster containing its position
+ * Sequential access only ever advances one link at a time; seeking
+ * backwards restarts from the head of the chain. If the chain ends before
+ * the position and alloc_end is not 0, enough clusters to hold the file up
+ * to alloc_end bytes are added to it in one go.
+ */
+static int fs_file_map(struct file_t *file, unsigned alloc_end)
+{
+	unsigned idx = file->pos / CLUSTER_SIZE, next;
+	unsigned clusters = (alloc_end + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+
+	if (file->dirent.cluster == 0) {
+		if (alloc_end == 0)
+			return -EIO;
+		if ((file->dirent.cluster = fs_alloc_cluster(clusters, 0)) == 0)
+			return -ENOSPC;
+		file->cluster = 0;
+	}
+
+	if (file->cluster == 0 || idx < file->cluster_idx) {
+		file->cluster = file->dirent.cluster;
+		file->cluster_idx = 0;
+	}
 
 	/* walk FAT cluster chain */
-	for (int i=0; i<cluster_cnt; i++) {
-		lba = FAT_LBA(cluster_no);
-		if (lba != last_lba)
-			emmc_read_block(lba, sector);
-		cluster_no = sector[cluster_no] & FAT_MASK;
+	while (file->cluster_idx < idx) {
+		next = fs_fat_next(file->cluster);
+		if (alloc_end != 0 && next >= FAT_END && (next = fs_alloc_cluster(
+						clusters - file->cluster_idx - 1, file->cluster)) == 0) {
+			file->cluster = 0;
+			return -ENOSPC;
+		}
+		if (next < 2 || next >= FAT_BAD) {
+			file->cluster = 0;
+			return -EIO;
+		}
+		file->cluster = next;
+		++file->cluster_idx;
+	}
+
+	return 0;
+}
+
+/*
+ * Extend the file's cached cluster over the clusters that follow it on disk
+ * Returns the number of physically contiguous clusters, at most max,
+ * starting at the cached cluster and leaves the cached cluster on the last
+ * of them.
+ */
+static unsigned fs_file_run(struct file_t *file, unsigned max)
+{
+	unsigned run = 1;
+
+	while (run < max && fs_fat_next(file->cluster) == file->cluster + 1) {
+		++file->cluster;
+		++file->cluster_idx;
+		++run;
 	}
 
-	return cluster_no;
+	return run;
 }
 
 /*
- * Read an MS DOS format partition table
+ * Read an MS DOS format partition table and mount the first partition of
+ * device dev
+ * The FAT is scanned straight away unless flags has FS_SCAN_DEFER.
  */
-void fs_init()
+void fs_init(struct blockdev_t *dev, unsigned flags)
 {
+	unsigned start = timer_read();
 	unsigned char sector[512];
 	struct disk_mbr_t *mbr = (struct disk_mbr_t *)sector;
 	struct disk_part_t *part = &mbr->part_1;
 	struct disk_bpb_t *bpb = (struct disk_bpb_t *)sector;
+	struct disk_fsinfo_t *fsinfo = (struct disk_fsinfo_t *)sector;
+
+	volume.dev = dev;
 
 	/* find volume in partition table */
-	emmc_read_block(0, sector);
+	blockdev_read(volume.dev, 0, 1, sector);
 	volume.vol_lba = part->start_lba;
 	volume.size = part->size;
 
 	/* initialize volume from BIOS Paramter Block */
-	emmc_read_block(volume.vol_lba, sector);
+	blockdev_read(volume.dev, volume.vol_lba, 1, sector);
 	volume.sector_size = bpb->sector_size;
 	volume.cluster_size = bpb->cluster_size;
 	volume.fat_size = bpb->fat_size;
@@ -180,58 +551,213 @@ void fs_init()
 	volume.fat_lba = volume.vol_lba + bpb->reserved_sectors;
 	volume.cluster_lba = volume.fat_lba + volume.num_fats * volume.fat_size;
 	volume.root = bpb->root;
+	volume.num_clusters = MIN((volume.size - (volume.cluster_lba -
+				volume.vol_lba)) / volume.cluster_size,
+			volume.fat_size * 128 - 2);
+	volume.fsinfo_lba = bpb->fsinfo != 0 && bpb->fsinfo != 0xFFFF ?
+		volume.vol_lba + bpb->fsinfo : 0;
+
+	/* clusters past the end of the free map are never allocated */
+	if (volume.num_clusters > FS_MAX_CLUSTERS - 2) {
+		log(WARN, "only using %u of %u clusters", FS_MAX_CLUSTERS - 2,
+				volume.num_clusters);
+		volume.num_clusters = FS_MAX_CLUSTERS - 2;
+	}
+
+	/* take the free count and next free hint from FSInfo if it is sane */
+	volume.free_clusters = FS_FREE_UNKNOWN;
+	next_free = 2;
+	if (volume.fsinfo_lba != 0 &&
+			blockdev_read(volume.dev, volume.fsinfo_lba, 1, sector) == 0 &&
+			fsinfo->lead_sig == FSINFO_LEAD_SIG &&
+			fsinfo->struct_sig == FSINFO_STRUCT_SIG &&
+			fsinfo->trail_sig == FSINFO_TRAIL_SIG) {
+		if (fsinfo->free_count <= volume.num_clusters)
+			volume.free_clusters = fsinfo->free_count;
+		if (fsinfo->next_free >= 2 && fsinfo->next_free < volume.num_clusters + 2)
+			next_free = fsinfo->next_free;
+	} else {
+		volume.fsinfo_lba = 0;
+	}
+
+	/* blocks, names and free clusters of another volume are meaningless */
+	bcache_init(dev);
+	dcache_init();
+	memset(region_map, 0, sizeof(region_map));
+
+	scan_pending = 1;
+	if (!(flags & FS_SCAN_DEFER) && fs_scan() == 0)
+		log(INFO, "%u of %u clusters free, %u chains in %u extents",
+				scan.free, volume.num_clusters, scan.chains,
+				scan.extents);
+	log(INFO, "mounted in %uus", timer_read() - start);
+}
+
+/*
+ * Load the next sector of a directory, returns 0 at the end of the chain
+ */
+static int fs_dir_next_sector(struct dir_t *dir)
+{
+	unsigned lba;
+
+	/* move on to the next cluster */
+	if (++dir->sector == volume.cluster_size) {
+		dir->cluster = fs_fat_next(dir->cluster);
+		if (dir->cluster < 2 || dir->cluster >= FAT_BAD) {
+			dir->cluster = 0;
+			return 0;
+		}
+		dir->sector = 0;
+	}
+
+	/* the cache may hold entries that have not been written back yet */
+	lba = CLUSTER_LBA(dir->cluster) + dir->sector;
+	if (bcache_copy(lba, 1, dir->buf) != 1 &&
+			blockdev_read(volume.dev, lba, 1, dir->buf) != 0) {
+		dir->cluster = 0;
+		return 0;
+	}
+	dir->offset = 0;
+
+	return 1;
+}
+
+/*
+ * Start iterating over the directory at cluster
+ */
+static void fs_dir_start(struct dir_t *dir, unsigned cluster)
+{
+	dir->cluster = cluster;
+	dir->sector = -1;
+	dir->offset = sizeof(dir->buf);
+}
+
+/*
+ * Checksum of a short name as stored in each of its long name entries
+ */
+static uint8_t fs_short_checksum(const char *short_name)
+{
+	int i;
+	uint8_t sum = 0;
+
+	for (i=0; i<11; i++)
+		sum = ((sum & 1) << 7) + (sum >> 1) + (uint8_t)short_name[i];
+
+	return sum;
 }
 
 /*
- * Read the directory entry in cluster at offset
+ * Read the next entry of an open directory
+ * Returns 1 if dirent was filled in and 0 at the end of the directory.
+ * Long name entries are collected as they stream past so a long name may
+ * straddle a sector or cluster boundary. A long name is only kept if its
+ * pieces arrived in sequence and they all carry the checksum of the short
+ * entry that follows them; anything else is an orphan left behind by a
+ * driver that does not understand long names and is dropped.
  */
-unsigned fs_readdir(unsigned char *cluster, unsigned offset,
-		struct dirent_t *dirent)
+int fs_readdir_next(struct dir_t *dir, struct dirent_t *dirent)
 {
-	int i, pos, seq;
+	int i, pos, seq, ended, too_long;
+	int next_seq = -1;	/* sequence of the next long piece, -1 if none */
+	uint8_t checksum = 0;
+	uint8_t *entry;
+	unsigned piece;
+	char c;
 	struct disk_short_dirent_t *short_dirent;
-	struct disk_long_dirent_t *long_dirent =
-		(struct disk_long_dirent_t *)(cluster + offset);
+	struct disk_long_dirent_t *long_dirent;
 
 	dirent->long_name[0] = '\0';
-	dirent->short_name[0] = '\0';
+	dirent->long_hash = 0;
 
-	/* check for empty directory entry */
-	if ((cluster + offset)[0] == 0xE5)
-		return offset + sizeof(struct disk_short_dirent_t);
+	while (dir->cluster != 0) {
+		if (dir->offset == sizeof(dir->buf) && !fs_dir_next_sector(dir))
+			break;
+		entry = &dir->buf[dir->offset];
+		dir->offset += sizeof(struct disk_short_dirent_t);
 
-	/* check for last directory entry */
-	if ((cluster + offset)[0] == 0x00)
-		return 0;
+		/* check for last directory entry */
+		if (entry[0] == 0x00) {
+			dir->cluster = 0;
+			break;
+		}
 
-	/* build the long name */
-	seq = ((long_dirent->sequence & ~0x40) - 1) * 13;
-	dirent->long_name[seq+13] = '\0';
-	while (FAT32_IS_LONG(long_dirent)) {
-		pos = 0;
-		for (i=0; i<5; i++)
-			dirent->long_name[seq+pos++] = (char)long_dirent->name_1[i];
-		for (i=0; i<6; i++)
-			dirent->long_name[seq+pos++] = (char)long_dirent->name_2[i];
-		for (i=0; i<2; i++)
-			dirent->long_name[seq+pos++] = (char)long_dirent->name_3[i];
-		long_dirent++;
-		seq = (long_dirent->sequence - 1) * 13;
-	}
+		/* check for empty directory entry */
+		if (entry[0] == 0xE5) {
+			next_seq = -1;
+			continue;
+		}
+
+		/* add this piece to the long name */
+		if (FAT32_IS_LONG(entry)) {
+			long_dirent = (struct disk_long_dirent_t *)entry;
+			seq = long_dirent->sequence & 0x1F;
 
-	/* build the short name */
-	short_dirent = (struct disk_short_dirent_t *)long_dirent;
-	/*strncpy(&dirent->short_name[0], short_dirent->name, 8);*/
-	/*dirent->short_name[8] = '.';*/
-	/*strncpy(&dirent->short_name[9], &short_dirent->name[8], 3);*/
-	/*dirent->short_name[12] = '\0';*/
-	strncpy(&dirent->short_name[0], short_dirent->name, 11);
-	dirent->short_name[11] = '\0';
+			/* the last piece comes first and starts a new name */
+			if (long_dirent->sequence & 0x40) {
+				next_seq = seq;
+				checksum = long_dirent->checksum;
+				dirent->long_hash = 0;
+				dirent->long_name[MIN(seq*13, FS_MAX_NAME)] = '\0';
+			}
+			if (seq == 0 || seq != next_seq || seq > LONG_PIECES ||
+					long_dirent->checksum != checksum) {
+				next_seq = -1;
+				continue;
+			}
 
-	dirent->cluster = (short_dirent->cluster_lo) | (short_dirent->cluster_hi << 16);
-	dirent->size = (unsigned)(short_dirent->size);
+			/* copy the piece, hashing it up to the terminator; the
+			 * last piece of the longest name ends in padding that
+			 * does not fit */
+			pos = (seq - 1) * 13;
+			piece = strhash_char(STRHASH_INIT, seq);
+			ended = too_long = 0;
+			for (i=0; i<13; i++, pos++) {
+				c = (char)(i < 5 ? long_dirent->name_1[i] :
+						i < 11 ? long_dirent->name_2[i-5] :
+						long_dirent->name_3[i-11]);
+				if (pos <= FS_MAX_NAME)
+					dirent->long_name[pos] = c;
+				if (c == '\0')
+					ended = 1;
+				else if (!ended && pos >= FS_MAX_NAME)
+					too_long = 1;
+				else if (!ended)
+					piece = strhash_char(piece, c);
+			}
+			if (too_long) {
+				next_seq = -1;
+				continue;
+			}
+			--next_seq;
+			dirent->long_hash += piece;
+			continue;
+		}
 
-	return (unsigned)(short_dirent + 1) - (unsigned)cluster;
+		/* skip the volume label */
+		short_dirent = (struct disk_short_dirent_t *)entry;
+		if (short_dirent->attributes & FS_ATTR_VOLUME_ID) {
+			next_seq = -1;
+			continue;
+		}
+
+		/* drop incomplete and orphaned long names */
+		if (next_seq != 0 || fs_short_checksum(short_dirent->name) != checksum)
+			dirent->long_name[0] = '\0';
+
+		/* build the short name */
+		strncpy(&dirent->short_name[0], short_dirent->name, 11);
+		dirent->short_name[11] = '\0';
+
+		dirent->cluster = (short_dirent->cluster_lo) | (short_dirent->cluster_hi << 16);
+		dirent->size = (unsigned)(short_dirent->size);
+		dirent->attributes = short_dirent->attributes;
+		dirent->entry_lba = CLUSTER_LBA(dir->cluster) + dir->sector;
+		dirent->entry_offset = entry - dir->buf;
+
+		return 1;
+	}
+
+	return 0;
 }
 
 /*
@@ -300,53 +826,957 @@ int fs_str_to_name(char *short_name, const char *filename)
 }
 
 /*
- * Find directory entry correspending to filename
+ * Return true if name fits in 8.3 without being truncated
  */
-int fs_lookup(const char *name, struct dirent_t *ret)
+static int fs_is_short_name(const char *name)
 {
-	unsigned char cluster[CLUSTER_SIZE];
-	unsigned offset = 0;
+	int i, dot = -1;
+
+	for (i=0; name[i] != '\0'; i++) {
+		if (name[i] != '.')
+			continue;
+		if (dot >= 0)
+			return 0;
+		dot = i;
+	}
+
+	if (dot < 0)
+		return i > 0 && i <= 8;
+
+	return dot > 0 && dot <= 8 && i - dot - 1 <= 3;
+}
+
+/*
+ * Case insensitive hash of a long name, the sum of the hashes of its 13
+ * character pieces each seeded with its sequence number; the pieces come
+ * off the disk last first, so fs_readdir_next() can only build a hash
+ * whose parts do not depend on order
+ */
+static unsigned fs_long_hash(const char *name)
+{
+	unsigned hash = 0, piece;
+	int seq, i;
+
+	for (seq=1; *name; seq++) {
+		piece = strhash_char(STRHASH_INIT, seq);
+		for (i=0; i<13 && *name; i++)
+			piece = strhash_char(piece, *name++);
+		hash += piece;
+	}
+
+	return hash;
+}
+
+/*
+ * Find name in the directory starting at cluster dir_cluster
+ * The name is compared with the long name of every entry and, if it is a
+ * valid 8.3 name, with the short name too. The name we are looking for is
+ * hashed once up front and fs_readdir_next() hashes each long name as it
+ * assembles it, so most entries are rejected without a string compare.
+ */
+static int fs_lookup_in(unsigned dir_cluster, const char *name,
+		struct dirent_t *ret)
+{
+	struct dir_t dir;
 	char short_name[11];
+	int has_short = 1;
+	unsigned hash;
 
-	fs_get_cluster(volume.root, cluster);
-	fs_str_to_name(short_name, name);
+	/* try the dentry cache first */
+	switch (dcache_lookup(dir_cluster, name, ret)) {
+		case DCACHE_HIT:
+			return 0;
+		case DCACHE_NEGATIVE:
+			return -1;
+	}
 
-	while ((offset = fs_readdir(cluster, offset, ret))) {
-		if (!strncmp(short_name, ret->short_name, 11))
+	/* '..' has no valid 8.3 form so match it verbatim */
+	if (!strcmp(name, ".."))
+		memcpy(short_name, "..         ", 11);
+	else if (!fs_is_short_name(name) || fs_str_to_name(short_name, name) != 0)
+		has_short = 0;
+
+	hash = fs_long_hash(name);
+
+	fs_dir_start(&dir, dir_cluster);
+	while (fs_readdir_next(&dir, ret)) {
+		if ((has_short && !strncmp(short_name, ret->short_name, 11)) ||
+				(ret->long_name[0] != '\0' &&
+				ret->long_hash == hash &&
+				!strcasecmp(ret->long_name, name))) {
+			dcache_insert(dir_cluster, name, ret);
 			return 0;
+		}
 	}
 
+	dcache_insert(dir_cluster, name, NULL);
+
 	return -1;
 }
 
 /*
- * Read bytes from file into buffer
- * TODO: set errno
+ * Find directory entry correspending to path
+ * Paths are always resolved from the root directory, so 'a/b.txt' and
+ * '/a/b.txt' are the same file. The root directory itself has no
+ * directory entry and gets a made up one.
+ * If last is not NULL the final component of the path is copied there
+ * instead of being looked up, leaving ret on the directory it lives in.
  */
-int fs_read(const char *filename, unsigned char* buf, size_t off, size_t count)
+static int fs_lookup_path(const char *path, struct dirent_t *ret, char *last)
+{
+	char name[FS_MAX_NAME+1];
+	int len;
+
+	if (last != NULL)
+		last[0] = '\0';
+	memset(ret, 0, sizeof(struct dirent_t));
+	ret->cluster = volume.root;
+	ret->attributes = FS_ATTR_DIRECTORY;
+
+	while (*path) {
+		/* skip separators */
+		if (*path == '/') {
+			++path;
+			continue;
+		}
+
+		/* copy out the next path component */
+		for (len=0; path[len] != '\0' && path[len] != '/'; len++)
+			if (len == FS_MAX_NAME)
+				return -1;
+		memcpy(name, path, len);
+		name[len] = '\0';
+		path += len;
+
+		/* only directories can have children */
+		if (!(ret->attributes & FS_ATTR_DIRECTORY))
+			return -1;
+
+		/* stop short of the final component if asked to */
+		while (*path == '/')
+			++path;
+		if (last != NULL && *path == '\0') {
+			memcpy(last, name, len + 1);
+			return 0;
+		}
+
+		if (!strcmp(name, "."))
+			continue;
+		if (!strcmp(name, "..") && ret->cluster == volume.root)
+			continue;
+
+		if (fs_lookup_in(ret->cluster, name, ret) != 0)
+			return -1;
+
+		/* '..' entries point at cluster 0 when the parent is the root */
+		if (ret->cluster == 0 && (ret->attributes & FS_ATTR_DIRECTORY))
+			ret->cluster = volume.root;
+	}
+
+	return 0;
+}
+
+/*
+ * Find directory entry correspending to path
+ */
+int fs_lookup(const char *path, struct dirent_t *ret)
+{
+	return fs_lookup_path(path, ret, NULL);
+}
+
+/*
+ * Build a unique short alias for a long name in the directory at cluster
+ * dir_cluster
+ * The alias is made of the first characters of the name and extension
+ * that are valid in a short name, followed by ~N where N is larger than
+ * that of any alias already in the directory that it could clash with.
+ */
+static void fs_make_alias(unsigned dir_cluster, const char *name, char *alias)
+{
+	struct dir_t dir;
+	struct dirent_t dirent;
+	char basis[8];
+	const char *ext = NULL, *c;
+	unsigned n, max = 0, len = 0, i, j, digits;
+
+	/* the extension follows the last dot */
+	for (c=name; *c; c++)
+		if (*c == '.' && c != name)
+			ext = c + 1;
+
+	memset(alias, ' ', 11);
+	for (c=name; *c && c+1 != ext && len < 6; c++) {
+		if (*c == ' ' || *c == '.')
+			continue;
+		basis[len++] = VALID_CHAR(*c) ? toupper(*c) : '_';
+	}
+	if (len == 0)
+		basis[len++] = '_';
+	for (j=8; ext && *ext && j < 11; ext++) {
+		if (*ext == ' ' || *ext == '.')
+			continue;
+		alias[j++] = VALID_CHAR(*ext) ? toupper(*ext) : '_';
+	}
+
+	/* find the largest ~N on an alias sharing our basis and extension */
+	fs_dir_start(&dir, dir_cluster);
+	while (fs_readdir_next(&dir, &dirent)) {
+		for (i=1; i<8 && dirent.short_name[i] != '~'; i++)
+			;
+		if (i == 8 || i > len || strncmp(dirent.short_name, basis, i) ||
+				strncmp(&dirent.short_name[8], &alias[8], 3))
+			continue;
+		for (n=0, j=i+1; j<8 && dirent.short_name[j] >= '0' &&
+				dirent.short_name[j] <= '9'; j++)
+			n = n * 10 + dirent.short_name[j] - '0';
+		max = MAX(max, n);
+	}
+
+	/* shorten the basis to make room for the tail */
+	for (n=max+1, digits=1; n >= 10; n/=10)
+		++digits;
+	len = MIN(len, 7 - digits);
+	memcpy(alias, basis, len);
+	alias[len] = '~';
+	for (n=max+1, i=len+digits; i>len; n/=10)
+		alias[i--] = '0' + n % 10;
+}
+
+/*
+ * Character i of a long name as stored in a long name entry, the name is
+ * terminated by a NUL and padded with 0xFFFF
+ */
+static uint16_t fs_long_char(const char *name, unsigned len, unsigned i)
+{
+	if (i < len)
+		return (uint8_t)name[i];
+	return i == len ? 0x0000 : 0xFFFF;
+}
+
+/*
+ * Find count free entries in a row in the directory at cluster dir_cluster,
+ * adding a cluster to the directory if there are not enough
+ * The location of each entry is returned in lbas and offsets.
+ */
+static int fs_dir_alloc(unsigned dir_cluster, unsigned count, unsigned *lbas,
+		unsigned *offsets)
+{
+	struct dir_t dir;
+	unsigned found = 0, last = dir_cluster, cluster, i;
+	uint8_t *entry;
+
+	fs_dir_start(&dir, dir_cluster);
+	while (found < count) {
+		if (dir.offset == sizeof(dir.buf)) {
+			last = dir.cluster;
+			if (!fs_dir_next_sector(&dir))
+				break;
+		}
+		entry = &dir.buf[dir.offset];
+		if (entry[0] == 0x00 || entry[0] == 0xE5) {
+			lbas[found] = CLUSTER_LBA(dir.cluster) + dir.sector;
+			offsets[found++] = dir.offset;
+		} else {
+			found = 0;
+		}
+		dir.offset += sizeof(struct disk_short_dirent_t);
+	}
+
+	/* the directory ended, make sure it was not a read error */
+	if (found < count && fs_fat_next(last) < FAT_END)
+		return -EIO;
+
+	/* grow the directory a cluster of empty entries at a time */
+	while (found < count) {
+		if ((cluster = fs_alloc_cluster(1, last)) == 0)
+			return -ENOSPC;
+		if (bcache_write(CLUSTER_LBA(cluster), volume.cluster_size, NULL) != 0)
+			return -EIO;
+		for (i=0; found<count && i<CLUSTER_SIZE; i+=sizeof(struct disk_short_dirent_t)) {
+			lbas[found] = CLUSTER_LBA(cluster) + i / volume.sector_size;
+			offsets[found++] = i % volume.sector_size;
+		}
+		last = cluster;
+	}
+
+	return 0;
+}
+
+/*
+ * Add an empty file called name to the directory at cluster dir_cluster
+ * A name that is not a valid short name, or whose case would be lost in
+ * one, gets a run of long name entries in front of its short entry.
+ */
+static int fs_dir_add(unsigned dir_cluster, const char *name,
+		struct dirent_t *ret)
+{
+	char short_name[11], str[13];
+	unsigned lbas[FS_MAX_NAME/13 + 2], offsets[FS_MAX_NAME/13 + 2];
+	unsigned len = strlen(name), count = 1, i, j, seq;
+	uint8_t checksum, *sector;
+	struct disk_long_dirent_t long_dirent;
+	struct disk_short_dirent_t short_dirent;
+	int ret_code;
+
+	if (len == 0 || len > FS_MAX_NAME)
+		return -EINVAL;
+
+	if (fs_is_short_name(name) && fs_str_to_name(short_name, name) == 0) {
+		fs_name_to_str(str, short_name);
+		if (strcmp(str, name))
+			count += (len + 12) / 13;
+	} else {
+		fs_make_alias(dir_cluster, name, short_name);
+		count += (len + 12) / 13;
+	}
+
+	if ((ret_code = fs_dir_alloc(dir_cluster, count, lbas, offsets)) != 0)
+		return ret_code;
+
+	/* long name entries come last piece first */
+	checksum = fs_short_checksum(short_name);
+	memset(&long_dirent, 0, sizeof(long_dirent));
+	long_dirent.attributes = 0x0F;
+	long_dirent.checksum = checksum;
+	for (i=0; i<count-1; i++) {
+		seq = count - 1 - i;
+		long_dirent.sequence = seq | (i == 0 ? 0x40 : 0);
+		for (j=0; j<5; j++)
+			long_dirent.name_1[j] = fs_long_char(name, len, (seq-1)*13 + j);
+		for (j=0; j<6; j++)
+			long_dirent.name_2[j] = fs_long_char(name, len, (seq-1)*13 + 5 + j);
+		for (j=0; j<2; j++)
+			long_dirent.name_3[j] = fs_long_char(name, len, (seq-1)*13 + 11 + j);
+
+		if ((sector = bcache_get(lbas[i])) == NULL)
+			return -EIO;
+		memcpy(&sector[offsets[i]], &long_dirent, sizeof(long_dirent));
+		bcache_dirty(lbas[i]);
+	}
+
+	memset(&short_dirent, 0, sizeof(short_dirent));
+	memcpy(short_dirent.name, short_name, 11);
+	short_dirent.attributes = FS_ATTR_ARCHIVE;
+	if ((sector = bcache_get(lbas[i])) == NULL)
+		return -EIO;
+	memcpy(&sector[offsets[i]], &short_dirent, sizeof(short_dirent));
+	bcache_dirty(lbas[i]);
+
+	memset(ret, 0, sizeof(struct dirent_t));
+	memcpy(ret->short_name, short_name, 11);
+	if (count > 1)
+		memcpy(ret->long_name, name, len + 1);
+	ret->attributes = FS_ATTR_ARCHIVE;
+	ret->entry_lba = lbas[i];
+	ret->entry_offset = offsets[i];
+
+	/* a lookup may have cached the name or its alias as missing */
+	dcache_invalidate(dir_cluster, name);
+	fs_name_to_str(str, short_name);
+	dcache_invalidate(dir_cluster, str);
+
+	return 0;
+}
+
+/*
+ * Open a directory for reading with fs_readdir_next()
+ */
+int fs_opendir(const char *path, struct dir_t *dir)
+{
+	struct dirent_t dirent;
+
+	if (fs_lookup(path, &dirent) != 0)
+		return -ENOENT;
+	if (!(dirent.attributes & FS_ATTR_DIRECTORY))
+		return -ENOTDIR;
+
+	fs_dir_start(dir, dirent.cluster);
+
+	return 0;
+}
+
+/*
+ * Get the open file for a descriptor
+ */
+static struct file_t *fs_get_file(int fd)
+{
+	if (fd < 0 || fd >= FS_MAX_FILES || !files[fd].used)
+		return NULL;
+	return &files[fd];
+}
+
+/*
+ * Take a free descriptor for the file with directory entry dirent
+ */
+static int fs_open_dirent(const struct dirent_t *dirent)
+{
+	int fd;
+	struct file_t *file;
+
+	/* find a free handle */
+	for (fd=0; fd<FS_MAX_FILES; fd++)
+		if (!files[fd].used)
+			break;
+	if (fd == FS_MAX_FILES)
+		return -EMFILE;
+	file = &files[fd];
+
+	memcpy(&file->dirent, dirent, sizeof(struct dirent_t));
+	file->used = 1;
+	file->pos = 0;
+	file->cluster = 0;
+	file->cluster_idx = 0;
+	file->ra_next = 0;
+	file->ra_end = 0;
+	file->ra_window = 0;
+
+	return fd;
+}
+
+/*
+ * Open a file and return its descriptor
+ */
+int fs_open(const char *filename)
 {
 	struct dirent_t dirent;
-	unsigned cluster_no;
-	unsigned char cluster[CLUSTER_SIZE]; 
-	int start_read, bytes_to_read, last_byte, pos = off;
 
 	if (fs_lookup(filename, &dirent) != 0)
-		return -1; /* FIXME -- no such file */
+		return -ENOENT;
+	if (dirent.attributes & FS_ATTR_DIRECTORY)
+		return -EISDIR;
+
+	return fs_open_dirent(&dirent);
+}
 
-	/* perform read for each cluster */
-	last_byte = MIN(off+count, dirent.size);
-	while (pos < last_byte) {
-		cluster_no = fs_cluster_map(pos, &dirent);
-		if (cluster_no == 0)
-			return pos - off;
-		fs_get_cluster(cluster_no, cluster);
-		start_read = pos % CLUSTER_SIZE;
-		bytes_to_read = MIN(CLUSTER_SIZE, last_byte - pos);
-		memcpy(&buf[pos-off], &cluster[start_read], bytes_to_read);
-		pos += bytes_to_read;
+/*
+ * Release a file descriptor
+ */
+int fs_close(int fd)
+{
+	struct file_t *file = fs_get_file(fd);
+
+	if (file == NULL)
+		return -EBADF;
+	file->used = 0;
+
+	return 0;
+}
+
+/*
+ * Set the position of the next read and return it
+ */
+int fs_seek(int fd, int off, int whence)
+{
+	int pos;
+	struct file_t *file = fs_get_file(fd);
+
+	if (file == NULL)
+		return -EBADF;
+
+	switch (whence) {
+		case FS_SEEK_SET:
+			pos = off;
+			break;
+		case FS_SEEK_CUR:
+			pos = file->pos + off;
+			break;
+		case FS_SEEK_END:
+			pos = file->dirent.size + off;
+			break;
+		default:
+			return -EINVAL;
 	}
+	if (pos < 0)
+		return -EINVAL;
 
-	return pos - off;
+	/* the cached cluster is fixed up lazily by the next read */
+	file->pos = pos;
+
+	return pos;
+}
+
+/*
+ * Grow the readahead window after a sequential read, shrink it after a
+ * random one
+ */
+static void fs_file_adapt(struct file_t *file)
+{
+	if (file->pos == file->ra_next) {
+		file->ra_window = file->ra_window == 0 ? FS_READAHEAD_MIN :
+			MIN(file->ra_window * 2, FS_READAHEAD_MAX);
+		return;
+	}
+
+	file->ra_window /= 2;
+	if (file->ra_window < FS_READAHEAD_MIN)
+		file->ra_window = 0;
+	file->ra_end = 0;
+}
+
+/*
+ * Prefetch the window that follows the current position into the block
+ * cache, taking contiguous clusters in a single request
+ */
+static void fs_file_readahead(struct file_t *file)
+{
+	unsigned start, end, cluster, idx, offset, lba = 0, count = 0, n;
+
+	start = MAX(file->ra_end, file->pos);
+	start -= start % volume.sector_size;
+	end = MIN(file->pos + file->ra_window * volume.sector_size,
+			file->dirent.size);
+	if (start >= end || fs_file_map(file, 0) != 0)
+		return;
+
+	/* find the cluster the window starts in */
+	cluster = file->cluster;
+	for (idx=file->cluster_idx; idx<start/CLUSTER_SIZE; idx++)
+		if ((cluster = fs_fat_next(cluster)) < 2 || cluster >= FAT_BAD)
+			return;
+
+	while (start < end) {
+		offset = start % CLUSTER_SIZE;
+		n = MIN(CLUSTER_SIZE - offset, end - start);
+		n = (n + volume.sector_size - 1) / volume.sector_size;
+
+		/* extend the request if this cluster follows the last one */
+		if (count > 0 && lba + count != CLUSTER_LBA(cluster) + offset /
+				volume.sector_size) {
+			bcache_readahead(lba, count);
+			count = 0;
+		}
+		if (count == 0)
+			lba = CLUSTER_LBA(cluster) + offset / volume.sector_size;
+		count += n;
+		start += n * volume.sector_size;
+
+		if (start < end && (start % CLUSTER_SIZE) == 0 &&
+				((cluster = fs_fat_next(cluster)) < 2 || cluster >= FAT_BAD))
+			break;
+	}
+	if (count > 0)
+		bcache_readahead(lba, count);
+
+	file->ra_end = start;
+}
+
+/*
+ * Read bytes from the current position of an open file into buffer
+ * Whole sectors are read by the device straight into the caller's buffer,
+ * taking every run of contiguous clusters in a single request. Only a
+ * head or tail that covers part of a sector goes through a bounce buffer.
+ * Sectors that were read ahead are copied out of the block cache.
+ */
+int fs_read_fd(int fd, unsigned char *buf, size_t count)
+{
+	struct file_t *file = fs_get_file(fd);
+	unsigned offset, sector_offset, bytes_to_read, last_byte, first_byte;
+	unsigned lba, run, sectors, i;
+
+	if (file == NULL)
+		return -EBADF;
+
+	fs_file_adapt(file);
+
+	first_byte = file->pos;
+	last_byte = MIN(file->pos + count, file->dirent.size);
+	while (file->pos < last_byte) {
+		if (fs_file_map(file, 0) != 0)
+			break;
+		offset = file->pos % CLUSTER_SIZE;
+		sector_offset = offset % volume.sector_size;
+		lba = CLUSTER_LBA(file->cluster) + offset / volume.sector_size;
+
+		/* partial sectors go through the bounce buffer */
+		if (sector_offset != 0 || last_byte - file->pos < volume.sector_size) {
+			if (bcache_copy(lba, 1, bounce) != 1 &&
+					blockdev_read(volume.dev, lba, 1, bounce) != 0)
+				break;
+			bytes_to_read = MIN(volume.sector_size - sector_offset,
+					last_byte - file->pos);
+			memcpy(&buf[file->pos - first_byte], &bounce[sector_offset],
+					bytes_to_read);
+			stats.bytes_copied += bytes_to_read;
+			file->pos += bytes_to_read;
+			continue;
+		}
+
+		/* whole sectors that were read ahead */
+		sectors = MIN((last_byte - file->pos) / volume.sector_size,
+				volume.cluster_size - offset / volume.sector_size);
+		if ((i = bcache_copy(lba, sectors, &buf[file->pos - first_byte])) > 0) {
+			bytes_to_read = i * volume.sector_size;
+			stats.bytes_copied += bytes_to_read;
+			file->pos += bytes_to_read;
+			continue;
+		}
+
+		/* whole sectors, extended over contiguous clusters */
+		bytes_to_read = (last_byte - file->pos) / volume.sector_size *
+			volume.sector_size;
+		run = fs_file_run(file, (offset + bytes_to_read + CLUSTER_SIZE - 1) /
+				CLUSTER_SIZE);
+		sectors = MIN(bytes_to_read, run * CLUSTER_SIZE - offset) /
+			volume.sector_size;
+
+		/* stop short of blocks that are already cached */
+		for (i=1; i<sectors; i++)
+			if (bcache_contains(lba + i))
+				break;
+		if (blockdev_read(volume.dev, lba, i, &buf[file->pos - first_byte]) != 0)
+			break;
+		file->pos += i * volume.sector_size;
+
+		/* back up if we stopped inside the run, it is contiguous */
+		if (file->pos / CLUSTER_SIZE < file->cluster_idx) {
+			file->cluster -= file->cluster_idx - file->pos / CLUSTER_SIZE;
+			file->cluster_idx = file->pos / CLUSTER_SIZE;
+		}
+	}
+
+	/*
+	 * prefetch behind sequential reads that are small enough to gain from
+	 * it, large reads are better off going straight to the buffer
+	 */
+	file->ra_next = file->pos;
+	if (file->ra_window != 0 && count < FS_READAHEAD_MAX * volume.sector_size &&
+			file->ra_end < file->pos + file->ra_window * volume.sector_size / 2)
+		fs_file_readahead(file);
+
+	stats.bytes_read += file->pos - first_byte;
+
+	return file->pos - first_byte;
+}
+
+/*
+ * Hand the rest of an open file to callback a sector at a time, with
+ * pointers into the block cache
+ * Cache blocks are separate buffers, so even a contiguous run of clusters
+ * cannot go out in one piece without copying it; the run is read ahead as
+ * a whole and handed over sector by sector. Each sector stays pinned
+ * while the callback runs, which may call into the filesystem. Returns 0 at the end of the file, the first nonzero
+ * value the callback returns or a negative error. The position is left
+ * after the last byte handed over.
+ */
+int fs_stream(int fd, fs_stream_callback_t callback, void *ctx)
+{
+	struct file_t *file = fs_get_file(fd);
+	unsigned offset, sector_offset, lba, run, sectors, len, i;
+	const uint8_t *sector;
+	int ret = 0;
+
+	if (file == NULL)
+		return -EBADF;
+
+	while (ret == 0 && file->pos < file->dirent.size) {
+		if (fs_file_map(file, 0) != 0)
+			return -EIO;
+		offset = file->pos % CLUSTER_SIZE;
+		lba = CLUSTER_LBA(file->cluster) + offset / volume.sector_size;
+
+		/* the run of clusters up to the end of the file */
+		run = fs_file_run(file, (offset + file->dirent.size - file->pos +
+					CLUSTER_SIZE - 1) / CLUSTER_SIZE);
+		sectors = MIN(run * volume.cluster_size - offset / volume.sector_size,
+				(file->dirent.size - file->pos + offset % volume.sector_size +
+				 volume.sector_size - 1) / volume.sector_size);
+
+		for (i=0; ret == 0 && i<sectors; i++) {
+			if (i % FS_READAHEAD_MAX == 0)
+				bcache_readahead(lba + i, MIN(FS_READAHEAD_MAX, sectors - i));
+			if ((sector = bcache_pin(lba + i)) == NULL)
+				return -EIO;
+
+			sector_offset = file->pos % volume.sector_size;
+			len = MIN(volume.sector_size - sector_offset,
+					file->dirent.size - file->pos);
+			ret = callback(ctx, &sector[sector_offset], len);
+			bcache_unpin(lba + i);
+
+			file->pos += len;
+			stats.bytes_streamed += len;
+		}
+
+		/* back up if we stopped inside the run, it is contiguous */
+		if (file->pos / CLUSTER_SIZE < file->cluster_idx) {
+			file->cluster -= file->cluster_idx - file->pos / CLUSTER_SIZE;
+			file->cluster_idx = file->pos / CLUSTER_SIZE;
+		}
+	}
+	file->ra_next = file->pos;
+
+	return ret;
+}
+
+/*
+ * Copy out what the FAT scan found, running it now if it was deferred
+ */
+int fs_get_scan(struct fs_scan_t *ret)
+{
+	if (scan_pending && fs_scan() != 0)
+		return -EIO;
+	memcpy(ret, &scan, sizeof(struct fs_scan_t));
+
+	return 0;
+}
+
+/*
+ * Copy out the file read statistics
+ */
+void fs_get_stats(struct fs_stats_t *ret)
+{
+	memcpy(ret, &stats, sizeof(struct fs_stats_t));
+}
+
+/*
+ * Write the size and first cluster of an open file back to its directory
+ * entry and to every other copy of the entry we hold
+ */
+static int fs_file_update(struct file_t *file)
+{
+	int fd;
+	uint8_t *sector;
+	struct disk_short_dirent_t *entry;
+
+	if ((sector = bcache_get(file->dirent.entry_lba)) == NULL)
+		return -EIO;
+	entry = (struct disk_short_dirent_t *)&sector[file->dirent.entry_offset];
+	entry->cluster_lo = file->dirent.cluster & 0xFFFF;
+	entry->cluster_hi = file->dirent.cluster >> 16;
+	entry->size = file->dirent.size;
+	entry->attributes |= FS_ATTR_ARCHIVE;
+	file->dirent.attributes |= FS_ATTR_ARCHIVE;
+	bcache_dirty(file->dirent.entry_lba);
+
+	dcache_update(&file->dirent);
+	for (fd=0; fd<FS_MAX_FILES; fd++) {
+		if (!files[fd].used || &files[fd] == file ||
+				files[fd].dirent.entry_lba != file->dirent.entry_lba ||
+				files[fd].dirent.entry_offset != file->dirent.entry_offset)
+			continue;
+		memcpy(&files[fd].dirent, &file->dirent, sizeof(struct dirent_t));
+		files[fd].cluster = 0;
+	}
+
+	return 0;
+}
+
+/*
+ * Write bytes at the current position of an open file, a NULL buffer
+ * writes zeros
+ * Whole sectors are copied into the block cache without reading them.
+ * A partial sector is read first unless it lies past the end of the file,
+ * where there is nothing worth keeping.
+ */
+static int fs_file_write(struct file_t *file, const unsigned char *buf,
+		size_t count)
+{
+	unsigned offset, sector_offset, bytes_to_write, first_byte, last_byte;
+	unsigned lba, sectors;
+	const unsigned char *src;
+	uint8_t *sector;
+	int ret = 0;
+
+	first_byte = file->pos;
+	last_byte = file->pos + count;
+	while (file->pos < last_byte) {
+		if ((ret = fs_file_map(file, last_byte)) != 0)
+			break;
+		offset = file->pos % CLUSTER_SIZE;
+		sector_offset = offset % volume.sector_size;
+		lba = CLUSTER_LBA(file->cluster) + offset / volume.sector_size;
+		src = buf == NULL ? NULL : &buf[file->pos - first_byte];
+
+		if (sector_offset == 0 && last_byte - file->pos >= volume.sector_size) {
+			/* whole sectors, up to the end of the cluster */
+			sectors = MIN((last_byte - file->pos) / volume.sector_size,
+					volume.cluster_size - offset / volume.sector_size);
+			if ((ret = bcache_write(lba, sectors, src)) != 0)
+				break;
+			bytes_to_write = sectors * volume.sector_size;
+		} else if (file->pos - sector_offset >= file->dirent.size) {
+			/* partial sector past the end of the file */
+			bytes_to_write = MIN(volume.sector_size - sector_offset,
+					last_byte - file->pos);
+			memset(bounce, 0, sizeof(bounce));
+			if (src != NULL)
+				memcpy(&bounce[sector_offset], src, bytes_to_write);
+			if ((ret = bcache_write(lba, 1, bounce)) != 0)
+				break;
+		} else {
+			/* partial sector inside the file */
+			if ((sector = bcache_get(lba)) == NULL) {
+				ret = -EIO;
+				break;
+			}
+			bytes_to_write = MIN(volume.sector_size - sector_offset,
+					last_byte - file->pos);
+			if (src != NULL)
+				memcpy(&sector[sector_offset], src, bytes_to_write);
+			else
+				memset(&sector[sector_offset], 0, bytes_to_write);
+			bcache_dirty(lba);
+		}
+
+		file->pos += bytes_to_write;
+		file->dirent.size = MAX(file->dirent.size, file->pos);
+	}
+
+	/* the data is no use without a directory entry that covers it */
+	if (file->pos != first_byte && fs_file_update(file) != 0)
+		return -EIO;
+	if (file->pos == first_byte && ret != 0)
+		return ret;
+
+	return file->pos - first_byte;
+}
+
+/*
+ * Write bytes from buffer at the current position of an open file
+ * Writing past the end of the file grows it, clusters are allocated and
+ * linked into the chain as they are needed. Seeking past the end and
+ * writing leaves a gap that reads back as zeros.
+ */
+int fs_write(int fd, const unsigned char *buf, size_t count)
+{
+	struct file_t *file = fs_get_file(fd);
+	unsigned pos;
+	int ret;
+
+	if (file == NULL)
+		return -EBADF;
+
+	/* fill the gap between the end of the file and the position */
+	if (file->pos > file->dirent.size) {
+		pos = file->pos;
+		file->pos = file->dirent.size;
+		ret = fs_file_write(file, NULL, pos - file->dirent.size);
+		if (file->pos != pos)
+			return ret < 0 ? ret : -EIO;
+	}
+
+	ret = fs_file_write(file, buf, count);
+	if (ret > 0)
+		stats.bytes_written += ret;
+
+	return ret;
+}
+
+/*
+ * Cut an open file down to size bytes, freeing the clusters past the end
+ */
+int fs_truncate(int fd, unsigned size)
+{
+	struct file_t *file = fs_get_file(fd);
+	unsigned cluster, next, i;
+
+	if (file == NULL)
+		return -EBADF;
+	if (size > file->dirent.size)
+		return -EINVAL;
+
+	if (size == 0) {
+		if (fs_fat_free(file->dirent.cluster) != 0)
+			return -EIO;
+		file->dirent.cluster = 0;
+	} else {
+		/* find the last cluster we keep and end the chain there */
+		cluster = file->dirent.cluster;
+		for (i=1; i<(size + CLUSTER_SIZE - 1) / CLUSTER_SIZE; i++)
+			if ((cluster = fs_fat_next(cluster)) < 2 || cluster >= FAT_BAD)
+				return -EIO;
+		next = fs_fat_next(cluster);
+		if (next < FAT_END && (fs_fat_set(cluster, FAT_TAIL) != 0 ||
+					fs_fat_free(next) != 0))
+			return -EIO;
+	}
+
+	file->dirent.size = size;
+	file->cluster = 0;
+	file->ra_end = 0;
+
+	return fs_file_update(file);
+}
+
+/*
+ * Create a file, or empty it if it exists, and open it
+ */
+int fs_create(const char *filename)
+{
+	char name[FS_MAX_NAME+1];
+	struct dirent_t parent, dirent;
+	int fd, ret;
+
+	if (fs_lookup_path(filename, &parent, name) != 0)
+		return -ENOENT;
+	if (!(parent.attributes & FS_ATTR_DIRECTORY))
+		return -ENOTDIR;
+	if (name[0] == '\0' || !strcmp(name, ".") || !strcmp(name, ".."))
+		return -EISDIR;
+
+	/* an existing file is truncated */
+	if (fs_lookup_in(parent.cluster, name, &dirent) == 0) {
+		if (dirent.attributes & FS_ATTR_DIRECTORY)
+			return -EISDIR;
+		if ((fd = fs_open_dirent(&dirent)) < 0)
+			return fd;
+		if ((ret = fs_truncate(fd, 0)) != 0) {
+			fs_close(fd);
+			return ret;
+		}
+		return fd;
+	}
+
+	if ((ret = fs_dir_add(parent.cluster, name, &dirent)) != 0)
+		return ret;
+
+	return fs_open_dirent(&dirent);
+}
+
+/*
+ * Write everything that was changed back to the device
+ * The FSInfo sector is brought up to date first so that the next mount
+ * starts with the right free count.
+ */
+int fs_sync()
+{
+	struct disk_fsinfo_t *fsinfo;
+
+	if (volume.fsinfo_lba != 0) {
+		if ((fsinfo = bcache_get(volume.fsinfo_lba)) == NULL)
+			return -EIO;
+		if (fsinfo->free_count != volume.free_clusters ||
+				fsinfo->next_free != next_free) {
+			fsinfo->free_count = volume.free_clusters;
+			fsinfo->next_free = next_free;
+			bcache_dirty(volume.fsinfo_lba);
+		}
+	}
+
+	if (bcache_flush() != 0)
+		return -EIO;
+
+	return blockdev_flush(volume.dev);
+}
+
+/*
+ * Read bytes from file into buffer
+ * Note: this looks the file up on every call, use fs_open() and
+ * fs_read_fd() to read a file piece by piece
+ */
+int fs_read(const char *filename, unsigned char* buf, size_t off, size_t count)
+{
+	int fd, ret;
+
+	if ((fd = fs_open(filename)) < 0)
+		return fd;
+
+	ret = fs_seek(fd, off, FS_SEEK_SET);
+	if (ret >= 0)
+		ret = fs_read_fd(fd, buf, count);
+	fs_close(fd);
+
+	return ret;
 }
 
 /*
@@ -366,15 +1796,11 @@ void fs_dump_part_table()
 	kprintf("root: 0x%x\n\n", volume.root);
 
 	/* read root dir */
-	unsigned char cluster[volume.sector_size * volume.cluster_size];
-	unsigned next_dirent = 0;
+	struct dir_t dir;
 	struct dirent_t dirent;
-	fs_get_cluster(volume.root, cluster);
-	emmc_dump_block(cluster);
-	while ((next_dirent = fs_readdir(cluster, next_dirent, &dirent))) {
-		if (strcmp(dirent.short_name, "")) {
-			kprintf("Long name:  '%s'\n", dirent.long_name);
-			kprintf("Short name: '%s'\n", dirent.short_name);
-		}
+	fs_dir_start(&dir, volume.root);
+	while (fs_readdir_next(&dir, &dirent)) {
+		kprintf("Long name:  '%s'\n", dirent.long_name);
+		kprintf("Short name: '%s'\n", dirent.short_name);
 	}
 }
@@ -38,7 +38,14 @@
  * bit 8 in the basic pending register forcing us to check the pending_1
  * register, the bit 11 of the basic register is set as a shortcut to
  * pending_1. This way, most of the time we only have to check the basic
- * pending register to service an IRQ.
+ * pending register to service an IRQ. A shortcut bit runs the service
+ * routine registered for the GPU interrupt it stands for.
+ *
+ * Service routines are registered by position: 0-31 for the bits of the
+ * basic pending register, then 32-63 and 64-95 for banks 1 and 2, so GPU
+ * interrupt n is at IRQ_GPU(n). A driver waiting on its device masks IRQs
+ * with irq_save(), checks what its service routine has recorded and, if
+ * nothing has happened yet, sleeps in irq_wait() until the next IRQ.
  */
 
 #define MODULE IRQ
@@ -51,6 +58,14 @@ static volatile irq_reg_t *irq_reg = (irq_reg_t *)IRQ_BASE;
 
 static irq_service_routine_t irq_service_routines[96];
 
+/* GPU interrupts behind basic pending bits 10-20 */
+static const int irq_shortcuts[] = { 7, 9, 10, 18, 19, 53, 54, 55, 56, 57, 62 };
+
+#define IRQ_SHORTCUT_FIRST	10
+#define IRQ_SHORTCUT_LAST	20
+
+#define CPSR_IRQ_DISABLE	0x80
+
 /*
  * Register a service routine with the interrupt handler
  */
@@ -68,13 +83,19 @@ void irq_register_service_routine(irq_service_routine_t isr, int pos)
  */
 static inline void irq_handle_pending(int bank)
 {
-	int bit;
-	uint32_t pending = irq_reg->pending[bank-1];
+	int bit, pos;
+	uint32_t pending;
+
+	pending = bank == 0 ? irq_reg->basic_pending : irq_reg->pending[bank-1];
 
 	while (pending) {
 		/* find the next set bit */
 		bit = 31 - __builtin_clz(pending);
-		(irq_service_routines[bank * 64 + bit])();
+		pos = bank * 32 + bit;
+		if (bank == 0 && bit >= IRQ_SHORTCUT_FIRST && bit <= IRQ_SHORTCUT_LAST)
+			pos = IRQ_GPU(irq_shortcuts[bit - IRQ_SHORTCUT_FIRST]);
+		if (irq_service_routines[pos])
+			(irq_service_routines[pos])();
 		pending ^= (1 << bit); 
 	}
 }
@@ -95,6 +116,58 @@ void irq_handle_bank_2_pending(void)
 	irq_handle_pending(2);
 }
 
+/*
+ * Let the interrupt at pos reach the ARM core
+ */
+void irq_enable(int pos)
+{
+	if (pos < 32)
+		irq_reg->basic_enable = 1 << pos;
+	else
+		irq_reg->enable[(pos - 32) / 32] = 1 << (pos % 32);
+}
+
+/*
+ * Stop the interrupt at pos from reaching the ARM core
+ */
+void irq_disable(int pos)
+{
+	if (pos < 32)
+		irq_reg->basic_disable = 1 << pos;
+	else
+		irq_reg->disable[(pos - 32) / 32] = 1 << (pos % 32);
+}
+
+/*
+ * Mask IRQs on the ARM core, returning the previous state
+ */
+unsigned irq_save()
+{
+	unsigned cpsr;
+
+	asm volatile("mrs %0, cpsr" : "=r" (cpsr));
+	asm volatile("msr cpsr_c, %0" : : "r" (cpsr | CPSR_IRQ_DISABLE) : "memory");
+	return cpsr;
+}
+
+/*
+ * Put back the IRQ mask saved by irq_save()
+ */
+void irq_restore(unsigned state)
+{
+	asm volatile("msr cpsr_c, %0" : : "r" (state) : "memory");
+}
+
+/*
+ * Sleep until an IRQ is pending, called with IRQs masked so one raised
+ * after the caller last looked still wakes us
+ */
+void irq_wait()
+{
+	/* wait for interrupt */
+	asm volatile("mcr p15, 0, %0, c7, c0, 4" : : "r" (0) : "memory");
+}
+
 /*
  * Initialize the interrupt service routine
  */
@@ -44,19 +44,196 @@
  * VC must be translated back into ARM physical addresses by subtracting
  * 0x40000000 (or 0x80000000 as the case may be).
  *
+ * All channels share the one read FIFO, so answers are sorted by channel
+ * as they are taken out of it. Once mailbox_init() has run, the mailbox
+ * raises IRQ_MAILBOX while the FIFO holds anything and the service
+ * routine empties it. An answer goes to the oldest callback waiting on
+ * its channel (see mailbox_write_async()), or else joins that channel's
+ * queue for mailbox_read(), which sleeps in irq_wait() until one arrives.
+ * Before mailbox_init(), mailbox_read() polls the FIFO instead, but still
+ * keeps answers meant for other channels.
+ *
+ * Most requests go through the property channel. A property message is a
+ * buffer of 32 bit words holding any number of tags:
+ *
+ *	word		contents
+ *	---------------------
+ *	0		size of the buffer in bytes
+ *	1		0 for a request, MBOX_PROP_OK in the answer
+ *	2...		tags
+ *	last		0, the end tag
+ *
+ * and each tag is laid out as:
+ *
+ *	word		contents
+ *	---------------------
+ *	0		tag id
+ *	1		size of the value buffer in bytes
+ *	2		0 for a request, bit 31 set and the size of the answer
+ *	3...		value buffer, arguments then room for the answer
+ *
+ * The VideoCore answers every tag in the buffer in place, so a message
+ * costs one round trip however many tags it carries. mailbox_prop_add()
+ * appends tags to a message, mailbox_prop_send() sends it and
+ * mailbox_prop_find() and mailbox_prop_value() pick the answers out.
+ *
+ * The board revision, MAC address, memory split and clocks do not change
+ * while we run, so mailbox_info_init() asks for all of them in a single
+ * message at boot and the lookups below answer from memory. A fact the
+ * VideoCore leaves unanswered, such as the MAC address of a board without
+ * one, fails its own lookup and no other; the message is not sent again
+ * for it. The one exception is a clock rate, which mailbox_set_clock_rate()
+ * changes; it drops the cached rate and the next lookup asks the VideoCore
+ * again, as it does for a rate that went unanswered.
+ *
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
  */
 
 #include <errno.h>
+#include <irq.h>
 #include <mailbox.h>
+#include <memory.h>
 #include <platform.h>
+#include <string.h>
+#include <timer.h>
 #include <util.h>
 
+/*
+ * Register access, on the host the mailbox and the VideoCore behind it
+ * are modelled by the simulator in test/mailbox_sim.c
+ */
+#ifdef MAILBOX_SIM
+#include "mailbox_sim.h"
+static volatile mailbox_reg_t *mailbox_reg = &mailbox_sim_reg;
+#define mailbox_read_reg(reg) mailbox_sim_read(reg)
+#define mailbox_write_reg(reg, val) mailbox_sim_write(reg, val)
+#define mailbox_bus_addr(addr) mailbox_sim_bus_addr(addr)
+#else
 static volatile mailbox_reg_t *mailbox_reg = (mailbox_reg_t *)MBOX_BASE;
+#define mailbox_read_reg(reg) (*(reg))
+#define mailbox_write_reg(reg, val) (*(reg) = (val))
+#define mailbox_bus_addr(addr) ((uint32_t)(addr) + MEM_ALIAS_L2_CO)
+#endif
 
 #define WRITE_READY (1 << 31)
 #define READ_READY (1 << 30)
 
+#define CONFIG_DATA_IRQ	0x1		/* interrupt while the FIFO holds data */
+#define TIMEOUT		1000		/* ms to wait for an answer */
+
+#define PROP_HEADER	2		/* words before the first tag */
+#define PROP_TAG_HEADER	3		/* words before a tag's value buffer */
+#define PROP_ANSWERED	0x80000000	/* the VideoCore answered a tag */
+
+#define CLOCKS		(MBOX_CLOCK_CORE + 1)	/* clock ids we keep, 0 is unused */
+#define NO_CLOCK	0x2			/* clock state of a missing clock */
+
+static struct mailbox_stats_t stats;
+
+/*
+ * Answers and callbacks on a channel
+ */
+struct mailbox_chan_t {
+	uint32_t msgs[MBOX_QUEUE_LEN];	/* answers nobody was waiting on */
+	unsigned head, count;
+	mailbox_callback_t done[MBOX_QUEUE_LEN];	/* waiting, oldest first */
+	void *arg[MBOX_QUEUE_LEN];
+	unsigned done_head, done_count;
+};
+
+static struct mailbox_chan_t mailbox_chans[MBOX_CHAN_MAX + 1];
+static int mailbox_irq_ready;		/* answers are taken by interrupt */
+
+/* board facts the VideoCore answered for */
+#define INFO_BOARD_REV	0x1
+#define INFO_MAC	0x2
+#define INFO_ARM_MEMORY	0x4
+#define INFO_VC_MEMORY	0x8
+
+/*
+ * Board facts, filled in by mailbox_info_init()
+ */
+static struct {
+	int asked;			/* 1 once the facts were answered */
+	unsigned known;			/* INFO_* that were answered */
+	uint32_t board_rev;
+	uint8_t mac[6];
+	uint32_t arm_memory[2];		/* base and size */
+	uint32_t vc_memory[2];
+	uint32_t clock_state[CLOCKS];
+	uint32_t clock_rate[CLOCKS];
+	unsigned rate_valid;		/* bit per clock whose rate is known */
+} info;
+
+/*
+ * Hand an answer to the callback waiting for it or queue it on its channel
+ */
+static void mailbox_deliver(uint32_t reg)
+{
+	struct mailbox_chan_t *chan;
+	mailbox_callback_t done;
+	void *arg;
+	int channel = reg & 0xF;
+
+	if (channel > MBOX_CHAN_MAX) {
+		++stats.dropped;
+		return;
+	}
+	chan = &mailbox_chans[channel];
+
+	if (chan->done_count > 0) {
+		done = chan->done[chan->done_head];
+		arg = chan->arg[chan->done_head];
+		chan->done_head = (chan->done_head + 1) % MBOX_QUEUE_LEN;
+		--chan->done_count;
+		done(channel, reg & ~0xF, arg);
+		return;
+	}
+
+	if (chan->count == MBOX_QUEUE_LEN) {
+		++stats.dropped;
+		return;
+	}
+	chan->msgs[(chan->head + chan->count++) % MBOX_QUEUE_LEN] = reg & ~0xF;
+}
+
+/*
+ * Take every answer out of the read FIFO
+ */
+static void mailbox_drain()
+{
+	/*while (!(READ4(MBOX_STATUS) & READ_READY))*/
+	while (!(mailbox_read_reg(&mailbox_reg->status) & READ_READY))
+		mailbox_deliver(mailbox_read_reg(&mailbox_reg->read));
+}
+
+/*
+ * Mailbox interrupt service routine
+ */
+static void mailbox_service_irq()
+{
+	++stats.irqs;
+	mailbox_drain();
+}
+
+/*
+ * Take answers by interrupt from now on
+ */
+void mailbox_init()
+{
+	unsigned state;
+
+	state = irq_save();
+	irq_register_service_routine(mailbox_service_irq, IRQ_MAILBOX);
+	irq_enable(IRQ_MAILBOX);
+	mailbox_write_reg(&mailbox_reg->config,
+			mailbox_read_reg(&mailbox_reg->config) | CONFIG_DATA_IRQ);
+	mailbox_irq_ready = 1;
+
+	/* anything already waiting is taken when IRQs come back on */
+	irq_restore(state);
+}
+
 /*
  * Write a message to the VideoCore mailbox
  * note: message data is *not* shifted!
@@ -66,7 +243,7 @@ int mailbox_write(int channel, uint32_t message)
 	uint32_t reg;
 
 	/* validate inputs */
-	if (channel > MBOX_CHAN_MAX)
+	if (channel < 0 || channel > MBOX_CHAN_MAX)
 		return -EINVAL;
 	if (message & 0xF)
 		return -EINVAL;
@@ -76,42 +253,393 @@ int mailbox_write(int channel, uint32_t message)
 
 	/* wait for the status register to clear for writing */
 	/*while (READ4(MBOX_STATUS) & WRITE_READY)*/
-	while (mailbox_reg->status & WRITE_READY)
+	while (mailbox_read_reg(&mailbox_reg->status) & WRITE_READY)
 		;
 
 	/* write message to mailbox */
 	/*WRITE4(MBOX_WRITE, reg);*/
-	mailbox_reg->write = reg;
+	mailbox_write_reg(&mailbox_reg->write, reg);
 
 	return 0;
 }
 
 /*
- * Read a message from the VideoCore mailbox
+ * Write a message and have done called with the answer, from the service
+ * routine; answers on a channel come back in the order they were asked
+ */
+int mailbox_write_async(int channel, uint32_t message, mailbox_callback_t done,
+		void *arg)
+{
+	struct mailbox_chan_t *chan;
+	unsigned state, i;
+
+	if (channel < 0 || channel > MBOX_CHAN_MAX || !done)
+		return -EINVAL;
+	if (message & 0xF)
+		return -EINVAL;
+	chan = &mailbox_chans[channel];
+
+	/* the callback is in place before the answer can arrive */
+	state = irq_save();
+	if (chan->done_count == MBOX_QUEUE_LEN) {
+		irq_restore(state);
+		return -ENOSPC;
+	}
+	i = (chan->done_head + chan->done_count++) % MBOX_QUEUE_LEN;
+	chan->done[i] = done;
+	chan->arg[i] = arg;
+	irq_restore(state);
+
+	return mailbox_write(channel, message);
+}
+
+/*
+ * Read a message from the VideoCore mailbox, sleeping until one arrives
  * note: message data is *not* shifted!
  */
 int mailbox_read(int channel, uint32_t *message)
 {
-	uint32_t reg;
+	struct mailbox_chan_t *chan;
+	unsigned start, state;
 
 	/* validate input */
-	if (channel > MBOX_CHAN_MAX)
+	if (channel < 0 || channel > MBOX_CHAN_MAX)
+		return -EINVAL;
+	chan = &mailbox_chans[channel];
+
+	start = timer_read();
+	for (;;) {
+		state = irq_save();
+		if (!mailbox_irq_ready)
+			mailbox_drain();
+
+		if (chan->count > 0) {
+			*message = chan->msgs[chan->head];
+			chan->head = (chan->head + 1) % MBOX_QUEUE_LEN;
+			--chan->count;
+			irq_restore(state);
+			return 0;
+		}
+		if (timer_read() - start >= TIMEOUT * 1000) {
+			irq_restore(state);
+			++stats.timeouts;
+			return -EIO;
+		}
+
+		/* sleep, the interrupt is taken once IRQs are restored */
+		if (mailbox_irq_ready) {
+			++stats.sleeps;
+			timer_set_alarm(start + TIMEOUT * 1000);
+			irq_wait();
+		}
+		irq_restore(state);
+	}
+}
+
+/*
+ * Start an empty property message
+ */
+void mailbox_prop_init(struct mailbox_prop_t *prop)
+{
+	prop->len = PROP_HEADER;
+}
+
+/*
+ * Append a tag with nargs words of arguments and a value buffer of size
+ * bytes, big enough for the arguments and the answer; returns a handle
+ * for mailbox_prop_value()
+ */
+int mailbox_prop_add(struct mailbox_prop_t *prop, uint32_t tag,
+		const uint32_t *args, unsigned nargs, unsigned size)
+{
+	unsigned words = (size + 3) / 4;
+	uint32_t *t = &prop->buf[prop->len];
+	int handle = prop->len;
+
+	if (nargs > words)
 		return -EINVAL;
 
-	/* loop until we are on the right channel */
-	do {
-		/* wait for the status register to clear for reading */
-		/*while (READ4(MBOX_STATUS) & READ_READY)*/
-		while (mailbox_reg->status & READ_READY)
-			;
+	/* leave room for the end tag */
+	if (prop->len + PROP_TAG_HEADER + words + 1 > MBOX_PROP_WORDS)
+		return -ENOSPC;
+
+	t[0] = tag;
+	t[1] = words * 4;
+	t[2] = nargs * 4;
+	memcpy(&t[PROP_TAG_HEADER], args, nargs * 4);
+	memset(&t[PROP_TAG_HEADER + nargs], 0, (words - nargs) * 4);
+	prop->len += PROP_TAG_HEADER + words;
+
+	return handle;
+}
+
+/*
+ * Send a property message and wait for the VideoCore to answer it
+ */
+int mailbox_prop_send(struct mailbox_prop_t *prop)
+{
+	unsigned start, handle;
+	uint32_t reply;
+
+	prop->buf[prop->len] = 0;
+	prop->buf[0] = (prop->len + 1) * 4;
+	prop->buf[1] = 0;
+
+	++stats.transactions;
+	for (handle=PROP_HEADER; handle<prop->len;
+			handle+=PROP_TAG_HEADER+prop->buf[handle+1]/4)
+		++stats.tags;
 
-		/* read message to mailbox */
-		/*reg = READ4(MBOX_READ);*/
-		reg = mailbox_reg->read;
-	} while (channel != (reg & 0xF));
+	start = timer_read();
+	mailbox_write(MBOX_CHAN_PROP, mailbox_bus_addr(prop->buf));
 
-	/* save message */
-	*message = reg & ~0xF;
+	/* a late answer to a message somebody gave up on is not ours */
+	for (;;) {
+		if (mailbox_read(MBOX_CHAN_PROP, &reply) != 0)
+			return -EIO;
+		if (reply == mailbox_bus_addr(prop->buf))
+			break;
+		++stats.dropped;
+	}
+	stats.us += timer_read() - start;
 
+	if (prop->buf[1] != MBOX_PROP_OK)
+		return -EIO;
 	return 0;
 }
+
+/*
+ * Return the handle of the first tag in a message with id tag
+ */
+int mailbox_prop_find(struct mailbox_prop_t *prop, uint32_t tag)
+{
+	unsigned handle;
+
+	for (handle=PROP_HEADER; handle<prop->len;
+			handle+=PROP_TAG_HEADER+prop->buf[handle+1]/4)
+		if (prop->buf[handle] == tag)
+			return handle;
+
+	return -ENOENT;
+}
+
+/*
+ * Return the value buffer of an answered tag and the size of the answer
+ * in bytes, or NULL if the VideoCore did not answer it
+ */
+uint32_t *mailbox_prop_value(struct mailbox_prop_t *prop, int handle,
+		unsigned *size)
+{
+	uint32_t *t = &prop->buf[handle];
+
+	if (handle < PROP_HEADER || handle >= prop->len)
+		return NULL;
+	if (!(t[2] & PROP_ANSWERED))
+		return NULL;
+
+	if (size)
+		*size = t[2] & ~PROP_ANSWERED;
+	return &t[PROP_TAG_HEADER];
+}
+
+/*
+ * Copy out the property channel statistics
+ */
+void mailbox_get_stats(struct mailbox_stats_t *ret)
+{
+	memcpy(ret, &stats, sizeof(struct mailbox_stats_t));
+}
+
+/*
+ * Copy the answer to a tag into the board facts, if there is one
+ */
+static void info_copy(struct mailbox_prop_t *prop, int handle, void *dst,
+		unsigned len, unsigned fact)
+{
+	uint32_t *val;
+
+	if (!(val = mailbox_prop_value(prop, handle, NULL)))
+		return;
+	memcpy(dst, val, len);
+	info.known |= fact;
+}
+
+/*
+ * Ask the VideoCore for every board fact in one message
+ * Returns -EIO only if the message went unanswered, a missing fact fails
+ * its own lookup.
+ */
+int mailbox_info_init()
+{
+	struct mailbox_prop_t prop;
+	int rev, mac, arm, vc, state[CLOCKS], rate[CLOCKS];
+	uint32_t id, *val;
+
+	mailbox_prop_init(&prop);
+	rev = mailbox_prop_add(&prop, MBOX_TAG_BOARD_REV, NULL, 0, 4);
+	mac = mailbox_prop_add(&prop, MBOX_TAG_MAC_ADDR, NULL, 0, 8);
+	arm = mailbox_prop_add(&prop, MBOX_TAG_ARM_MEMORY, NULL, 0, 8);
+	vc = mailbox_prop_add(&prop, MBOX_TAG_VC_MEMORY, NULL, 0, 8);
+	for (id=1; id<CLOCKS; id++) {
+		state[id] = mailbox_prop_add(&prop, MBOX_TAG_CLOCK_STATE, &id, 1, 8);
+		rate[id] = mailbox_prop_add(&prop, MBOX_TAG_CLOCK_RATE, &id, 1, 8);
+	}
+
+	if (mailbox_prop_send(&prop) != 0)
+		return -EIO;
+
+	info.known = 0;
+	info_copy(&prop, rev, &info.board_rev, 4, INFO_BOARD_REV);
+	info_copy(&prop, mac, info.mac, 6, INFO_MAC);
+	info_copy(&prop, arm, info.arm_memory, 8, INFO_ARM_MEMORY);
+	info_copy(&prop, vc, info.vc_memory, 8, INFO_VC_MEMORY);
+
+	/* a clock the VideoCore does not answer for is missing, a rate it
+	 * does not answer is asked for again on its own */
+	info.rate_valid = 0;
+	for (id=1; id<CLOCKS; id++) {
+		val = mailbox_prop_value(&prop, state[id], NULL);
+		info.clock_state[id] = val ? val[1] : NO_CLOCK;
+		if ((val = mailbox_prop_value(&prop, rate[id], NULL))) {
+			info.clock_rate[id] = val[1];
+			info.rate_valid |= 1 << id;
+		}
+	}
+	info.asked = 1;
+
+	return 0;
+}
+
+/*
+ * Fill in the board facts on first use, returns 0 if the facts asked for
+ * are known
+ */
+static int info_get(unsigned facts)
+{
+	if (!info.asked && mailbox_info_init() != 0)
+		return -EIO;
+	return (info.known & facts) == facts ? 0 : -EIO;
+}
+
+/*
+ * Return the board revision
+ */
+int mailbox_board_rev(uint32_t *rev)
+{
+	if (info_get(INFO_BOARD_REV) != 0)
+		return -EIO;
+	*rev = info.board_rev;
+	return 0;
+}
+
+/*
+ * Return the 6 byte MAC address
+ */
+int mailbox_mac_addr(uint8_t *mac)
+{
+	if (info_get(INFO_MAC) != 0)
+		return -EIO;
+	memcpy(mac, info.mac, 6);
+	return 0;
+}
+
+/*
+ * Return the memory given to the ARM core
+ */
+int mailbox_arm_memory(uint32_t *base, uint32_t *size)
+{
+	if (info_get(INFO_ARM_MEMORY) != 0)
+		return -EIO;
+	*base = info.arm_memory[0];
+	*size = info.arm_memory[1];
+	return 0;
+}
+
+/*
+ * Return the memory kept by the VideoCore
+ */
+int mailbox_vc_memory(uint32_t *base, uint32_t *size)
+{
+	if (info_get(INFO_VC_MEMORY) != 0)
+		return -EIO;
+	*base = info.vc_memory[0];
+	*size = info.vc_memory[1];
+	return 0;
+}
+
+/*
+ * Return 1 if a clock is running, 0 if it is stopped
+ */
+int mailbox_clock_on(int clock)
+{
+	if (clock <= 0 || clock >= CLOCKS)
+		return -EINVAL;
+	if (info_get(0) != 0)
+		return -EIO;
+	if (info.clock_state[clock] & NO_CLOCK)
+		return -EINVAL;
+	return info.clock_state[clock] & 1;
+}
+
+/*
+ * Return the rate of a clock in Hz, or 0 if it cannot be had
+ */
+unsigned mailbox_clock_rate(int clock)
+{
+	struct mailbox_prop_t prop;
+	uint32_t id = clock;
+	uint32_t *val;
+	int rate;
+
+	if (clock <= 0 || clock >= CLOCKS || info_get(0) != 0)
+		return 0;
+	if (info.rate_valid & (1 << clock))
+		return info.clock_rate[clock];
+
+	/* the rate was changed since we last asked, or never answered */
+	mailbox_prop_init(&prop);
+	rate = mailbox_prop_add(&prop, MBOX_TAG_CLOCK_RATE, &id, 1, 8);
+	if (mailbox_prop_send(&prop) != 0 ||
+			!(val = mailbox_prop_value(&prop, rate, NULL)))
+		return 0;
+
+	info.clock_rate[clock] = val[1];
+	info.rate_valid |= 1 << clock;
+	return val[1];
+}
+
+/*
+ * Set the rate of a clock, returns the rate the VideoCore chose or 0
+ */
+unsigned mailbox_set_clock_rate(int clock, unsigned rate)
+{
+	struct mailbox_prop_t prop;
+	uint32_t args[3];
+	uint32_t *val;
+	int set;
+
+	if (clock <= 0 || clock >= CLOCKS)
+		return 0;
+
+	args[0] = clock;
+	args[1] = rate;
+	args[2] = 0;		/* do not skip turbo settings */
+	mailbox_prop_init(&prop);
+	set = mailbox_prop_add(&prop, MBOX_TAG_SET_CLOCK_RATE, args, 3, 12);
+
+	/* whatever happened, the cached rate is no good */
+	mailbox_clock_invalidate(clock);
+	if (mailbox_prop_send(&prop) != 0 ||
+			!(val = mailbox_prop_value(&prop, set, NULL)))
+		return 0;
+	return val[1];
+}
+
+/*
+ * Forget the cached rate of a clock that was changed behind our back
+ */
+void mailbox_clock_invalidate(int clock)
+{
+	if (clock > 0 && clock < CLOCKS)
+		info.rate_valid &= ~(1 << clock);
+}
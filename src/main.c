@@ -18,8 +18,10 @@
 #include <emmc.h>
 #include <framebuffer.h>
 #include <gpio.h>
+#include <irq.h>
 #include <led.h>
 #include <log.h>
+#include <mailbox.h>
 #include <timer.h>
 #include <util.h>
 
@@ -28,6 +30,8 @@
  */
 slice_main()
 {
+	struct mailbox_stats_t mbox;
+	uint32_t rev, base, size;
 	int i, ret;
 
 	/* prepare LED pin */
@@ -43,9 +47,25 @@ slice_main()
 	console_init();
 	kprintf("Console initialized, welcome to Slice.\n");
 
+	/* route interrupts to their service routines */
+	irq_init();
+	timer_init();
+	mailbox_init();
+
+	/* ask the VideoCore for the board facts in one go */
+	if (mailbox_info_init() == 0 && mailbox_board_rev(&rev) == 0 &&
+			mailbox_arm_memory(&base, &size) == 0)
+		log(INFO, "board revision 0x%x, %u MB for the ARM core", rev,
+				size >> 20);
+
 	/* initialize SD card */
 	emmc_init();
 
+	/* time spent asking the VideoCore for board facts */
+	mailbox_get_stats(&mbox);
+	log(INFO, "%u property messages, %u tags in %u us", mbox.transactions,
+			mbox.tags, mbox.us);
+
 	kprintf("Done.\n");
 
 	error_solid();
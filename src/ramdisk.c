@@ -0,0 +1,68 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * src/ramdisk.c
+ *
+ * RAM disk
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	March 14 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * A block device backed by memory. Requests complete immediately, which
+ * makes it the baseline to measure the filesystem and cache against: any
+ * time spent reading from a RAM disk is time spent in our own code.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#include <ramdisk.h>
+#include <string.h>
+#include <types.h>
+
+static int ramdisk_read(struct blockdev_t *dev, unsigned lba, unsigned count,
+		void *buf)
+{
+	memcpy(buf, (uint8_t *)dev->priv + lba * dev->block_size,
+			count * dev->block_size);
+	return 0;
+}
+
+static int ramdisk_write(struct blockdev_t *dev, unsigned lba, unsigned count,
+		const void *buf)
+{
+	memcpy((uint8_t *)dev->priv + lba * dev->block_size, buf,
+			count * dev->block_size);
+	return 0;
+}
+
+/* discarded blocks read back as zeros */
+static int ramdisk_discard(struct blockdev_t *dev, unsigned lba, unsigned count)
+{
+	memset((uint8_t *)dev->priv + lba * dev->block_size, 0,
+			count * dev->block_size);
+	return 0;
+}
+
+static const struct blockdev_ops_t ramdisk_ops = {
+	.read = ramdisk_read,
+	.write = ramdisk_write,
+	.flush = NULL,
+	.discard = ramdisk_discard,
+};
+
+/*
+ * Make a block device out of num_blocks blocks of memory at mem
+ */
+void ramdisk_init(struct blockdev_t *dev, void *mem, unsigned num_blocks)
+{
+	memset(dev, 0, sizeof(struct blockdev_t));
+	dev->name = "ramdisk";
+	dev->ops = &ramdisk_ops;
+	dev->block_size = BLOCKDEV_BLOCK_SIZE;
+	dev->num_blocks = num_blocks;
+	dev->priv = mem;
+}
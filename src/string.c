@@ -13,6 +13,7 @@
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
  */
 
+#include <string.h>
 #include <types.h>
 
 void *memcpy(void *dst, const void *src, unsigned long size)
@@ -81,3 +82,27 @@ int toupper(int c)
 {
 	return (c > 96 && c < 123) ? c - ('a' - 'A') : c;
 }
+
+/* one case insensitive FNV-1a step */
+unsigned strhash_char(unsigned hash, int c)
+{
+	return (hash ^ (unsigned char)toupper((unsigned char)c)) * 16777619u;
+}
+
+unsigned strhash(const char *str)
+{
+	unsigned hash = STRHASH_INIT;
+	while (*str)
+		hash = strhash_char(hash, *str++);
+	return hash;
+}
+
+int strcasecmp(const char *str1, const char *str2)
+{
+	int c1, c2;
+	do {
+		c1 = toupper((unsigned char)*str1++);
+		c2 = toupper((unsigned char)*str2++);
+	} while (c1 == c2 && c1 != '\0');
+	return c1 == c2 ? 0 : c1 > c2 ? 1 : -1;
+}
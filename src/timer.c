@@ -35,9 +35,12 @@
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
  */
 
+#include <irq.h>
 #include <platform.h>
 #include <util.h>
 
+#define TIMER_MATCH_1	0x2	/* compare 1 matched the counter */
+
 static volatile timer_reg_t *timer_reg = (timer_reg_t *)TIMER_BASE;
 
 /*
@@ -67,3 +70,30 @@ void timer_wait(unsigned ticks)
 		current = timer_reg->count_lo;
 	} while (current - start < ticks);
 }
+
+/*
+ * raise IRQ_TIMER_1 when the counter reaches ticks, to wake a CPU
+ * sleeping in irq_wait()
+ */
+void timer_set_alarm(unsigned ticks)
+{
+	timer_reg->status = TIMER_MATCH_1;
+	timer_reg->cmp_1 = ticks;
+}
+
+/*
+ * acknowledge the alarm, whoever was waiting has woken up
+ */
+static void timer_service_alarm()
+{
+	timer_reg->status = TIMER_MATCH_1;
+}
+
+/*
+ * route the alarm to the ARM core
+ */
+void timer_init()
+{
+	irq_register_service_routine(timer_service_alarm, IRQ_TIMER_1);
+	irq_enable(IRQ_TIMER_1);
+}
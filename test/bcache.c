@@ -0,0 +1,216 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * test/bcache.c
+ *
+ * Tests for the block cache
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	March 7 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#include <bcache.h>
+#include <bio.h>
+#include <blockdev.h>
+#include <errno.h>
+#include <ramdisk.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "imagedev.h"
+
+const char *test_name = "BCACHE";
+
+#define RAM_BLOCKS 1024
+
+static struct blockdev_t disk;
+static struct blockdev_t ramdev;
+static unsigned char ram[RAM_BLOCKS * BLOCKDEV_BLOCK_SIZE];
+static unsigned char other_ram[RAM_BLOCKS * BLOCKDEV_BLOCK_SIZE];
+
+/*
+ * Compare the cached copy of a block with the disk
+ */
+static int same_as_disk(unsigned lba, const unsigned char *cached)
+{
+	unsigned char block[BLOCKDEV_BLOCK_SIZE];
+	int i;
+
+	if (cached == NULL || blockdev_read(&disk, lba, 1, block) != 0)
+		return 0;
+	for (i=0; i<BLOCKDEV_BLOCK_SIZE; i++)
+		if (block[i] != cached[i])
+			return 0;
+	return 1;
+}
+
+/*
+ * Write operation of a RAM disk that has stopped taking writes
+ */
+static int failing_write(struct blockdev_t *dev, unsigned lba, unsigned count,
+		const void *buf)
+{
+	return -EIO;
+}
+
+const char *run_test()
+{
+	unsigned i;
+	unsigned char *block;
+	unsigned char buf[4 * BLOCKDEV_BLOCK_SIZE];
+	struct bcache_stats_t stats;
+	struct blockdev_stats_t before, after;
+	unsigned char *ram_block;
+	struct blockdev_t other;
+	struct blockdev_ops_t failing_ops;
+
+	if (imagedev_open(&disk, getenv(IMAGEDEV_ENV), NULL) != 0)
+		return "opening disk image";
+	bcache_init(&disk);
+
+	/* misses read the block in, hits do not */
+	if (bcache_contains(0))
+		return "finding block in empty cache";
+	block = bcache_get(0);
+	if (!same_as_disk(0, block) || block[510] != 0x55 || block[511] != 0xAA)
+		return "reading block into cache";
+	blockdev_get_stats(&disk, &before);
+	if (bcache_get(0) != block || !bcache_contains(0))
+		return "finding cached block";
+	blockdev_get_stats(&disk, &after);
+	if (after.reads != before.reads)
+		return "reading cached block from disk";
+
+	/* readahead only queues the missing blocks of a range */
+	bcache_get(2050);
+	blockdev_get_stats(&disk, &before);
+	if (bcache_readahead(2048, 4) != 0 || !bcache_contains(2048))
+		return "reading ahead";
+	blockdev_get_stats(&disk, &after);
+	if (after.reads != before.reads)
+		return "reading ahead before blocks are wanted";
+
+	/* copying stops at the first block that is not cached, the queued
+	 * blocks arrive in a request for each run */
+	if (bcache_copy(2049, 4, buf) != 3)
+		return "copying cached blocks";
+	blockdev_get_stats(&disk, &after);
+	if (after.reads - before.reads != 2 || after.blocks_read - before.blocks_read != 3)
+		return "reading ahead around cached block";
+	for (i=0; i<3; i++)
+		if (!same_as_disk(2049 + i, &buf[i * BLOCKDEV_BLOCK_SIZE]))
+			return "copying cached blocks returned wrong data";
+
+	bcache_get_stats(&stats);
+	if (stats.hits != 4 || stats.misses != 2 || stats.ra_blocks != 3 ||
+			stats.ra_hits != 2 || stats.evictions != 0)
+		return "counting hits and misses";
+
+	/* flood the cache while keeping one block hot */
+	for (i=0; i<2*BCACHE_SIZE; i++) {
+		bcache_get(4096 + i);
+		if (bcache_get(0) == NULL || !bcache_contains(0))
+			return "evicting recently used block";
+	}
+	if (bcache_contains(4096) || !bcache_contains(4096 + i - 1))
+		return "evicting least recently used block";
+
+	bcache_get_stats(&stats);
+	if (stats.ra_unused != 1 || stats.evictions != 2*BCACHE_SIZE - (BCACHE_SIZE - 5))
+		return "counting evictions";
+
+	/* writes stay in the cache until they are flushed */
+	ramdisk_init(&ramdev, ram, RAM_BLOCKS);
+	bcache_init(&ramdev);
+	memset(buf, 0xAB, sizeof(buf));
+	bcache_write(20, 2, buf);
+	bcache_write(12, 2, buf);
+	bcache_write(10, 2, buf);
+	block = bcache_get(40);
+	block[0] = 0xCD;
+	bcache_dirty(40);
+	if (ram[10 * BLOCKDEV_BLOCK_SIZE] != 0 || ram[40 * BLOCKDEV_BLOCK_SIZE] != 0)
+		return "writing through the cache";
+	if ((block = bcache_get(11)) == NULL || block[0] != 0xAB)
+		return "reading back a dirty block";
+
+	/* neighbouring blocks are written back together, in LBA order */
+	blockdev_get_stats(&ramdev, &before);
+	if (bcache_flush() != 0)
+		return "flushing dirty blocks";
+	blockdev_get_stats(&ramdev, &after);
+	if (after.writes - before.writes != 3 ||
+			after.blocks_written - before.blocks_written != 7)
+		return "batching dirty blocks";
+	for (i=10; i<22; i++) {
+		ram_block = &ram[i * BLOCKDEV_BLOCK_SIZE];
+		if (ram_block[0] != ((i < 14 || i >= 20) ? 0xAB : 0) ||
+				ram_block[BLOCKDEV_BLOCK_SIZE-1] != ram_block[0])
+			return "writing back dirty blocks";
+	}
+	if (ram[40 * BLOCKDEV_BLOCK_SIZE] != 0xCD)
+		return "writing back block changed in place";
+
+	/* clean blocks are not written twice */
+	if (bcache_flush() != 0)
+		return "flushing clean cache";
+	blockdev_get_stats(&ramdev, &before);
+	if (before.writes != after.writes)
+		return "writing back clean blocks";
+
+	/* recycling a dirty block writes back the whole cache */
+	bcache_write(0, BCACHE_SIZE, NULL);
+	bcache_get(BCACHE_SIZE);
+	blockdev_get_stats(&ramdev, &after);
+	if (after.writes - before.writes != BCACHE_SIZE / BIO_MAX_BLOCKS)
+		return "writing back dirty blocks on eviction";
+
+	bcache_get_stats(&stats);
+	if (stats.wb_blocks != 7 + BCACHE_SIZE ||
+			stats.wb_requests != 3 + BCACHE_SIZE / BIO_MAX_BLOCKS)
+		return "counting written back blocks";
+
+	/* with every block pinned there is nothing to recycle */
+	for (i=0; i<BCACHE_SIZE; i++)
+		if (bcache_pin(i) == NULL)
+			return "pinning blocks";
+	if (bcache_get(BCACHE_SIZE) != NULL || bcache_readahead(BCACHE_SIZE, 1) == 0 ||
+			bcache_write(BCACHE_SIZE, 1, buf) == 0)
+		return "recycling pinned blocks";
+	for (i=0; i<BCACHE_SIZE; i++)
+		if (!bcache_contains(i))
+			return "keeping pinned blocks";
+	bcache_unpin(0);
+	if (bcache_get(BCACHE_SIZE) == NULL || bcache_contains(0))
+		return "recycling unpinned block";
+	for (i=1; i<BCACHE_SIZE; i++)
+		bcache_unpin(i);
+
+	/* a block the device refused is not written to the next device */
+	failing_ops = *ramdev.ops;
+	failing_ops.write = failing_write;
+	ramdev.ops = &failing_ops;
+	memset(buf, 0xEE, sizeof(buf));
+	bcache_write(5, 1, buf);
+	if (bcache_flush() != -EIO)
+		return "failing write-back";
+	ramdisk_init(&other, other_ram, RAM_BLOCKS);
+	bcache_init(&other);
+	bcache_write(7, 1, buf);
+	blockdev_get_stats(&other, &before);
+	if (bcache_flush() != 0 || other_ram[5 * BLOCKDEV_BLOCK_SIZE] != 0 ||
+			other_ram[7 * BLOCKDEV_BLOCK_SIZE] != 0xEE)
+		return "writing back blocks of another device";
+	blockdev_get_stats(&other, &after);
+	if (after.blocks_written - before.blocks_written != 1 || bcache_flush() != 0)
+		return "counting dirty blocks after changing device";
+	blockdev_get_stats(&other, &before);
+	if (before.writes != after.writes)
+		return "writing back clean blocks after changing device";
+
+	return NULL;
+}
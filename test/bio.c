@@ -0,0 +1,190 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * test/bio.c
+ *
+ * Tests for the block I/O request queue
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	April 4 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#include <stdlib.h>
+
+#include <bio.h>
+#include <blockdev.h>
+#include <errno.h>
+#include <ramdisk.h>
+#include <string.h>
+
+#include "imagedev.h"
+
+const char *test_name = "BIO";
+
+#define RAM_BLOCKS 1024
+#define NUM_BIOS (2 * BIO_MAX_BLOCKS)
+
+static unsigned char ram[RAM_BLOCKS * BLOCKDEV_BLOCK_SIZE];
+static unsigned char buf[NUM_BIOS * BLOCKDEV_BLOCK_SIZE];
+static unsigned char direct[NUM_BIOS * BLOCKDEV_BLOCK_SIZE];
+static struct bio_t bios[NUM_BIOS];
+
+/* completed requests in the order their callbacks ran */
+static unsigned done_lba[NUM_BIOS];
+static int done_status[NUM_BIOS];
+static unsigned num_done;
+
+static void record_done(struct bio_t *bio, int status)
+{
+	done_lba[num_done] = bio->lba;
+	done_status[num_done] = status;
+	++num_done;
+}
+
+/*
+ * Queue a one block request for lba using the nth bio and nth block of buf
+ */
+static void submit(struct bio_queue_t *queue, int n, unsigned lba, int dir)
+{
+	bios[n].lba = lba;
+	bios[n].count = 1;
+	bios[n].buf = &buf[n * BLOCKDEV_BLOCK_SIZE];
+	bios[n].dir = dir;
+	bios[n].done = record_done;
+	bio_submit(queue, &bios[n]);
+}
+
+/*
+ * Return true if a buffer holds block lba of the RAM disk
+ */
+static int same_as_ram(const unsigned char *block, unsigned lba)
+{
+	int i;
+
+	for (i=0; i<BLOCKDEV_BLOCK_SIZE; i++)
+		if (block[i] != ram[lba * BLOCKDEV_BLOCK_SIZE + i])
+			return 0;
+	return 1;
+}
+
+const char *run_test()
+{
+	int i;
+	struct bio_queue_t queue;
+	struct bio_stats_t stats;
+	struct blockdev_t ramdev, image;
+	struct blockdev_stats_t before, after;
+	struct imagedev_latency_t latency = { 2000, 0 };
+
+	for (i=0; i<sizeof(ram); i++)
+		ram[i] = (i / BLOCKDEV_BLOCK_SIZE * 7 + i) & 0xFF;
+	ramdisk_init(&ramdev, ram, RAM_BLOCKS);
+	bio_queue_init(&queue, &ramdev);
+
+	/* nothing happens until the queue runs */
+	submit(&queue, 0, 12, BIO_READ);
+	submit(&queue, 1, 30, BIO_WRITE);
+	submit(&queue, 2, 10, BIO_READ);
+	submit(&queue, 3, 13, BIO_READ);
+	submit(&queue, 4, 5, BIO_READ);
+	submit(&queue, 5, 11, BIO_READ);
+	memset(&buf[1 * BLOCKDEV_BLOCK_SIZE], 0xAB, BLOCKDEV_BLOCK_SIZE);
+	blockdev_get_stats(&ramdev, &before);
+	if (before.reads != 0 || before.writes != 0 || !bios[0].pending)
+		return "submitting requests";
+
+	/* neighbouring reads go in one command, in LBA order */
+	bio_run(&queue);
+	blockdev_get_stats(&ramdev, &after);
+	if (after.reads != 2 || after.blocks_read != 5 || after.writes != 1)
+		return "merging neighbouring requests";
+	if (num_done != 6 || done_lba[0] != 5 || done_lba[1] != 10 ||
+			done_lba[4] != 13 || done_lba[5] != 30)
+		return "completing requests in LBA order";
+	for (i=0; i<6; i++)
+		if (bios[i].pending || done_status[i] != 0)
+			return "reporting status of completed requests";
+	for (i=0; i<6; i++)
+		if (!same_as_ram(&buf[i * BLOCKDEV_BLOCK_SIZE], bios[i].lba))
+			return "scattering merged read";
+	if (ram[30 * BLOCKDEV_BLOCK_SIZE] != 0xAB)
+		return "writing request";
+
+	bio_get_stats(&queue, &stats);
+	if (stats.submitted != 6 || stats.reads != 2 || stats.writes != 1 ||
+			stats.merged != 3 || stats.expired != 0)
+		return "counting requests";
+
+	/* reads and writes are not merged, commands are capped in size */
+	num_done = 0;
+	submit(&queue, 0, 50, BIO_READ);
+	submit(&queue, 1, 51, BIO_WRITE);
+	bio_run(&queue);
+	for (i=0; i<NUM_BIOS; i++)
+		submit(&queue, i, 100 + i, BIO_READ);
+	blockdev_get_stats(&ramdev, &before);
+	bio_run(&queue);
+	blockdev_get_stats(&ramdev, &after);
+	if (after.reads - before.reads != NUM_BIOS / BIO_MAX_BLOCKS ||
+			after.blocks_read - before.blocks_read != NUM_BIOS)
+		return "splitting long run of requests";
+	bio_get_stats(&queue, &stats);
+	if (stats.reads != 5 || stats.writes != 2)
+		return "merging reads with writes";
+
+	/* failures reach every request of the command */
+	num_done = 0;
+	submit(&queue, 0, RAM_BLOCKS - 2, BIO_READ);
+	submit(&queue, 1, RAM_BLOCKS - 1, BIO_READ);
+	bios[2] = bios[1];
+	bios[2].lba = RAM_BLOCKS;
+	bio_submit(&queue, &bios[2]);
+	if (bio_wait(&queue, &bios[1]) != -EINVAL || num_done != 3 ||
+			done_status[0] != -EINVAL || done_status[2] != -EINVAL)
+		return "failing merged request";
+
+	/* a request far from the head is not passed over forever */
+	num_done = 0;
+	submit(&queue, 0, 499, BIO_READ);
+	bio_run(&queue);
+	submit(&queue, 1, 1, BIO_READ);
+	for (i=0; i<2*BIO_DEADLINE && bios[1].pending; i++) {
+		submit(&queue, 2 + i, 500 + 2*i, BIO_READ);
+		bio_dispatch(&queue);
+	}
+	bio_run(&queue);
+	bio_get_stats(&queue, &stats);
+	if (i != BIO_DEADLINE + 1 || stats.expired != 1)
+		return "serving starved request";
+
+	/* on a slow device the merged command costs one request */
+	if (imagedev_open(&image, getenv(IMAGEDEV_ENV), &latency) != 0)
+		return "opening disk image";
+	bio_queue_init(&queue, &image);
+	for (i=0; i<16; i++)
+		blockdev_read(&image, 2048 + i, 1, &direct[i * BLOCKDEV_BLOCK_SIZE]);
+
+	/* buffers that follow each other are read in place */
+	blockdev_get_stats(&image, &before);
+	for (i=15; i>=0; i--) {
+		submit(&queue, i, 2048 + i, BIO_READ);
+		bios[i].done = NULL;
+	}
+	bio_run(&queue);
+	blockdev_get_stats(&image, &after);
+	bio_get_stats(&queue, &stats);
+	for (i=0; i<16 * BLOCKDEV_BLOCK_SIZE; i++)
+		if (buf[i] != direct[i])
+			return "reading merged request from image";
+	if (after.reads - before.reads != 1 ||
+			after.blocks_read - before.blocks_read != 16 ||
+			stats.reads != 1 || stats.merged != 15)
+		return "merging requests to slow device";
+	imagedev_close(&image);
+
+	return NULL;
+}
@@ -0,0 +1,133 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * test/blockdev.c
+ *
+ * Tests for the block device layer and its backends
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	March 14 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <blockdev.h>
+#include <errno.h>
+#include <filesystem.h>
+#include <ramdisk.h>
+#include <string.h>
+
+#include "imagedev.h"
+#include "test.h"
+
+/*
+ * Private function prototypes to include in tests
+ */
+int fs_lookup(const char *name, struct dirent_t *ret);
+
+const char *test_name = "BLOCKDEV";
+
+#define RAM_BLOCKS 64
+
+static unsigned char ram[RAM_BLOCKS * BLOCKDEV_BLOCK_SIZE];
+static unsigned char buf[4 * BLOCKDEV_BLOCK_SIZE];
+
+static long now_us()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+const char *run_test()
+{
+	int i;
+	long start;
+	unsigned char *disk;
+	struct blockdev_t ramdev, image, disk_dev;
+	struct blockdev_stats_t stats, before;
+	struct imagedev_latency_t latency = { 10000, 0 };
+	struct dirent_t dirent;
+	const char *path = getenv(IMAGEDEV_ENV);
+
+	/* RAM disk */
+	ramdisk_init(&ramdev, ram, RAM_BLOCKS);
+	for (i=0; i<sizeof(buf); i++)
+		buf[i] = IMAGE_PATTERN(i);
+	if (blockdev_write(&ramdev, 10, 4, buf) != 0)
+		return "writing to RAM disk";
+	memset(buf, 0, sizeof(buf));
+	if (blockdev_read(&ramdev, 10, 4, buf) != 0)
+		return "reading from RAM disk";
+	for (i=0; i<sizeof(buf); i++)
+		if (buf[i] != IMAGE_PATTERN(i))
+			return "reading back from RAM disk";
+
+	if (blockdev_discard(&ramdev, 11, 2) != 0 ||
+			blockdev_read(&ramdev, 10, 4, buf) != 0)
+		return "discarding blocks on RAM disk";
+	for (i=0; i<sizeof(buf); i++)
+		if (buf[i] != (i < 512 || i >= 1536 ? IMAGE_PATTERN(i) : 0))
+			return "reading discarded blocks from RAM disk";
+
+	if (blockdev_read(&ramdev, RAM_BLOCKS - 1, 2, buf) != -EINVAL ||
+			blockdev_write(&ramdev, RAM_BLOCKS, 1, buf) != -EINVAL)
+		return "accessing past end of RAM disk";
+
+	blockdev_get_stats(&ramdev, &stats);
+	if (stats.reads != 2 || stats.blocks_read != 8 || stats.writes != 1 ||
+			stats.blocks_written != 4 || stats.discards != 1)
+		return "counting RAM disk requests";
+
+	/* image file */
+	if (path == NULL || imagedev_open(&image, path, NULL) != 0)
+		return "opening image";
+	if (blockdev_read(&image, 0, 1, buf) != 0 || buf[510] != 0x55 || buf[511] != 0xAA)
+		return "reading MBR from image";
+	if (image.num_blocks == 0 || blockdev_read(&image, image.num_blocks, 1, buf) != -EINVAL)
+		return "checking size of image";
+	imagedev_close(&image);
+
+	/* latency is charged per request */
+	imagedev_open(&image, path, &latency);
+	start = now_us();
+	for (i=0; i<4; i++)
+		blockdev_read(&image, i, 1, buf);
+	if (now_us() - start < 4 * latency.request_us)
+		return "adding latency to requests";
+	blockdev_get_stats(&image, &before);
+	start = now_us();
+	blockdev_read(&image, 0, 4, buf);
+	blockdev_get_stats(&image, &stats);
+	if (now_us() - start < latency.request_us || stats.reads - before.reads != 1 ||
+			stats.blocks_read - before.blocks_read != 4)
+		return "adding latency to blocks of a request";
+
+	/* the filesystem runs on whatever device it is given */
+	disk = malloc(image.num_blocks * BLOCKDEV_BLOCK_SIZE);
+	if (disk == NULL || blockdev_read(&image, 0, image.num_blocks, disk) != 0)
+		return "loading image into memory";
+	ramdisk_init(&disk_dev, disk, image.num_blocks);
+	imagedev_close(&image);
+
+	fs_init(&disk_dev, 0);
+	if (fs_read("/FS_TEST.TXT", buf, 0, sizeof(buf)) <= 0 ||
+			strncmp((char *)buf, "'Twas brillig", 13))
+		return "reading file from RAM disk";
+	if (fs_lookup("/deep/d0/d1", &dirent) != 0 ||
+			!(dirent.attributes & FS_ATTR_DIRECTORY))
+		return "looking up path on RAM disk";
+
+	blockdev_get_stats(&disk_dev, &stats);
+	if (stats.reads == 0)
+		return "counting requests to RAM disk";
+	free(disk);
+
+	return NULL;
+}
@@ -0,0 +1,105 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * test/dcache.c
+ *
+ * Tests for the directory entry cache
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	February 14 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#include <dcache.h>
+#include <string.h>
+
+const char *test_name = "DCACHE";
+
+/*
+ * Make a dirent with a recognisable cluster number
+ */
+static struct dirent_t *make_dirent(struct dirent_t *dirent, unsigned cluster)
+{
+	memset(dirent, 0, sizeof(struct dirent_t));
+	strncpy(dirent->short_name, "NAME    TXT", 12);
+	strncpy(dirent->long_name, "a long name.txt", FS_MAX_NAME);
+	dirent->cluster = cluster;
+	dirent->size = cluster * 10;
+	return dirent;
+}
+
+const char *run_test()
+{
+	int i;
+	char name[16];
+	struct dirent_t dirent, found;
+	struct dcache_stats_t stats;
+
+	dcache_init();
+
+	/* empty cache */
+	if (dcache_lookup(2, "FILE.TXT", &found) != DCACHE_MISS)
+		return "looking up name in empty cache";
+
+	/* positive entries keep both names */
+	dcache_insert(2, "file.txt", make_dirent(&dirent, 100));
+	if (dcache_lookup(2, "file.txt", &found) != DCACHE_HIT ||
+			found.cluster != 100 || found.size != 1000 ||
+			strcmp(found.short_name, "NAME    TXT") ||
+			strcmp(found.long_name, "a long name.txt"))
+		return "looking up cached name";
+
+	/* names are case insensitive */
+	if (dcache_lookup(2, "FiLe.TxT", &found) != DCACHE_HIT || found.cluster != 100)
+		return "looking up cached name in different case";
+
+	/* the parent directory is part of the key */
+	if (dcache_lookup(3, "file.txt", &found) != DCACHE_MISS)
+		return "looking up cached name in different directory";
+
+	/* negative entries */
+	dcache_insert(2, "missing.txt", NULL);
+	if (dcache_lookup(2, "MISSING.TXT", &found) != DCACHE_NEGATIVE)
+		return "looking up negative entry";
+
+	/* re-inserting replaces the entry */
+	dcache_insert(2, "missing.txt", make_dirent(&dirent, 200));
+	if (dcache_lookup(2, "missing.txt", &found) != DCACHE_HIT || found.cluster != 200)
+		return "replacing negative entry";
+
+	/* invalidation */
+	dcache_invalidate(2, "FILE.txt");
+	if (dcache_lookup(2, "file.txt", &found) != DCACHE_MISS)
+		return "looking up invalidated name";
+
+	dcache_get_stats(&stats);
+	if (stats.hits != 3 || stats.neg_hits != 1 || stats.misses != 3 ||
+			stats.evictions != 0)
+		return "counting hits and misses";
+
+	/* fill the cache while keeping one name hot */
+	dcache_insert(2, "hot", make_dirent(&dirent, 1));
+	for (i=0; i<2*DCACHE_SIZE; i++) {
+		name[0] = 'a' + i / 26;
+		name[1] = 'a' + i % 26;
+		name[2] = '\0';
+		dcache_insert(7, name, make_dirent(&dirent, i + 1000));
+		if (dcache_lookup(2, "hot", &found) != DCACHE_HIT)
+			return "evicting recently used entry";
+	}
+
+	/* the oldest names were evicted, the newest survive */
+	if (dcache_lookup(7, "aa", &found) != DCACHE_MISS)
+		return "keeping least recently used entry";
+	if (dcache_lookup(7, name, &found) != DCACHE_HIT || found.cluster != i + 999)
+		return "evicting most recently inserted entry";
+
+	dcache_get_stats(&stats);
+	if (stats.evictions != 2*DCACHE_SIZE - (DCACHE_SIZE - 2))
+		return "counting evictions";
+
+	return NULL;
+}
@@ -0,0 +1,266 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * test/dma_sim.c
+ *
+ * Simulator of the DMA controller
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	April 25 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * Built with -DDMA_SIM, src/dma.c drives these registers instead of the
+ * hardware. The engine runs whenever a register is read and while the CPU
+ * sleeps in irq_wait(). It works through a channel's control blocks a
+ * word at a time, and stops whenever the peripheral pacing the transfer
+ * drops its DREQ. The EMMC simulator gives DREQ while its buffer is ready.
+ *
+ * Host pointers do not fit in a 32 bit bus address, so dma_bus_addr()
+ * hands out a made up bus address for each pointer and the engine looks
+ * it up again when it loads a control block.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#include <string.h>
+
+#include "dma_sim.h"
+#include "dummy_irq.h"
+#include "emmc_sim.h"
+
+/* CS fields */
+#define CS_ACTIVE	0x1
+#define CS_END		0x2
+#define CS_INT		0x4
+#define CS_DREQ		0x8
+#define CS_ERROR	0x100
+#define CS_RESET	0x80000000
+
+#define BUS_ADDRS	1024
+#define BUS_STEP	0x1000
+
+struct dma_sim_chan_t dma_sim_chan[DMA_CHANNELS];
+uint32_t dma_sim_enable;
+
+static struct dma_sim_stats_t stats;
+
+/* bus addresses handed out, address i is (i + 1) * BUS_STEP */
+static const volatile void *bus_addrs[BUS_ADDRS];
+static unsigned next_bus_addr;
+
+/*
+ * Where each channel is in its control block
+ */
+static volatile uint8_t *src[DMA_CHANNELS];
+static volatile uint8_t *dest[DMA_CHANNELS];
+
+#define REG(ch, field) (&dma_sim_chan[ch].reg.field)
+
+/*
+ * Look up the pointer behind a bus address
+ */
+static volatile uint8_t *sim_pointer(uint32_t bus)
+{
+	unsigned i = bus / BUS_STEP - 1;
+
+	if (bus % BUS_STEP != 0 || i >= BUS_ADDRS || !bus_addrs[i]) {
+		++stats.bad_addresses;
+		return NULL;
+	}
+	return (volatile uint8_t *)bus_addrs[i];
+}
+
+/*
+ * Load the control block at CONBLK_AD into a channel
+ */
+static int sim_load(int ch)
+{
+	struct dma_cb_t *cb;
+
+	cb = (struct dma_cb_t *)sim_pointer(*REG(ch, conblk_ad));
+	if (!cb)
+		return -1;
+
+	++stats.control_blocks;
+	*REG(ch, ti) = cb->ti;
+	*REG(ch, source_ad) = cb->source_ad;
+	*REG(ch, dest_ad) = cb->dest_ad;
+	*REG(ch, txfr_len) = cb->txfr_len;
+	*REG(ch, stride) = cb->stride;
+	*REG(ch, nextconbk) = cb->nextconbk;
+	src[ch] = sim_pointer(cb->source_ad);
+	dest[ch] = sim_pointer(cb->dest_ad);
+
+	return src[ch] && dest[ch] ? 0 : -1;
+}
+
+/*
+ * Return true if the peripheral pacing a transfer is ready for a word
+ */
+static int sim_dreq(uint32_t ti)
+{
+	int permap = (ti >> 16) & 0x1F;
+
+	if (!(ti & (DMA_TI_SRC_DREQ | DMA_TI_DEST_DREQ)))
+		return 1;
+	if (permap == DMA_DREQ_EMMC)
+		return emmc_sim_dreq((ti & DMA_TI_DEST_DREQ) != 0);
+	return 0;
+}
+
+/*
+ * Read a word, through the EMMC simulator if it is its DATA register
+ */
+static uint32_t sim_load_word(volatile uint8_t *p)
+{
+	uint32_t val;
+
+	if (p == (volatile uint8_t *)&emmc_sim_reg.data)
+		return emmc_sim_dma_read();
+	memcpy(&val, (uint8_t *)p, 4);
+	return val;
+}
+
+/*
+ * Write a word, through the EMMC simulator if it is its DATA register
+ */
+static void sim_store_word(volatile uint8_t *p, uint32_t val)
+{
+	if (p == (volatile uint8_t *)&emmc_sim_reg.data)
+		emmc_sim_dma_write(val);
+	else
+		memcpy((uint8_t *)p, &val, 4);
+}
+
+/*
+ * Move words on a channel until it finishes or has to wait for DREQ
+ */
+static void sim_run_channel(int ch)
+{
+	uint32_t ti, val;
+
+	while (*REG(ch, cs) & CS_ACTIVE) {
+		ti = *REG(ch, ti);
+
+		/* on to the next block, or stop after the last */
+		if (*REG(ch, txfr_len) == 0) {
+			if (*REG(ch, nextconbk) == 0) {
+				*REG(ch, cs) &= ~CS_ACTIVE;
+				*REG(ch, cs) |= CS_END | (ti & DMA_TI_INTEN ? CS_INT : 0);
+				return;
+			}
+			*REG(ch, conblk_ad) = *REG(ch, nextconbk);
+			if (sim_load(ch) < 0) {
+				*REG(ch, cs) &= ~CS_ACTIVE;
+				*REG(ch, cs) |= CS_ERROR;
+				return;
+			}
+			continue;
+		}
+
+		if (!sim_dreq(ti)) {
+			++stats.dreq_stalls;
+			return;
+		}
+
+		val = sim_load_word(src[ch]);
+		sim_store_word(dest[ch], val);
+		++stats.words;
+		if (ti & DMA_TI_SRC_INC)
+			src[ch] += 4;
+		if (ti & DMA_TI_DEST_INC)
+			dest[ch] += 4;
+		*REG(ch, txfr_len) -= 4;
+	}
+}
+
+/*
+ * Run every enabled channel
+ */
+void dma_sim_run()
+{
+	int ch;
+
+	for (ch=0; ch<DMA_CHANNELS; ch++)
+		if (dma_sim_enable & (1 << ch))
+			sim_run_channel(ch);
+}
+
+/*
+ * Start with every channel off and no bus addresses handed out
+ */
+void dma_sim_init()
+{
+	memset(dma_sim_chan, 0, sizeof(dma_sim_chan));
+	memset(&stats, 0, sizeof(stats));
+	memset(bus_addrs, 0, sizeof(bus_addrs));
+	dma_sim_enable = 0;
+	next_bus_addr = 0;
+	dummy_irq_add_device(dma_sim_run);
+}
+
+/*
+ * Hand out a bus address for a host pointer
+ */
+uint32_t dma_sim_bus_addr(const volatile void *addr)
+{
+	unsigned i;
+
+	for (i=0; i<BUS_ADDRS; i++)
+		if (bus_addrs[i] == addr)
+			return (i + 1) * BUS_STEP;
+
+	i = next_bus_addr++ % BUS_ADDRS;
+	bus_addrs[i] = addr;
+	return (i + 1) * BUS_STEP;
+}
+
+/*
+ * Read a register of the simulated controller
+ */
+uint32_t dma_sim_read(volatile uint32_t *reg)
+{
+	dma_sim_run();
+	return *reg;
+}
+
+/*
+ * Write a register of the simulated controller
+ */
+void dma_sim_write(volatile uint32_t *reg, uint32_t val)
+{
+	int ch;
+
+	for (ch=0; ch<DMA_CHANNELS; ch++)
+		if (reg == REG(ch, cs))
+			break;
+
+	if (ch == DMA_CHANNELS) {
+		*reg = val;
+		return;
+	}
+
+	if (val & CS_RESET) {
+		memset(&dma_sim_chan[ch].reg, 0, sizeof(dma_reg_t));
+		return;
+	}
+
+	/* END and INT are cleared by writing 1 */
+	*reg &= ~(val & (CS_END | CS_INT));
+	if ((val & CS_ACTIVE) && !(*reg & CS_ACTIVE)) {
+		++stats.chains;
+		*reg |= sim_load(ch) == 0 ? CS_ACTIVE : CS_ERROR;
+		dma_sim_run();
+	}
+}
+
+/*
+ * Copy out what the engine did
+ */
+void dma_sim_get_stats(struct dma_sim_stats_t *ret)
+{
+	memcpy(ret, &stats, sizeof(struct dma_sim_stats_t));
+}
@@ -0,0 +1,53 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * test/dma_sim.h
+ *
+ * Simulator of the DMA controller
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	April 25 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#ifndef DMA_SIM_H
+#define DMA_SIM_H
+
+#include <dma.h>
+#include <platform.h>
+#include <types.h>
+
+/* a channel's registers and the gap up to the next */
+struct __attribute__((packed)) dma_sim_chan_t {
+	dma_reg_t reg;
+	uint8_t PAD[DMA_CHAN_SIZE - sizeof(dma_reg_t)];
+};
+
+/*
+ * What the engine did
+ */
+struct dma_sim_stats_t {
+	unsigned chains;	/* chains started */
+	unsigned control_blocks;	/* control blocks loaded */
+	unsigned words;		/* words moved */
+	unsigned dreq_stalls;	/* times a channel waited for DREQ */
+	unsigned bad_addresses;	/* bus addresses that were never handed out */
+};
+
+extern struct dma_sim_chan_t dma_sim_chan[DMA_CHANNELS];
+extern uint32_t dma_sim_enable;
+
+#define dma_sim_reg (&dma_sim_chan[0].reg)
+
+/* Function prototypes */
+void dma_sim_init();
+uint32_t dma_sim_bus_addr(const volatile void *addr);
+uint32_t dma_sim_read(volatile uint32_t *reg);
+void dma_sim_write(volatile uint32_t *reg, uint32_t val);
+void dma_sim_run();
+void dma_sim_get_stats(struct dma_sim_stats_t *stats);
+
+#endif /* DMA_SIM_H */
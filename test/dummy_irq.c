@@ -0,0 +1,134 @@
+#include <unistd.h>
+
+#include "dummy_irq.h"
+
+#define MAX_DEVICES 4
+
+extern unsigned dummy_timer_alarm;
+extern int dummy_timer_alarm_set;
+unsigned timer_read();
+
+static irq_service_routine_t routines[96];
+static int enabled[96];
+static int raised[96];
+static int masked;
+
+static dummy_irq_device_t devices[MAX_DEVICES];
+static int num_devices;
+
+static unsigned slept;		/* us spent in irq_wait() */
+
+void irq_init()
+{
+}
+
+void irq_register_service_routine(irq_service_routine_t isr, int pos)
+{
+	routines[pos] = isr;
+}
+
+void irq_enable(int pos)
+{
+	enabled[pos] = 1;
+}
+
+void irq_disable(int pos)
+{
+	enabled[pos] = 0;
+}
+
+int dummy_irq_enabled(int pos)
+{
+	return enabled[pos];
+}
+
+/* run the service routines of raised interrupts while IRQs are unmasked */
+static void deliver()
+{
+	int pos;
+
+	for (pos=0; pos<96 && !masked; pos++) {
+		if (!raised[pos] || !enabled[pos])
+			continue;
+		raised[pos] = 0;
+		masked = 1;
+		if (routines[pos])
+			routines[pos]();
+		masked = 0;
+	}
+}
+
+static int pending()
+{
+	int pos;
+
+	for (pos=0; pos<96; pos++)
+		if (raised[pos] && enabled[pos])
+			return 1;
+	return 0;
+}
+
+/* a device asserts its interrupt line */
+void dummy_irq_raise(int pos)
+{
+	raised[pos] = 1;
+	deliver();
+}
+
+unsigned irq_save()
+{
+	unsigned state = masked;
+
+	masked = 1;
+	return state;
+}
+
+void irq_restore(unsigned state)
+{
+	masked = state;
+	deliver();
+}
+
+/* give the simulated devices a chance to move on */
+void dummy_irq_run_devices()
+{
+	int i;
+
+	for (i=0; i<num_devices; i++)
+		devices[i]();
+}
+
+/* let the devices run until one of them interrupts or the alarm goes off */
+void irq_wait()
+{
+	unsigned start = timer_read();
+
+	for (;;) {
+		dummy_irq_run_devices();
+		if (pending())
+			break;
+		if (dummy_timer_alarm_set && (int)(timer_read() - dummy_timer_alarm) >= 0) {
+			dummy_timer_alarm_set = 0;
+			break;
+		}
+		usleep(1);
+	}
+
+	slept += timer_read() - start;
+}
+
+/* time the CPU would have been free to do something else */
+unsigned dummy_irq_slept()
+{
+	return slept;
+}
+
+void dummy_irq_add_device(dummy_irq_device_t device)
+{
+	int i;
+
+	for (i=0; i<num_devices; i++)
+		if (devices[i] == device)
+			return;
+	devices[num_devices++] = device;
+}
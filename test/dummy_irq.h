@@ -0,0 +1,30 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * test/dummy_irq.h
+ *
+ * Interrupt controller for simulated devices on the host
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	April 18 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#ifndef DUMMY_IRQ_H
+#define DUMMY_IRQ_H
+
+#include <irq.h>
+
+/* a simulated device, run while the CPU sleeps in irq_wait() */
+typedef void (*dummy_irq_device_t)(void);
+
+void dummy_irq_add_device(dummy_irq_device_t device);
+void dummy_irq_run_devices();
+void dummy_irq_raise(int pos);
+int dummy_irq_enabled(int pos);
+unsigned dummy_irq_slept();
+
+#endif /* DUMMY_IRQ_H */
@@ -0,0 +1,30 @@
+#include <sys/time.h>
+#include <unistd.h>
+
+/* the system timer counts microseconds */
+unsigned timer_read()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void timer_wait(unsigned ticks)
+{
+	usleep(ticks);
+}
+
+/* the dummy interrupt controller stops sleeping at the alarm */
+unsigned dummy_timer_alarm;
+int dummy_timer_alarm_set;
+
+void timer_set_alarm(unsigned ticks)
+{
+	dummy_timer_alarm = ticks;
+	dummy_timer_alarm_set = 1;
+}
+
+void timer_init()
+{
+}
@@ -0,0 +1,321 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * test/emmc.c
+ *
+ * Tests for the EMMC driver on the simulated host
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	April 11 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#include <stdlib.h>
+
+#include <blockdev.h>
+#include <emmc.h>
+#include <errno.h>
+#include <string.h>
+
+#include "dma_sim.h"
+#include "dummy_irq.h"
+#include "emmc_sim.h"
+#include "mailbox_sim.h"
+#include "test.h"
+
+const char *test_name = "EMMC";
+
+#define CARD_BLOCKS 1024
+
+static unsigned char card[CARD_BLOCKS * 512];
+static unsigned char buf[128 * 512];
+
+static unsigned idle_calls;
+
+static const struct emmc_sim_latency_t slow = { 50, 50, 0 };
+static const struct emmc_sim_latency_t slower = { 200, 200, 0 };
+static const struct emmc_sim_latency_t bus_time = { 0, 0, 1 };
+
+/*
+ * Work done while the driver waits, the card carries on meanwhile
+ */
+static void idle_work()
+{
+	++idle_calls;
+	dummy_irq_run_devices();
+}
+
+/*
+ * Return the bus time in us to read count blocks from lba
+ */
+static unsigned time_read(unsigned lba, unsigned count)
+{
+	struct emmc_sim_stats_t before, after;
+
+	emmc_sim_get_stats(&before);
+	if (emmc_read_blocks(lba, count, buf) != 0)
+		return 0;
+	emmc_sim_get_stats(&after);
+	return after.bus_us - before.bus_us;
+}
+
+/*
+ * Return true if a buffer holds count blocks of the card from lba
+ */
+static int same_as_card(const unsigned char *data, unsigned lba, unsigned count)
+{
+	unsigned i;
+
+	for (i=0; i<count*512; i++)
+		if (data[i] != card[lba * 512 + i])
+			return 0;
+	return 1;
+}
+
+const char *run_test()
+{
+	unsigned i, fast_us, slow_us;
+	struct emmc_sim_stats_t before, after;
+	struct emmc_stats_t start, end;
+	struct dma_sim_stats_t dma_before, dma_after;
+	struct mailbox_sim_stats_t mbox;
+	struct emmc_sg_t sg[5];
+
+	for (i=0; i<sizeof(card); i++)
+		card[i] = IMAGE_PATTERN(i);
+	emmc_sim_init(card, CARD_BLOCKS);
+	dma_sim_init();
+	mailbox_sim_init();
+
+	if (emmc_init() != 0)
+		return "initializing card";
+	mailbox_sim_get_stats(&mbox);
+	if (mbox.transactions != 1)
+		return "asking for the clock in one message";
+	if ((emmc_sim_reg.ctrl_0 & 0x6) != 0x6)
+		return "switching to 4 bit bus in high speed mode";
+	emmc_sim_get_stats(&after);
+	if (after.illegal_commands != 0)
+		return "sending commands in card state";
+
+	/* 250 MHz divides down to 41.7 MHz, the fastest under 50 MHz */
+	emmc_get_stats(&start);
+	if (start.clock_target_hz != 50000000 ||
+			start.clock_hz != EMMC_SIM_CLOCK / 6)
+		return "dividing clock";
+
+	/* a single block is a single block command */
+	emmc_sim_get_stats(&before);
+	if (emmc_read_block(5, buf) != 0 || !same_as_card(buf, 5, 1))
+		return "reading single block";
+	emmc_sim_get_stats(&after);
+	if (after.cmd[17] - before.cmd[17] != 1 || after.commands - before.commands != 1)
+		return "reading single block with READ_SINGLE_BLOCK";
+
+	/* a run of blocks is one command, stopped by the host */
+	emmc_sim_get_stats(&before);
+	if (emmc_read_blocks(100, 64, buf) != 0 || !same_as_card(buf, 100, 64))
+		return "reading blocks";
+	emmc_sim_get_stats(&after);
+	if (after.commands - before.commands != 1 || after.cmd[18] - before.cmd[18] != 1 ||
+			after.auto_cmd12 - before.auto_cmd12 != 1 ||
+			after.blocks_read - before.blocks_read != 64)
+		return "reading blocks with READ_MULTIPLE_BLOCK";
+
+	/* and the same for writes */
+	for (i=0; i<8*512; i++)
+		buf[i] = i * 3;
+	emmc_sim_get_stats(&before);
+	if (emmc_write_blocks(200, 8, buf) != 0 || !same_as_card(buf, 200, 8))
+		return "writing blocks";
+	emmc_sim_get_stats(&after);
+	if (after.commands - before.commands != 1 || after.cmd[25] - before.cmd[25] != 1 ||
+			after.auto_cmd12 - before.auto_cmd12 != 1 ||
+			after.blocks_written - before.blocks_written != 8)
+		return "writing blocks with WRITE_MULTIPLE_BLOCK";
+	if (card[199 * 512] != IMAGE_PATTERN(199 * 512) ||
+			card[208 * 512] != IMAGE_PATTERN(208 * 512))
+		return "writing outside of blocks";
+	if (emmc_write_block(300, buf) != 0 || !same_as_card(buf, 300, 1))
+		return "writing single block";
+
+	/* the block device takes a request in one command */
+	emmc_sim_get_stats(&before);
+	if (blockdev_read(&emmc_dev, 500, 128, buf) != 0 || !same_as_card(buf, 500, 128))
+		return "reading through block device";
+	emmc_sim_get_stats(&after);
+	if (after.commands - before.commands != 1)
+		return "reading through block device with one command";
+
+	/* a failed transfer leaves the host ready for the next */
+	if (emmc_read_blocks(CARD_BLOCKS - 2, 4, buf) == 0)
+		return "reading past end of card";
+	if (emmc_read_blocks(CARD_BLOCKS, 2, buf) == 0)
+		return "starting read past end of card";
+	if (blockdev_read(&emmc_dev, 10, 2, buf) != 0 || !same_as_card(buf, 10, 2))
+		return "reading after failed transfer";
+
+	/* a command that takes 50 us is not charged a millisecond of polling:
+	 * every wait ends at the interrupt that finishes it */
+	emmc_sim_set_latency(&slow);
+	emmc_sim_get_stats(&before);
+	emmc_get_stats(&start);
+	for (i=0; i<16; i++)
+		if (emmc_read_block(i, buf) != 0 || !same_as_card(buf, i, 1))
+			return "reading with command latency";
+	emmc_sim_get_stats(&after);
+	emmc_get_stats(&end);
+	if (end.commands - start.commands != 16 || end.blocks - start.blocks != 16)
+		return "counting commands and blocks";
+	if ((end.command_us - start.command_us) / 16 < 50)
+		return "measuring command latency";
+	if (end.irqs - start.irqs < 16 || end.sleeps - start.sleeps > end.irqs - start.irqs ||
+			after.int_reads - before.int_reads > end.irqs - start.irqs)
+		return "polling for command done";
+	if (end.timeouts != start.timeouts)
+		return "timing out";
+
+	/* the driver sleeps until the host interrupts instead of polling */
+	if (!dummy_irq_enabled(IRQ_EMMC))
+		return "enabling interrupt";
+	emmc_sim_set_latency(&slower);
+	emmc_sim_get_stats(&before);
+	emmc_get_stats(&start);
+	for (i=0; i<16; i++)
+		if (emmc_read_block(i, buf) != 0 || !same_as_card(buf, i, 1))
+			return "reading by interrupt";
+	emmc_sim_get_stats(&after);
+	emmc_get_stats(&end);
+	if (end.irqs == start.irqs || end.sleeps - start.sleeps < 16)
+		return "sleeping until interrupt";
+	if (after.int_reads - before.int_reads > end.irqs - start.irqs)
+		return "polling INTERRUPT register";
+
+	/* or gets on with other work */
+	emmc_set_idle(idle_work);
+	emmc_get_stats(&start);
+	if (emmc_read_blocks(20, 16, buf) != 0 || !same_as_card(buf, 20, 16))
+		return "reading with idle work";
+	emmc_get_stats(&end);
+	if (idle_calls == 0 || end.sleeps != start.sleeps)
+		return "running idle work";
+	emmc_set_idle(NULL);
+
+	/* DMA waits for DREQ while the card is slow to answer */
+	dma_sim_get_stats(&dma_before);
+	if (emmc_read_blocks(40, 16, buf) != 0 || !same_as_card(buf, 40, 16))
+		return "reading by DMA with latency";
+	dma_sim_get_stats(&dma_after);
+	if (dma_after.dreq_stalls == dma_before.dreq_stalls)
+		return "pacing DMA with DREQ";
+	emmc_sim_set_latency(NULL);
+
+	/* DMA moves the data, the CPU touches no DATA words */
+	emmc_sim_get_stats(&before);
+	emmc_get_stats(&start);
+	if (emmc_read_blocks(600, 64, buf) != 0 || !same_as_card(buf, 600, 64))
+		return "reading by DMA";
+	emmc_sim_get_stats(&after);
+	emmc_get_stats(&end);
+	if (after.cpu_words != before.cpu_words || end.dma_blocks - start.dma_blocks != 64)
+		return "moving data by DMA";
+
+	/* unless told not to */
+	emmc_set_dma(0);
+	emmc_sim_get_stats(&before);
+	if (emmc_read_blocks(600, 64, buf) != 0 || !same_as_card(buf, 600, 64))
+		return "reading without DMA";
+	emmc_sim_get_stats(&after);
+	if (after.cpu_words - before.cpu_words != 64 * 512 / 4)
+		return "moving data without DMA";
+	emmc_set_dma(1);
+
+	/* or the buffer is not word aligned */
+	emmc_sim_get_stats(&before);
+	if (emmc_read_blocks(700, 2, buf + 1) != 0 || !same_as_card(buf + 1, 700, 2))
+		return "reading to unaligned buffer";
+	emmc_sim_get_stats(&after);
+	if (after.cpu_words == before.cpu_words)
+		return "falling back without DMA";
+
+	/* a scatter-gather list is one command with a control block a piece */
+	sg[0].buf = buf;
+	sg[0].count = 4;
+	sg[1].buf = buf + 10 * 512;
+	sg[1].count = 0;
+	sg[2].buf = buf + 20 * 512;
+	sg[2].count = 8;
+	sg[3].buf = buf + 28 * 512;	/* follows sg[2] */
+	sg[3].count = 2;
+	sg[4].buf = buf + 40 * 512;
+	sg[4].count = 1;
+	emmc_sim_get_stats(&before);
+	dma_sim_get_stats(&dma_before);
+	if (emmc_read_sg(800, sg, 5) != 0 || !same_as_card(buf, 800, 4) ||
+			!same_as_card(buf + 20 * 512, 804, 10) ||
+			!same_as_card(buf + 40 * 512, 814, 1))
+		return "reading scatter-gather list";
+	emmc_sim_get_stats(&after);
+	dma_sim_get_stats(&dma_after);
+	if (after.commands - before.commands != 1 ||
+			dma_after.control_blocks - dma_before.control_blocks != 3)
+		return "chaining control blocks";
+	for (i=0; i<15*512; i++)
+		buf[20 * 512 + i] = i * 7;
+	if (emmc_write_sg(900, sg + 2, 3) != 0 || !same_as_card(buf + 20 * 512, 900, 10) ||
+			!same_as_card(buf + 40 * 512, 910, 1))
+		return "writing scatter-gather list";
+	if (dma_after.bad_addresses != 0)
+		return "giving DMA bus addresses";
+
+	/* with the bus timed, 4 bits at 41.7 MHz beats 1 bit at 25 MHz */
+	emmc_sim_set_latency(&bus_time);
+	fast_us = time_read(0, 64);
+
+	/* a card without high speed mode stays at default speed */
+	emmc_sim_set_caps(EMMC_SIM_4BIT);
+	if (emmc_init() != 0 || (emmc_sim_reg.ctrl_0 & 0x6) != 0x2)
+		return "initializing card without high speed mode";
+	emmc_get_stats(&start);
+	if (start.clock_hz != 25000000)
+		return "dividing clock exactly";
+	if (emmc_read_blocks(100, 8, buf) != 0 || !same_as_card(buf, 100, 8))
+		return "reading at default speed";
+
+	/* and one whose 4 bit bus does not work goes back to 1 bit */
+	emmc_sim_set_caps(EMMC_SIM_4BIT | EMMC_SIM_BAD_4BIT | EMMC_SIM_HS);
+	if (emmc_init() != 0 || (emmc_sim_reg.ctrl_0 & 0x6) != 0x4)
+		return "falling back to 1 bit bus";
+	if (emmc_read_blocks(100, 8, buf) != 0 || !same_as_card(buf, 100, 8))
+		return "reading on 1 bit bus";
+
+	/* as does an old card */
+	emmc_sim_set_caps(0);
+	if (emmc_init() != 0 || (emmc_sim_reg.ctrl_0 & 0x6) != 0)
+		return "initializing card with 1 bit bus";
+	if (emmc_read_blocks(100, 8, buf) != 0 || !same_as_card(buf, 100, 8))
+		return "reading on 1 bit bus at default speed";
+	slow_us = time_read(0, 64);
+	mailbox_sim_get_stats(&mbox);
+	if (mbox.transactions != 1)
+		return "asking for the clock once";
+	if (fast_us == 0 || slow_us < 4 * fast_us)
+		return "timing the bus";
+	emmc_sim_set_latency(NULL);
+
+	emmc_sim_get_stats(&after);
+	if (after.protocol_errors != 0)
+		return "driving host registers";
+
+	/* the card can hold an image file */
+	if (emmc_sim_open(getenv("FS_IMAGE")) != 0 || emmc_init() != 0)
+		return "opening image";
+	if (blockdev_read(&emmc_dev, 0, 1, buf) != 0 || buf[510] != 0x55 ||
+			buf[511] != 0xAA)
+		return "reading image";
+
+	return NULL;
+}
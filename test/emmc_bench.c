@@ -0,0 +1,210 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * test/emmc_bench.c
+ *
+ * EMMC driver benchmarks
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	April 25 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * Runs the driver against the simulated host and DMA controller (see the
+ * emmc-bench target in the Makefile) and prints one CSV row per
+ * measurement:
+ *
+ *	read	reading BENCH_BYTES in requests of param blocks
+ *	write	writing them back
+ *	fs_read	mounting the image given on the command line and reading
+ *		its files through the filesystem
+ *
+ * The read and write rows are taken once with each block costing
+ * BLOCK_LATENCY us (bus "fixed"), moving the data with the CPU (pio) and
+ * with the DMA engine (dma), and again by DMA with the simulator timing
+ * the bus, for a card on a 1 bit bus at default speed ("1bit") and one on
+ * a 4 bit bus in high speed mode ("4bit_hs"). Most of the wall clock time
+ * is spent asleep in irq_wait(). Every row carries the wall clock and CPU
+ * time per MB, where CPU time is the wall clock time less the time slept,
+ * the DATA register words the CPU moved per MB and the throughput.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include <blockdev.h>
+#include <emmc.h>
+#include <filesystem.h>
+#include <string.h>
+
+#include "dma_sim.h"
+#include "dummy_irq.h"
+#include "emmc_sim.h"
+#include "mailbox_sim.h"
+
+#define BLOCK_LATENCY 25	/* us for the card to ready a block */
+#define BENCH_BYTES (1 << 20)	/* bytes moved per row */
+#define CARD_BLOCKS (BENCH_BYTES / 512)
+#define BUS_BLOCKS 64		/* blocks per request with the bus timed */
+
+static const unsigned request_sizes[] = { 1, 8, 64, 256 };
+static const struct emmc_sim_latency_t fixed = { 0, BLOCK_LATENCY, 0 };
+static const struct emmc_sim_latency_t bus_time = { 0, 0, 1 };
+
+/* files in the test image, see FS_IMAGE_ARGS in the Makefile */
+static const char *files[] = {
+	"/big.dat", "/kernel.img", "/stream.dat", "/random.dat", "/bootcode.bin"
+};
+
+/*
+ * Card set up for a row
+ */
+struct bus_t {
+	const char *name;
+	unsigned caps;		/* EMMC_SIM_* */
+};
+
+static const struct bus_t buses[] = {
+	{ "1bit", 0 },
+	{ "4bit_hs", EMMC_SIM_4BIT | EMMC_SIM_HS },
+};
+
+static unsigned char card[CARD_BLOCKS * 512];
+static unsigned char buf[256 * 512];
+
+/*
+ * A measurement in progress
+ */
+struct sample_t {
+	double start;
+	unsigned slept;
+	struct emmc_sim_stats_t stats;
+};
+
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sample_start(struct sample_t *sample)
+{
+	emmc_sim_get_stats(&sample->stats);
+	sample->slept = dummy_irq_slept();
+	sample->start = now();
+}
+
+/*
+ * Print the row for requests of blocks blocks that moved bytes bytes
+ */
+static void sample_end(struct sample_t *sample, const char *bench,
+		const char *bus, const char *mode, unsigned blocks, double bytes)
+{
+	double secs = now() - sample->start;
+	double mb = bytes / (1 << 20);
+	double cpu = secs - (dummy_irq_slept() - sample->slept) / 1e6;
+	struct emmc_sim_stats_t stats;
+
+	emmc_sim_get_stats(&stats);
+	printf("%s,%s,%s,%u,%.0f,%.0f,%.0f,%.2f\n", bench, bus, mode, blocks,
+			secs * 1e6 / mb, cpu * 1e6 / mb,
+			(stats.cpu_words - sample->stats.cpu_words) / mb,
+			mb / secs);
+}
+
+static void bench_blocks(const char *bus, const char *mode, unsigned blocks)
+{
+	struct sample_t sample;
+	unsigned lba;
+
+	sample_start(&sample);
+	for (lba=0; lba<CARD_BLOCKS; lba+=blocks)
+		emmc_read_blocks(lba, blocks, buf);
+	sample_end(&sample, "read", bus, mode, blocks, BENCH_BYTES);
+
+	sample_start(&sample);
+	for (lba=0; lba<CARD_BLOCKS; lba+=blocks)
+		emmc_write_blocks(lba, blocks, buf);
+	sample_end(&sample, "write", bus, mode, blocks, BENCH_BYTES);
+}
+
+static void bench_fs(const char *bus)
+{
+	struct sample_t sample;
+	double bytes = 0;
+	unsigned i;
+	int fd, n;
+
+	sample_start(&sample);
+	fs_init(&emmc_dev, 0);
+	for (i=0; i<sizeof(files)/sizeof(files[0]); i++) {
+		if ((fd = fs_open(files[i])) < 0)
+			continue;
+		while ((n = fs_read_fd(fd, buf, sizeof(buf))) > 0)
+			bytes += n;
+		fs_close(fd);
+	}
+	sample_end(&sample, "fs_read", bus, "dma", 0, bytes);
+}
+
+/*
+ * Start a card with some of 4 bit bus and high speed mode
+ */
+static int start_card(unsigned caps)
+{
+	emmc_sim_set_caps(caps);
+	if (emmc_init() != 0) {
+		fprintf(stderr, "emmc-bench: initializing card failed\n");
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned i, b;
+	int dma;
+
+	emmc_sim_init(card, CARD_BLOCKS);
+	dma_sim_init();
+	mailbox_sim_init();
+
+	printf("bench,bus,mode,blocks,us_per_mb,cpu_us_per_mb,cpu_words_per_mb,mb_per_s\n");
+	if (start_card(EMMC_SIM_4BIT | EMMC_SIM_HS) < 0)
+		return 1;
+	emmc_sim_set_latency(&fixed);
+	for (dma=0; dma<2; dma++) {
+		emmc_set_dma(dma);
+		for (i=0; i<sizeof(request_sizes)/sizeof(request_sizes[0]); i++)
+			bench_blocks("fixed", dma ? "dma" : "pio", request_sizes[i]);
+	}
+
+	for (b=0; b<sizeof(buses)/sizeof(buses[0]); b++) {
+		if (start_card(buses[b].caps) < 0)
+			return 1;
+		emmc_sim_set_latency(&bus_time);
+		bench_blocks(buses[b].name, "dma", BUS_BLOCKS);
+	}
+
+	/* the filesystem on an image, on each bus */
+	if (argc < 2)
+		return 0;
+	if (emmc_sim_open(argv[1]) != 0) {
+		fprintf(stderr, "emmc-bench: cannot open %s\n", argv[1]);
+		return 1;
+	}
+	for (b=0; b<sizeof(buses)/sizeof(buses[0]); b++) {
+		if (start_card(buses[b].caps) < 0)
+			return 1;
+		emmc_sim_set_latency(&bus_time);
+		bench_fs(buses[b].name);
+	}
+
+	return 0;
+}
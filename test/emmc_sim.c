@@ -0,0 +1,793 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * test/emmc_sim.c
+ *
+ * Register level simulator of the EMMC host and an SD card
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	April 11 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * Built with -DEMMC_SIM, src/emmc.c reads and writes its registers through
+ * emmc_sim_read() and emmc_sim_write() instead of the hardware, so the
+ * driver can run on the host. Writing CMDTM carries out the command: the
+ * response registers are filled in and CMD_DONE is raised. A data command
+ * then moves blocks between the card's memory and the DATA register a
+ * word at a time, raising READ_RDY or WRITE_RDY for each block and
+ * DAT_DONE after the last, with the block counter and auto CMD12 behaving
+ * as the SDHCI specification says. The card's memory is a buffer handed
+ * to emmc_sim_init() or an image file mapped by emmc_sim_open().
+ *
+ * The card goes through the states of the SD specification:
+ *
+ *	idle -ACMD41-> ready -CMD2-> ident -CMD3-> stby -CMD7-> tran
+ *	tran -CMD17,18-> data -last block or CMD12-> tran
+ *	tran -CMD24,25-> rcv -last block or CMD12-> tran
+ *
+ * A command sent in a state it is not allowed in gets no answer, so the
+ * host times out on it, and it is counted in illegal_commands. R1
+ * responses carry the state the card was in.
+ *
+ * Commands and blocks take the time set by emmc_sim_set_latency(): a
+ * fixed time each, plus if asked the time to clock the bits over the bus
+ * at the SD clock and bus width the driver chose. The clock is worked out
+ * from the divider in CONTROL1 and EMMC_SIM_CLOCK, the base clock the
+ * mailbox in test/dummy_mailbox.c reports.
+ *
+ * Flags enabled in INT_EN are signalled to the interrupt controller in
+ * test/dummy_irq.c, which runs the driver's service routine as the real
+ * one would. While the driver sleeps in irq_wait() the simulator keeps
+ * running, so a command with latency completes by interrupt.
+ *
+ * The DMA controller simulator in test/dma_sim.c moves DATA words too,
+ * paced by emmc_sim_dreq(). Only the words the CPU moves itself are
+ * counted in cpu_words.
+ *
+ * The card has 4 data lines and high speed mode unless emmc_sim_set_caps()
+ * says otherwise. It answers SEND_SCR and SWITCH_FUNC with short blocks of
+ * data, and a transfer on a bus the card and host disagree about (width
+ * or high speed timing) fails with a data CRC error, as does one with the
+ * SD clock faster than the card's mode allows.
+ *
+ * Anything the real host would not let the driver do (touching DATA with
+ * no block ready, sending a command with the clock off) is counted as a
+ * protocol error for the tests to check.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <irq.h>
+#include <string.h>
+#include <timer.h>
+
+#include "dummy_irq.h"
+#include "emmc_sim.h"
+
+#define BLOCK_SIZE	512
+#define BLOCK_WORDS	(BLOCK_SIZE / 4)
+
+/* CMDTM fields */
+#define TM_BLKCNT	0x2
+#define TM_CMD12	0x4
+#define TM_MULTIBLK	0x20
+#define CMD_RESP	0x30000
+#define CMD_LONG	0x10000
+#define CMD_INDEX(cmd)	(((cmd) >> 24) & 0x3F)
+
+/* CONTROL0 fields */
+#define C0_HCTL_DWIDTH	0x2
+#define C0_HCTL_HS_EN	0x4
+
+/* CONTROL1 fields */
+#define CTRL_INTCLK_EN	0x1
+#define CTRL_STABLE	0x2
+#define CTRL_CLK_EN	0x4
+#define CTRL_CLK_DIV(r)	(((r) >> 8 & 0xFF) | ((r) & 0xC0) << 2)
+#define CTRL_RESET_ALL	0x1000000
+#define CTRL_RESET_CMD	0x2000000
+#define CTRL_RESET_DAT	0x4000000
+
+/* STATUS fields */
+#define ST_DAT_BUSY	0x2
+#define ST_DAT_ACTIVE	0x4
+#define ST_WRITE_RDY	0x100
+#define ST_READ_RDY	0x200
+#define ST_CARD_INS	0x10000
+
+/* INTERRUPT fields */
+#define INT_CMD_DONE	0x1
+#define INT_DAT_DONE	0x2
+#define INT_WR_READY	0x10
+#define INT_RD_READY	0x20
+#define INT_ERROR	0x8000
+#define INT_CTO_ERR	0x10000
+#define INT_DTO_ERR	0x100000
+#define INT_DCRC_ERR	0x200000
+
+/* card responses */
+#define OCR_VOLTAGE	0xFF8000
+#define OCR_CAPACITY	0x40000000
+#define OCR_BUSY	0x80000000
+#define R1_OUT_OF_RANGE	0x80000000
+#define R1_ILLEGAL	0x400000
+#define R1_STATE(s)	((s) << 9)
+#define R1_READY	0x100	/* ready for data */
+#define R1_APP_CMD	0x20
+#define SIM_RCA		0x4567
+#define CSD_TRAN_SPEED	0x32	/* 25 MHz */
+#define SCR_SIZE	8
+#define SWITCH_SIZE	64
+
+#define IDENT_MAX	400000		/* fastest clock in identification */
+#define DEFAULT_MAX	25000000	/* fastest clock at default speed */
+#define HS_MAX		50000000	/* fastest clock at high speed */
+#define CRC_BITS	16		/* CRC sent on each data line per block */
+
+/* card states */
+#define CARD_IDLE	0
+#define CARD_READY	1
+#define CARD_IDENT	2
+#define CARD_STBY	3
+#define CARD_TRAN	4
+#define CARD_DATA	5
+#define CARD_RCV	6
+#define IN(s)		(1 << (s))
+#define ANY_STATE	0x7F
+
+#define REG(field) ((volatile uint32_t *)&emmc_sim_reg.field)
+
+/* transfer directions */
+#define SIM_IDLE 0
+#define SIM_READ 1
+#define SIM_WRITE 2
+
+/* flags waiting on the CMD and DAT lines */
+#define EV_CMD 0
+#define EV_DAT 1
+
+emmc_reg_t emmc_sim_reg;
+
+static uint8_t *mem;		/* contents of the card */
+static unsigned num_blocks;
+static struct emmc_sim_stats_t stats;
+
+static struct emmc_sim_latency_t latency;
+static struct {
+	uint32_t flags;		/* flags to raise */
+	unsigned due;		/* system timer value to raise them at */
+} events[2];
+
+static int state;		/* CARD_* */
+static int app_cmd;		/* next command is application specific */
+static unsigned ocr_polls;	/* SD_SEND_OP_COND sent since reset */
+
+static unsigned caps;		/* EMMC_SIM_* the card has */
+static int card_4bit;		/* card is using 4 data lines */
+static int card_hs;		/* card is in high speed mode */
+
+/*
+ * Transfer in progress
+ */
+static int dir;			/* SIM_IDLE, SIM_READ or SIM_WRITE */
+static unsigned lba;		/* block being moved */
+static unsigned left;		/* blocks left if counted */
+static int counted;		/* 0 if the transfer runs until CMD12 */
+static unsigned word;		/* next word of block */
+static int auto_stop;		/* 1 to send CMD12 after the last block */
+static uint8_t reg_data[SWITCH_SIZE];	/* card register being sent */
+static unsigned reg_len;	/* its length, 0 when moving blocks */
+
+/*
+ * Set interrupt flags that are enabled in INT_MASK
+ */
+static void sim_raise(uint32_t flags)
+{
+	flags &= emmc_sim_reg.int_mask;
+	if (flags & 0xFFFF0000)
+		flags |= INT_ERROR;
+	emmc_sim_reg.interrupt |= flags;
+
+	/* INT_EN decides which flags reach the interrupt controller */
+	if (flags & emmc_sim_reg.int_enbl)
+		dummy_irq_raise(IRQ_EMMC);
+}
+
+/*
+ * Set interrupt flags once us microseconds have passed on a line
+ */
+static void sim_raise_after(int line, uint32_t flags, unsigned us)
+{
+	if (us == 0) {
+		sim_raise(flags);
+		return;
+	}
+	events[line].flags |= flags;
+	events[line].due = timer_read() + us;
+}
+
+/*
+ * Raise flags whose time has come
+ */
+static void sim_update()
+{
+	int i;
+
+	for (i=0; i<2; i++)
+		if (events[i].flags && (int)(timer_read() - events[i].due) >= 0) {
+			sim_raise(events[i].flags);
+			events[i].flags = 0;
+		}
+}
+
+/*
+ * SD clock in Hz
+ */
+static unsigned sim_clock()
+{
+	unsigned div = CTRL_CLK_DIV(emmc_sim_reg.ctrl_1);
+
+	return div ? EMMC_SIM_CLOCK / (2 * div) : EMMC_SIM_CLOCK;
+}
+
+/*
+ * Time in us to clock bits over a line, if the bus is being timed
+ */
+static unsigned sim_bus_us(unsigned bits)
+{
+	unsigned us;
+
+	if (!latency.bus)
+		return 0;
+	us = ((unsigned long long)bits * 1000000 + sim_clock() - 1) / sim_clock();
+	stats.bus_us += us;
+	return us;
+}
+
+/*
+ * Time in us for the card to move a block of len bytes
+ */
+static unsigned sim_block_us(unsigned len)
+{
+	return latency.block_us + sim_bus_us(len * 8 / (card_4bit ? 4 : 1) +
+			CRC_BITS);
+}
+
+/*
+ * Finish the transfer in progress, the host sees it done after us
+ */
+static void sim_end_transfer(unsigned us)
+{
+	if (dir == SIM_IDLE)
+		return;
+	dir = SIM_IDLE;
+	state = CARD_TRAN;
+	sim_raise_after(EV_DAT, INT_DAT_DONE, us);
+}
+
+/*
+ * Words in the block being moved
+ */
+static unsigned sim_block_words()
+{
+	return reg_len ? reg_len / 4 : BLOCK_WORDS;
+}
+
+/*
+ * Move on after the last word of a block
+ */
+static void sim_next_block()
+{
+	if (reg_len) {
+		reg_len = 0;
+		sim_end_transfer(0);
+		return;
+	}
+
+	word = 0;
+	++lba;
+	if (left > 0) {
+		--left;
+		emmc_sim_reg.blksizcnt = (left << 16) | BLOCK_SIZE;
+	}
+
+	if (counted && left == 0) {
+		if (auto_stop) {
+			++stats.auto_cmd12;
+			++stats.cmd[12];
+		}
+		/* the last block of a write still has to go to the card */
+		sim_end_transfer(dir == SIM_WRITE ? sim_block_us(BLOCK_SIZE) : 0);
+	} else if (lba >= num_blocks) {
+		/* the card waits in data or rcv to be stopped */
+		dir = SIM_IDLE;
+		sim_raise(INT_DTO_ERR);
+	} else {
+		sim_raise_after(EV_DAT, dir == SIM_READ ? INT_RD_READY : INT_WR_READY,
+				sim_block_us(BLOCK_SIZE));
+	}
+}
+
+/*
+ * Take the next word of a read from the buffer
+ */
+static uint32_t sim_data_read()
+{
+	uint32_t val;
+
+	if (dir != SIM_READ) {
+		++stats.protocol_errors;
+		return 0;
+	}
+	if (reg_len)
+		memcpy(&val, &reg_data[word * 4], 4);
+	else
+		memcpy(&val, &mem[lba * BLOCK_SIZE + word * 4], 4);
+	if (++word == sim_block_words()) {
+		if (!reg_len)
+			++stats.blocks_read;
+		sim_next_block();
+	}
+	return val;
+}
+
+/*
+ * Put the next word of a write in the buffer
+ */
+static void sim_data_write(uint32_t val)
+{
+	if (dir != SIM_WRITE) {
+		++stats.protocol_errors;
+		return;
+	}
+	memcpy(&mem[lba * BLOCK_SIZE + word * 4], &val, 4);
+	if (++word == BLOCK_WORDS) {
+		++stats.blocks_written;
+		sim_next_block();
+	}
+}
+
+/*
+ * R1 response giving the state the card was in when the command came
+ */
+static uint32_t sim_r1(uint32_t flags)
+{
+	return R1_STATE(state) | R1_READY | flags;
+}
+
+/*
+ * Return true if the card and host agree on how to drive the DAT lines
+ */
+static int sim_bus_ok()
+{
+	int host_4bit = (emmc_sim_reg.ctrl_0 & C0_HCTL_DWIDTH) != 0;
+	int host_hs = (emmc_sim_reg.ctrl_0 & C0_HCTL_HS_EN) != 0;
+
+	if (card_4bit && (caps & EMMC_SIM_BAD_4BIT))
+		return 0;
+	if (sim_clock() > (card_hs ? HS_MAX : DEFAULT_MAX))
+		return 0;
+	return host_4bit == card_4bit && host_hs == card_hs;
+}
+
+/*
+ * Start moving blocks for a read or write command
+ */
+static void sim_start_transfer(unsigned cmd, unsigned arg, int write)
+{
+	if (arg >= num_blocks) {
+		emmc_sim_reg.resp_0 = sim_r1(R1_OUT_OF_RANGE);
+		return;
+	}
+	if ((emmc_sim_reg.blksizcnt & 0x3FF) != BLOCK_SIZE)
+		++stats.protocol_errors;
+	emmc_sim_reg.resp_0 = sim_r1(0);
+
+	/* a single block ends on its own, more wait for CMD12 */
+	if (!sim_bus_ok()) {
+		if (cmd & TM_MULTIBLK)
+			state = write ? CARD_RCV : CARD_DATA;
+		sim_raise(INT_DCRC_ERR);
+		return;
+	}
+
+	state = write ? CARD_RCV : CARD_DATA;
+	dir = write ? SIM_WRITE : SIM_READ;
+	lba = arg;
+	word = 0;
+	left = 1;
+	counted = 1;
+	auto_stop = 0;
+	if (cmd & TM_MULTIBLK) {
+		left = emmc_sim_reg.blksizcnt >> 16;
+		counted = (cmd & TM_BLKCNT) != 0;
+		auto_stop = (cmd & TM_CMD12) != 0;
+	}
+
+	/* the host buffer takes the first block of a write at once */
+	sim_raise_after(EV_DAT, write ? INT_WR_READY : INT_RD_READY,
+			write ? 0 : sim_block_us(BLOCK_SIZE));
+}
+
+/*
+ * Start sending len bytes of a card register held in reg_data
+ */
+static void sim_send_register(unsigned len)
+{
+	if ((emmc_sim_reg.blksizcnt & 0x3FF) != len)
+		++stats.protocol_errors;
+	emmc_sim_reg.resp_0 = sim_r1(0);
+	if (!sim_bus_ok()) {
+		sim_raise(INT_DCRC_ERR);
+		return;
+	}
+
+	state = CARD_DATA;
+	dir = SIM_READ;
+	word = 0;
+	reg_len = len;
+	sim_raise_after(EV_DAT, INT_RD_READY, sim_block_us(len));
+}
+
+/*
+ * Answer SWITCH_FUNC, which only knows about high speed in group 1
+ */
+static void sim_switch(unsigned arg)
+{
+	unsigned fn = arg & 0xF;
+
+	memset(reg_data, 0, SWITCH_SIZE);
+	reg_data[13] = 0x1 | (caps & EMMC_SIM_HS ? 0x2 : 0);
+	if (fn == 0xF)
+		fn = card_hs;
+	else if (fn > 1 || (fn == 1 && !(caps & EMMC_SIM_HS)))
+		fn = 0xF;
+	reg_data[16] = fn;
+
+	/* the card switches once it has sent the status */
+	sim_send_register(SWITCH_SIZE);
+	if ((arg & 0x80000000) && fn != 0xF)
+		card_hs = fn;
+}
+
+/*
+ * States a command is allowed in
+ */
+static unsigned sim_legal_states(unsigned index, int app)
+{
+	switch (index) {
+	case 0:		/* GO_IDLE_STATE */
+	case 55:	/* APP_CMD */
+		return ANY_STATE;
+	case 2:		/* ALL_SEND_CID */
+		return IN(CARD_READY);
+	case 3:		/* SEND_RELATIVE_ADDR */
+		return IN(CARD_IDENT) | IN(CARD_STBY);
+	case 7:		/* SELECT_CARD */
+		return IN(CARD_STBY) | IN(CARD_TRAN);
+	case 8:		/* SD_SEND_IF_COND */
+		return IN(CARD_IDLE);
+	case 9:		/* SEND_CSD */
+		return IN(CARD_STBY);
+	case 12:	/* STOP_TRANSMISSION */
+		return IN(CARD_DATA) | IN(CARD_RCV);
+	case 41:	/* SD_SEND_OP_COND */
+		return app ? IN(CARD_IDLE) : 0;
+	case 51:	/* SEND_SCR */
+		return app ? IN(CARD_TRAN) : 0;
+	case 6:		/* SET_BUS_WIDTH, SWITCH_FUNC */
+	case 16:	/* SET_BLOCKLEN */
+	case 17:	/* READ_SINGLE_BLOCK */
+	case 18:	/* READ_MULTIPLE_BLOCK */
+	case 24:	/* WRITE_BLOCK */
+	case 25:	/* WRITE_MULTIPLE_BLOCK */
+		return IN(CARD_TRAN);
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Carry out a command written to CMDTM
+ */
+static void sim_command(unsigned cmd)
+{
+	unsigned arg = emmc_sim_reg.arg_1, index = CMD_INDEX(cmd), bits;
+	int app = app_cmd;
+
+	++stats.commands;
+	++stats.cmd[index];
+	app_cmd = 0;
+
+	if (!(emmc_sim_reg.ctrl_1 & CTRL_CLK_EN) || (dir != SIM_IDLE && index != 12))
+		++stats.protocol_errors;
+
+	/* the card is identified at no more than 400 kHz */
+	if ((index == 2 || index == 3 || (app && index == 41)) &&
+			sim_clock() > IDENT_MAX)
+		++stats.protocol_errors;
+
+	/* the card does not answer a command it does not expect */
+	if (!(sim_legal_states(index, app) & IN(state))) {
+		++stats.illegal_commands;
+		sim_raise(INT_CTO_ERR);
+		return;
+	}
+
+	switch (index) {
+	case 0:		/* GO_IDLE_STATE */
+		state = CARD_IDLE;
+		ocr_polls = 0;
+		card_4bit = 0;
+		card_hs = 0;
+		dir = SIM_IDLE;
+		break;
+	case 2:		/* ALL_SEND_CID */
+		emmc_sim_reg.resp_0 = 0x53494D30;
+		emmc_sim_reg.resp_1 = 0x2E313233;
+		emmc_sim_reg.resp_2 = 0x45534D53;
+		emmc_sim_reg.resp_3 = 0x00DA4B00;
+		state = CARD_IDENT;
+		break;
+	case 3:		/* SEND_RELATIVE_ADDR */
+		emmc_sim_reg.resp_0 = SIM_RCA << 16 | R1_STATE(state) | R1_READY;
+		state = CARD_STBY;
+		break;
+	case 6:
+		if (app) {	/* SET_BUS_WIDTH */
+			if ((arg & 0x3) == 2 && !(caps & EMMC_SIM_4BIT)) {
+				emmc_sim_reg.resp_0 = sim_r1(R1_ILLEGAL);
+				break;
+			}
+			card_4bit = (arg & 0x3) == 2;
+			emmc_sim_reg.resp_0 = sim_r1(R1_APP_CMD);
+		} else {	/* SWITCH_FUNC */
+			sim_switch(arg);
+		}
+		break;
+	case 7:		/* SELECT_CARD */
+		emmc_sim_reg.resp_0 = sim_r1(0);
+		state = arg >> 16 == SIM_RCA ? CARD_TRAN : CARD_STBY;
+		break;
+	case 8:		/* SD_SEND_IF_COND */
+		emmc_sim_reg.resp_0 = arg & 0xFFF;
+		break;
+	case 9:		/* SEND_CSD, version 2.0 */
+		emmc_sim_reg.resp_0 = 0;
+		emmc_sim_reg.resp_1 = 0;
+		emmc_sim_reg.resp_2 = CSD_TRAN_SPEED << 24;
+		emmc_sim_reg.resp_3 = 0x400000;
+		break;
+	case 12:	/* STOP_TRANSMISSION */
+		emmc_sim_reg.resp_0 = sim_r1(0);
+		sim_end_transfer(0);
+		state = CARD_TRAN;
+		break;
+	case 16:	/* SET_BLOCKLEN */
+		emmc_sim_reg.resp_0 = sim_r1(0);
+		break;
+	case 17:	/* READ_SINGLE_BLOCK */
+	case 18:	/* READ_MULTIPLE_BLOCK */
+		sim_start_transfer(cmd, arg, 0);
+		break;
+	case 24:	/* WRITE_BLOCK */
+	case 25:	/* WRITE_MULTIPLE_BLOCK */
+		sim_start_transfer(cmd, arg, 1);
+		break;
+	case 41:	/* SD_SEND_OP_COND */
+		/* the card is ready the second time it is asked to start */
+		emmc_sim_reg.resp_0 = OCR_VOLTAGE | OCR_CAPACITY;
+		if (arg != 0 && ++ocr_polls >= 2) {
+			emmc_sim_reg.resp_0 |= OCR_BUSY;
+			state = CARD_READY;
+		}
+		break;
+	case 51:	/* SEND_SCR */
+		/* SD 2.00, 1 bit and maybe 4 bit bus */
+		memset(reg_data, 0, SCR_SIZE);
+		reg_data[0] = 0x02;
+		reg_data[1] = 0x01 | (caps & EMMC_SIM_4BIT ? 0x04 : 0);
+		sim_send_register(SCR_SIZE);
+		break;
+	case 55:	/* APP_CMD */
+		app_cmd = 1;
+		emmc_sim_reg.resp_0 = sim_r1(R1_APP_CMD);
+		break;
+	}
+
+	/* the command and its response, 136 bits for a long one */
+	bits = 48;
+	if (cmd & CMD_RESP)
+		bits += (cmd & CMD_RESP) == CMD_LONG ? 136 : 48;
+	sim_raise_after(EV_CMD, INT_CMD_DONE, latency.command_us + sim_bus_us(bits));
+}
+
+/*
+ * Handle a write to CONTROL1
+ */
+static void sim_control(uint32_t val)
+{
+	if (val & CTRL_RESET_ALL) {
+		memset(&emmc_sim_reg, 0, sizeof(emmc_sim_reg));
+		memset(events, 0, sizeof(events));
+		dir = SIM_IDLE;
+		reg_len = 0;
+		return;
+	}
+	if (val & CTRL_RESET_DAT) {
+		events[EV_DAT].flags = 0;
+		dir = SIM_IDLE;
+		reg_len = 0;
+	}
+
+	/* resets finish at once and the clock is stable as soon as it is on */
+	val &= ~(CTRL_RESET_CMD | CTRL_RESET_DAT | CTRL_STABLE);
+	if (val & CTRL_INTCLK_EN)
+		val |= CTRL_STABLE;
+	emmc_sim_reg.ctrl_1 = val;
+}
+
+/*
+ * Start with a freshly powered card holding num_blocks blocks at mem
+ */
+void emmc_sim_init(void *card_mem, unsigned card_blocks)
+{
+	memset(&emmc_sim_reg, 0, sizeof(emmc_sim_reg));
+	memset(&stats, 0, sizeof(stats));
+	memset(&latency, 0, sizeof(latency));
+	memset(events, 0, sizeof(events));
+	mem = card_mem;
+	num_blocks = card_blocks;
+	dummy_irq_add_device(sim_update);
+	state = CARD_IDLE;
+	app_cmd = 0;
+	ocr_polls = 0;
+	caps = EMMC_SIM_4BIT | EMMC_SIM_HS;
+	card_4bit = 0;
+	card_hs = 0;
+	dir = SIM_IDLE;
+	reg_len = 0;
+}
+
+/*
+ * Start with a freshly powered card holding the image at path, writes go
+ * to the image
+ */
+int emmc_sim_open(const char *path)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	if (path == NULL || (fd = open(path, O_RDWR)) < 0)
+		return -ENOENT;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -EIO;
+	}
+
+	/* the mapping outlives the descriptor */
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -EIO;
+
+	emmc_sim_init(map, st.st_size / BLOCK_SIZE);
+	return 0;
+}
+
+/*
+ * Give the card only some of 4 bit bus and high speed mode, must be
+ * called before emmc_init()
+ */
+void emmc_sim_set_caps(unsigned card_caps)
+{
+	caps = card_caps;
+}
+
+/*
+ * Make commands and blocks take time to complete, NULL for none
+ */
+void emmc_sim_set_latency(const struct emmc_sim_latency_t *lat)
+{
+	if (lat == NULL)
+		memset(&latency, 0, sizeof(latency));
+	else
+		latency = *lat;
+}
+
+/*
+ * Read a register of the simulated host
+ */
+uint32_t emmc_sim_read(volatile uint32_t *reg)
+{
+	sim_update();
+
+	if (reg == REG(status))
+		return ST_CARD_INS | (dir == SIM_IDLE ? 0 : ST_DAT_BUSY | ST_DAT_ACTIVE) |
+			(dir == SIM_READ ? ST_READ_RDY : 0) |
+			(dir == SIM_WRITE ? ST_WRITE_RDY : 0);
+
+	if (reg == REG(interrupt))
+		++stats.int_reads;
+
+	if (reg == REG(data)) {
+		++stats.cpu_words;
+		return sim_data_read();
+	}
+
+	return *reg;
+}
+
+/*
+ * Write a register of the simulated host
+ */
+void emmc_sim_write(volatile uint32_t *reg, uint32_t val)
+{
+	if (reg == REG(cmd_tm)) {
+		emmc_sim_reg.cmd_tm = val;
+		sim_command(val);
+	} else if (reg == REG(ctrl_1)) {
+		sim_control(val);
+	} else if (reg == REG(interrupt)) {
+		/* flags are cleared by writing 1 */
+		emmc_sim_reg.interrupt &= ~val;
+		if (!(emmc_sim_reg.interrupt & 0xFFFF0000))
+			emmc_sim_reg.interrupt &= ~INT_ERROR;
+	} else if (reg == REG(data)) {
+		++stats.cpu_words;
+		sim_data_write(val);
+	} else if (reg == REG(int_enbl)) {
+		emmc_sim_reg.int_enbl = val;
+		if (emmc_sim_reg.interrupt & val)
+			dummy_irq_raise(IRQ_EMMC);
+	} else if (reg != REG(status) && reg != REG(resp_0) && reg != REG(resp_1) &&
+			reg != REG(resp_2) && reg != REG(resp_3)) {
+		*reg = val;
+	}
+}
+
+/*
+ * Copy out what the driver asked of the card
+ */
+void emmc_sim_get_stats(struct emmc_sim_stats_t *ret)
+{
+	memcpy(ret, &stats, sizeof(struct emmc_sim_stats_t));
+}
+
+/*
+ * Return true while the buffer can take (write) or give (read) a word,
+ * the DREQ signal the host gives the DMA controller
+ */
+int emmc_sim_dreq(int write)
+{
+	sim_update();
+	if (events[EV_DAT].flags & (INT_RD_READY | INT_WR_READY))
+		return 0;
+	return dir == (write ? SIM_WRITE : SIM_READ);
+}
+
+/*
+ * DATA read by the DMA controller
+ */
+uint32_t emmc_sim_dma_read()
+{
+	return sim_data_read();
+}
+
+/*
+ * DATA written by the DMA controller
+ */
+void emmc_sim_dma_write(uint32_t val)
+{
+	sim_data_write(val);
+}
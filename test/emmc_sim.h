@@ -0,0 +1,68 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * test/emmc_sim.h
+ *
+ * Register level simulator of the EMMC host and an SD card
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	April 11 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#ifndef EMMC_SIM_H
+#define EMMC_SIM_H
+
+#include <platform.h>
+#include <types.h>
+
+#define EMMC_SIM_CLOCK		250000000	/* base clock of the host */
+
+/* what the card can do, for emmc_sim_set_caps() */
+#define EMMC_SIM_4BIT		0x1	/* 4 data lines */
+#define EMMC_SIM_HS		0x2	/* high speed mode */
+#define EMMC_SIM_BAD_4BIT	0x4	/* but data on 4 lines is garbled */
+
+/*
+ * What the driver asked of the card
+ */
+struct emmc_sim_stats_t {
+	unsigned commands;	/* commands sent by the driver */
+	unsigned cmd[64];	/* commands sent by index */
+	unsigned auto_cmd12;	/* STOP_TRANSMISSION sent by the host */
+	unsigned blocks_read;	/* blocks moved to the host */
+	unsigned blocks_written;	/* blocks moved to the card */
+	unsigned protocol_errors;	/* data accesses the host would not allow */
+	unsigned int_reads;	/* reads of the INTERRUPT register */
+	unsigned cpu_words;	/* DATA reads and writes by the CPU */
+	unsigned illegal_commands;	/* commands the card's state did not allow */
+	unsigned bus_us;	/* time spent clocking bits over the bus */
+};
+
+/*
+ * Time taken by the card
+ */
+struct emmc_sim_latency_t {
+	unsigned command_us;	/* fixed cost of a command */
+	unsigned block_us;	/* fixed cost of each block */
+	int bus;		/* 1 to add the time to clock bits over the bus */
+};
+
+extern emmc_reg_t emmc_sim_reg;
+
+/* Function prototypes */
+void emmc_sim_init(void *mem, unsigned num_blocks);
+int emmc_sim_open(const char *path);
+void emmc_sim_set_latency(const struct emmc_sim_latency_t *latency);
+void emmc_sim_set_caps(unsigned caps);
+uint32_t emmc_sim_read(volatile uint32_t *reg);
+void emmc_sim_write(volatile uint32_t *reg, uint32_t val);
+void emmc_sim_get_stats(struct emmc_sim_stats_t *stats);
+int emmc_sim_dreq(int write);
+uint32_t emmc_sim_dma_read();
+void emmc_sim_dma_write(uint32_t val);
+
+#endif /* EMMC_SIM_H */
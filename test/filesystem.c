@@ -1,10 +1,19 @@
-#include <emmc.h>
+#include <stdlib.h>
+
+#include <bcache.h>
+#include <blockdev.h>
+#include <dcache.h>
+#include <errno.h>
 #include <filesystem.h>
 #include <string.h>
 
+#include "imagedev.h"
+#include "test.h"
+
 /*
  * Private function prototypes to include in tests
  */
+extern struct vol_t volume;
 int fs_lookup(const char *name, struct dirent_t *ret);
 int fs_str_to_name(char *short_name, const char *filename);
 void fs_name_to_str(char *filename, const char *short_name);
@@ -12,20 +21,162 @@ void fs_name_to_str(char *filename, const char *short_name);
 const char *test_name = "FS";
 
 const char *test_file = "FS_TEST.TXT";
+const char *deep_file = "/deep/d0/d1/d2/d3/d4/d5/d6/d7/d8/d9/d10/d11/d12/d13/d14/d15/leaf.dat";
+#define WIDE_FILES 600
+#define LONG_FILES 300
+#define BIG_SIZE 70000
+#define STREAM_SIZE 100000
+
+static unsigned char big_buf[BIG_SIZE];
+static struct blockdev_t disk;
+
 const char *test_str = "'Twas brillig, and the slithy toves\n"
 	"Did gyre and gimble in the wabe;\n"
 	"All mimsy were the borogoves,\n"
 	"And the mome raths outgrabe.\n";
 
+/*
+ * Count the runs of contiguous clusters in a file and the FAT sectors its
+ * chain goes through
+ */
+static unsigned count_runs(const char *path, unsigned *fat_sectors)
+{
+        struct dirent_t dirent;
+        unsigned cluster, next, lba, last_lba = 0, runs = 1;
+        uint32_t fat[128];
+
+        *fat_sectors = 0;
+        if (fs_lookup(path, &dirent) != 0)
+                return 0;
+        for (cluster=dirent.cluster; ; cluster=next) {
+                lba = volume.fat_lba + cluster / 128;
+                if (lba != last_lba) {
+                        blockdev_read(&disk, lba, 1, fat);
+                        last_lba = lba;
+                        ++*fat_sectors;
+                }
+                next = fat[cluster % 128] & 0x0FFFFFFF;
+                if (next >= 0x0FFFFFF8)
+                        return runs;
+                if (next != cluster + 1)
+                        ++runs;
+        }
+}
+
+/*
+ * Consumer for fs_stream() that checks the pattern of a file
+ */
+struct stream_check_t {
+        unsigned pos;           /* offset of the next byte */
+        unsigned stop;          /* offset to stop streaming at */
+        int flood;              /* 1 to flood the cache during the first call */
+        int bad;                /* 1 if the data did not match */
+};
+
+static int check_stream(void *ctx, const unsigned char *data, unsigned len)
+{
+        struct stream_check_t *check = ctx;
+        unsigned i;
+
+        /* the sector is pinned while the rest of the cache turns over */
+        for (i=0; check->flood && i<2*BCACHE_SIZE; i++)
+                bcache_get(i);
+        check->flood = 0;
+
+        for (i=0; i<len; i++)
+                if (data[i] != IMAGE_PATTERN(check->pos + i))
+                        check->bad = 1;
+        check->pos += len;
+
+        return check->pos >= check->stop;
+}
+
+/*
+ * Read operation of a disk that cannot read its FAT
+ */
+static const struct blockdev_ops_t *image_ops;
+
+static int fat_failing_read(struct blockdev_t *dev, unsigned lba,
+                unsigned count, void *buf)
+{
+        if (lba + count > volume.fat_lba && lba < volume.fat_lba + volume.fat_size)
+                return -EIO;
+        return image_ops->read(dev, lba, count, buf);
+}
+
+/*
+ * Count the free clusters, chains and extents in the FAT the slow way
+ */
+static void count_fat(struct fs_scan_t *expect)
+{
+        unsigned cluster, next;
+        uint32_t fat[128];
+
+        memset(expect, 0, sizeof(struct fs_scan_t));
+        for (cluster=2; cluster<volume.num_clusters+2; cluster++) {
+                if (cluster == 2 || cluster % 128 == 0)
+                        blockdev_read(&disk, volume.fat_lba + cluster / 128, 1, fat);
+                next = fat[cluster % 128] & 0x0FFFFFFF;
+                if (next == 0) {
+                        ++expect->free;
+                } else if (next >= 0x0FFFFFF8) {
+                        ++expect->chains;
+                        ++expect->extents;
+                } else if (next != cluster + 1) {
+                        ++expect->extents;
+                }
+        }
+}
+
 const char *run_test()
 {
         int ret;
         char short_name[12];
         char filename[13];
         struct dirent_t dirent;
-
-        fs_init();
+        struct fs_scan_t scan, expect;
+        struct blockdev_stats_t dev_before, dev_after;
+        struct blockdev_ops_t failing_ops;
+
+        if (imagedev_open(&disk, getenv(IMAGEDEV_ENV), NULL) != 0)
+                return "opening disk image";
+
+        /* deferring the scan keeps mount down to a few reads */
+        blockdev_get_stats(&disk, &dev_before);
+        fs_init(&disk, FS_SCAN_DEFER);
+        blockdev_get_stats(&disk, &dev_after);
+        if (dev_after.reads - dev_before.reads > 3)
+                return "deferring FAT scan";
+        if (fs_get_scan(&scan) != 0 || scan.reads == 0)
+                return "running deferred FAT scan";
+
+        /* the scan streams the FAT in large reads */
+        fs_init(&disk, 0);
         /*fs_dump_part_table();*/
+        count_fat(&expect);
+        if (fs_get_scan(&scan) != 0)
+                return "scanning FAT";
+        if (scan.free != expect.free || scan.chains != expect.chains ||
+                        scan.extents != expect.extents || scan.bad || scan.broken)
+                return "counting clusters and chains in FAT";
+        if (scan.used + scan.free != volume.num_clusters ||
+                        volume.free_clusters != scan.free)
+                return "counting used clusters";
+        if (scan.reads > (volume.fat_size + FS_SCAN_BLOCKS - 1) / FS_SCAN_BLOCKS)
+                return "reading FAT in large requests";
+
+        /* a scan that fails is run again rather than reported */
+        fs_init(&disk, FS_SCAN_DEFER);
+        image_ops = disk.ops;
+        failing_ops = *disk.ops;
+        failing_ops.read = fat_failing_read;
+        disk.ops = &failing_ops;
+        if (fs_get_scan(&scan) != -EIO || fs_get_scan(&scan) != -EIO)
+                return "failing FAT scan on failing disk";
+        disk.ops = image_ops;
+        if (fs_get_scan(&scan) != 0 || scan.free != expect.free ||
+                        scan.chains != expect.chains)
+                return "scanning FAT after disk recovers";
 
         /* fs_str_to_name */
         memset(short_name, '\0', 12);
@@ -126,6 +277,20 @@ const char *run_test()
         if (!ret)
                 return "found non-existant file";
 
+        /* repeated lookups are answered by the dentry cache */
+        struct dcache_stats_t before, after;
+        dcache_get_stats(&before);
+        ret = fs_lookup("BootCode.Bin", &dirent);
+        if (ret || strcmp(dirent.short_name, "BOOTCODEBIN"))
+                return "could not find cached file";
+        ret = fs_lookup("bootcode.bi", &dirent);
+        if (!ret)
+                return "found cached non-existant file";
+        dcache_get_stats(&after);
+        if (after.hits != before.hits + 1 || after.neg_hits != before.neg_hits + 1 ||
+                        after.misses != before.misses)
+                return "looking up cached files";
+
         /* fs_read */
         unsigned char read_buf[1024];
         int bytes_read, pos = 0;
@@ -137,5 +302,278 @@ const char *run_test()
 	if (strcmp((char *)read_buf, test_str))
 		return "failed reading from short file";
 
+        /* fs_open, fs_read_fd, fs_seek, fs_close */
+        int fd = fs_open(test_file);
+        if (fd < 0)
+                return "could not open file";
+
+        if (fs_open("bootcode.bi") >= 0)
+                return "opened non-existant file";
+
+        pos = 0;
+        do {
+                bytes_read = fs_read_fd(fd, &read_buf[pos], 64);
+                pos += bytes_read;
+                read_buf[pos] = '\0';
+        } while (bytes_read > 0);
+        if (bytes_read < 0 || strcmp((char *)read_buf, test_str))
+                return "failed reading from open file";
+
+        if (fs_seek(fd, 5, FS_SEEK_SET) != 5)
+                return "seeking from start of file";
+        bytes_read = fs_read_fd(fd, read_buf, 7);
+        if (bytes_read != 7 || strncmp((char *)read_buf, &test_str[5], 7))
+                return "reading after seek";
+
+        if (fs_seek(fd, -4, FS_SEEK_CUR) != 8)
+                return "seeking backwards from current position";
+
+        if (fs_seek(fd, -8, FS_SEEK_END) != strlen(test_str) - 8)
+                return "seeking from end of file";
+        bytes_read = fs_read_fd(fd, read_buf, 64);
+        if (bytes_read != 8 || strncmp((char *)read_buf, &test_str[strlen(test_str)-8], 8))
+                return "reading up to end of file";
+
+        if (fs_seek(fd, -1, FS_SEEK_SET) >= 0)
+                return "seeking before start of file";
+
+        if (fs_close(fd) != 0 || fs_close(fd) == 0)
+                return "closing file";
+        if (fs_read_fd(fd, read_buf, 64) >= 0)
+                return "reading from closed file";
+
+        /* path resolution */
+        ret = fs_lookup(deep_file, &dirent);
+        if (ret || dirent.size != 1000 || (dirent.attributes & FS_ATTR_DIRECTORY))
+                return "could not find file in deep tree";
+
+        ret = fs_lookup("deep//d0/./d1/../../d0/d1/d2", &dirent);
+        if (ret || !(dirent.attributes & FS_ATTR_DIRECTORY))
+                return "resolving path with '.' and '..'";
+
+        ret = fs_lookup("/..", &dirent);
+        if (ret || dirent.cluster != volume.root)
+                return "resolving '..' in root directory";
+
+        ret = fs_lookup("/deep/..", &dirent);
+        if (ret || dirent.cluster != volume.root)
+                return "resolving '..' to root directory";
+
+        struct dirent_t parent;
+        fs_lookup("/deep", &parent);
+        ret = fs_lookup("/deep/d0/..", &dirent);
+        if (ret || dirent.cluster != parent.cluster)
+                return "resolving '..' to parent directory";
+
+        ret = fs_lookup("/deep/d0/nothere/d1", &dirent);
+        if (!ret)
+                return "found file below non-existant directory";
+
+        ret = fs_lookup("/FS_TEST.TXT/d0", &dirent);
+        if (!ret)
+                return "found file below regular file";
+
+        ret = fs_lookup("/wide/f0000599.dat", &dirent);
+        if (ret || dirent.size != 100)
+                return "could not find last file in large directory";
+
+        fd = fs_open(deep_file);
+        if (fd < 0)
+                return "could not open file in deep tree";
+        bytes_read = fs_read_fd(fd, read_buf, sizeof(read_buf));
+        fs_close(fd);
+        if (bytes_read != 1000)
+                return "reading file in deep tree";
+        for (pos=0; pos<bytes_read; pos++)
+                if (read_buf[pos] != IMAGE_PATTERN(pos))
+                        return "reading file in deep tree returned wrong data";
+
+        if (fs_open("/deep") != -EISDIR)
+                return "opening directory as file";
+
+        /* contiguous clusters are read with a single request */
+        struct blockdev_stats_t bd_before, bd_after;
+        struct fs_stats_t fs_before, fs_after;
+        unsigned runs, fat_sectors;
+        runs = count_runs("big.dat", &fat_sectors);
+        fd = fs_open("big.dat");
+        bcache_flush();         /* finish readahead queued by earlier reads */
+        blockdev_get_stats(&disk, &bd_before);
+        fs_get_stats(&fs_before);
+        bytes_read = fs_read_fd(fd, big_buf, BIG_SIZE);
+        blockdev_get_stats(&disk, &bd_after);
+        fs_get_stats(&fs_after);
+        fs_close(fd);
+        if (bytes_read != BIG_SIZE)
+                return "reading large file at once";
+        for (pos=0; pos<BIG_SIZE; pos++)
+                if (big_buf[pos] != IMAGE_PATTERN(pos))
+                        return "reading large file at once returned wrong data";
+        /* each run, the partial last cluster and the FAT sectors */
+        if (bd_after.reads - bd_before.reads > runs + 1 + fat_sectors)
+                return "reading contiguous clusters with separate requests";
+
+        /* only the partial last sector is copied */
+        if (fs_after.bytes_read - fs_before.bytes_read != BIG_SIZE ||
+                        fs_after.bytes_copied - fs_before.bytes_copied != BIG_SIZE % 512)
+                return "copying whole sectors through bounce buffer";
+
+        /* reads spanning many clusters */
+        fd = fs_open("big.dat");
+        pos = 0;
+        while ((bytes_read = fs_read_fd(fd, read_buf, 1000)) > 0) {
+                for (ret=0; ret<bytes_read; ret++)
+                        if (read_buf[ret] != IMAGE_PATTERN(pos + ret))
+                                return "reading large file returned wrong data";
+                pos += bytes_read;
+        }
+        fs_close(fd);
+        if (pos != BIG_SIZE)
+                return "reading large file";
+
+        /* small sequential reads are served by readahead */
+        struct bcache_stats_t bc_before, bc_after;
+        runs = count_runs("stream.dat", &fat_sectors);
+        fd = fs_open("stream.dat");
+        bcache_flush();
+        blockdev_get_stats(&disk, &bd_before);
+        bcache_get_stats(&bc_before);
+        pos = 0;
+        while ((bytes_read = fs_read_fd(fd, read_buf, 512)) > 0) {
+                for (ret=0; ret<bytes_read; ret++)
+                        if (read_buf[ret] != IMAGE_PATTERN(pos + ret))
+                                return "reading ahead returned wrong data";
+                pos += bytes_read;
+        }
+        blockdev_get_stats(&disk, &bd_after);
+        bcache_get_stats(&bc_after);
+        if (pos != STREAM_SIZE)
+                return "reading file with readahead";
+        if (bd_after.reads - bd_before.reads >
+                        STREAM_SIZE / 512 / FS_READAHEAD_MIN + runs + fat_sectors)
+                return "reading ahead with small requests";
+        if (bc_after.ra_hits - bc_before.ra_hits < STREAM_SIZE / 512 - FS_READAHEAD_MIN ||
+                        bc_after.ra_hits - bc_before.ra_hits !=
+                        bc_after.ra_blocks - bc_before.ra_blocks)
+                return "counting readahead hits";
+
+        /* streaming hands out cached sectors without copying them */
+        struct stream_check_t check = { 1000, STREAM_SIZE / 2, 1, 0 };
+        fs_get_stats(&fs_before);
+        if (fs_seek(fd, check.pos, FS_SEEK_SET) != check.pos ||
+                        fs_stream(fd, check_stream, &check) != 1 ||
+                        fs_seek(fd, 0, FS_SEEK_CUR) != check.pos)
+                return "stopping stream early";
+        check.stop = STREAM_SIZE + 1;
+        if (fs_stream(fd, check_stream, &check) != 0 || check.pos != STREAM_SIZE)
+                return "streaming to end of file";
+        if (check.bad)
+                return "streaming returned wrong data";
+        fs_get_stats(&fs_after);
+        if (fs_after.bytes_streamed - fs_before.bytes_streamed != STREAM_SIZE - 1000 ||
+                        fs_after.bytes_copied != fs_before.bytes_copied)
+                return "copying streamed data";
+        if (fs_stream(FS_MAX_FILES, check_stream, &check) != -EBADF)
+                return "streaming bad descriptor";
+        fs_close(fd);
+
+        /* random reads shut the window, sequential reads open it again */
+        static const unsigned offsets[] = { 90000, 10000, 50000, 30000, 70000, 20000 };
+        fd = fs_open("random.dat");
+        bcache_get_stats(&bc_before);
+        for (pos=0; pos<6; pos++) {
+                fs_seek(fd, offsets[pos], FS_SEEK_SET);
+                bytes_read = fs_read_fd(fd, read_buf, 100);
+                for (ret=0; ret<bytes_read; ret++)
+                        if (read_buf[ret] != IMAGE_PATTERN(offsets[pos] + ret))
+                                return "reading at random returned wrong data";
+        }
+        bcache_get_stats(&bc_after);
+        if (bc_after.ra_blocks != bc_before.ra_blocks)
+                return "reading ahead of random reads";
+        for (pos=0; pos<4; pos++)
+                fs_read_fd(fd, read_buf, 100);
+        bcache_get_stats(&bc_after);
+        fs_close(fd);
+        if (bc_after.ra_blocks == bc_before.ra_blocks)
+                return "reading ahead after random reads";
+
+        /* streaming directory iteration */
+        struct dir_t dir;
+        if (fs_opendir("/FS_TEST.TXT", &dir) != -ENOTDIR)
+                return "opening regular file as directory";
+        if (fs_opendir("/nothere", &dir) != -ENOENT)
+                return "opening non-existant directory";
+
+        if (fs_opendir("/wide", &dir) != 0)
+                return "could not open large directory";
+        if (!fs_readdir_next(&dir, &dirent) || strcmp(dirent.short_name, ".          "))
+                return "reading '.' entry";
+        if (!fs_readdir_next(&dir, &dirent) || strcmp(dirent.short_name, "..         "))
+                return "reading '..' entry";
+        for (pos=0; fs_readdir_next(&dir, &dirent); pos++) {
+                char expect[13];
+                fs_name_to_str(filename, dirent.short_name);
+                memcpy(expect, "F0000000.DAT", 13);
+                expect[5] += pos / 100 % 10;
+                expect[6] += pos / 10 % 10;
+                expect[7] += pos % 10;
+                if (pos >= WIDE_FILES || strcmp(filename, expect))
+                        return "listing large directory";
+        }
+        if (pos != WIDE_FILES)
+                return "listing every entry of large directory";
+        if (fs_readdir_next(&dir, &dirent))
+                return "reading past end of directory";
+
+        if (fs_opendir("/", &dir) != 0 || !fs_readdir_next(&dir, &dirent) ||
+                        strcmp(dirent.short_name, "BOOTCODEBIN"))
+                return "listing root directory";
+
+        /* long names */
+        ret = fs_lookup("/long/Long file name 0000299.dat", &dirent);
+        if (ret || dirent.size != 10 || strcmp(dirent.short_name, "LONG~300DAT"))
+                return "could not find long name";
+
+        ret = fs_lookup("/LONG/LONG FILE NAME 0000150.DAT", &dirent);
+        if (ret || strcmp(dirent.long_name, "Long file name 0000150.dat"))
+                return "could not find long name in different case";
+
+        ret = fs_lookup("/long/long~300.dat", &dirent);
+        if (ret || strcmp(dirent.long_name, "Long file name 0000299.dat"))
+                return "could not find short alias of long name";
+
+        ret = fs_lookup("/long/Long file name 0000300.dat", &dirent);
+        if (!ret)
+                return "found non-existant long name";
+
+        ret = fs_lookup("/long/LONG~300.DATA", &dirent);
+        if (!ret)
+                return "found truncated 8.3 name";
+
+        ret = fs_lookup("/Orphaned long name.txt", &dirent);
+        if (!ret)
+                return "found orphaned long name";
+
+        ret = fs_lookup("/ORPHAN~1.TXT", &dirent);
+        if (ret || dirent.long_name[0] != '\0')
+                return "could not find short name of orphaned long name";
+
+        if (fs_opendir("/long", &dir) != 0)
+                return "could not open directory of long names";
+        fs_readdir_next(&dir, &dirent);
+        fs_readdir_next(&dir, &dirent);
+        for (pos=0; fs_readdir_next(&dir, &dirent); pos++) {
+                char expect[32];
+                memcpy(expect, "Long file name 0000000.dat", 27);
+                expect[19] += pos / 100 % 10;
+                expect[20] += pos / 10 % 10;
+                expect[21] += pos % 10;
+                if (pos >= LONG_FILES || strcmp(dirent.long_name, expect))
+                        return "listing directory of long names";
+        }
+        if (pos != LONG_FILES)
+                return "listing every long name";
+
         return NULL;
 }
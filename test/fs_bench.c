@@ -0,0 +1,222 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * test/fs_bench.c
+ *
+ * Filesystem benchmarks
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	March 21 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * Runs the filesystem against one or more images built by mkimage (see
+ * the fs-bench target in the Makefile) and prints one CSV row per
+ * measurement:
+ *
+ *	lookup_miss	fs_lookup() of a random name in a directory of
+ *			param entries with an empty dentry cache
+ *	lookup_hit	the same with a set of names small enough to stay in
+ *			the dentry cache
+ *	seq_read_4k	reading a file of param bytes front to back in 4K
+ *			calls to fs_read_fd()
+ *	seq_read_64k	the same in 64K calls
+ *	rand_read_4k	4K reads at random 4K aligned offsets in a file of
+ *			param bytes
+ *
+ * Every row carries the wall clock cost of an operation, the device
+ * requests and blocks it took, and a modelled throughput that charges
+ * each request and each block what they would cost on an SD card. The
+ * image itself is memory mapped, so wall clock time is the time spent in
+ * our own code and the request counts are what would make it fast or
+ * slow on real hardware.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <blockdev.h>
+#include <dcache.h>
+#include <filesystem.h>
+#include <string.h>
+
+#include "imagedev.h"
+
+/*
+ * Private function prototypes to include in benchmarks
+ */
+extern struct vol_t volume;
+int fs_lookup(const char *name, struct dirent_t *ret);
+
+#define MODEL_REQUEST_US 150	/* command overhead of an SD request */
+#define MODEL_BLOCK_US 25	/* transfer time of a block at 20MB/s */
+
+#define LOOKUPS 200		/* lookups per directory */
+#define HOT_NAMES (DCACHE_SIZE / 2)	/* names used by lookup_hit */
+#define RANDOM_READS 1000	/* random reads per file */
+#define SEQ_BYTES (16 << 20)	/* read at least this much per file */
+
+static const unsigned dir_sizes[] = { 10, 100, 1000, 5000 };
+static const unsigned file_sizes[] = { 4096, 65536, 1 << 20, 8 << 20 };
+
+static struct blockdev_t disk;
+static unsigned char buf[65536];
+static unsigned seed = 1;
+
+/*
+ * A measurement in progress
+ */
+struct sample_t {
+	double start;
+	struct blockdev_stats_t stats;
+};
+
+static unsigned next_random()
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7FFF;
+}
+
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sample_start(struct sample_t *sample)
+{
+	blockdev_get_stats(&disk, &sample->stats);
+	sample->start = now();
+}
+
+/*
+ * Print the row for ops operations that moved bytes bytes since start
+ */
+static void sample_end(struct sample_t *sample, const char *bench,
+		unsigned param, unsigned ops, double bytes)
+{
+	double secs = now() - sample->start;
+	struct blockdev_stats_t stats;
+	unsigned reads, blocks;
+	double model;
+
+	blockdev_get_stats(&disk, &stats);
+	reads = stats.reads - sample->stats.reads;
+	blocks = stats.blocks_read - sample->stats.blocks_read;
+	model = secs + (reads * MODEL_REQUEST_US + blocks * MODEL_BLOCK_US) / 1e6;
+
+	printf("%s,%u,%u,%u,%.3f,%.1f,%.2f,%.2f,%.2f\n", bench,
+			volume.cluster_size * volume.sector_size, param, ops,
+			secs * 1e6 / ops, bytes / secs / 1e6,
+			(double)reads / ops, (double)blocks / ops,
+			bytes / model / 1e6);
+}
+
+static void bench_lookup(unsigned entries)
+{
+	char path[64];
+	struct dirent_t dirent;
+	struct sample_t sample;
+	unsigned names[LOOKUPS];
+	int i, cached;
+
+	for (i=0; i<LOOKUPS; i++)
+		names[i] = next_random() % entries;
+
+	for (cached=0; cached<2; cached++) {
+		/* warm the cache with the few names we will look up */
+		dcache_init();
+		for (i=0; cached && i<LOOKUPS; i++) {
+			names[i] = names[i % HOT_NAMES];
+			sprintf(path, "/d%u/f%07u.dat", entries, names[i]);
+			fs_lookup(path, &dirent);
+		}
+
+		sample_start(&sample);
+		for (i=0; i<LOOKUPS; i++) {
+			if (!cached)
+				dcache_init();
+			sprintf(path, "/d%u/f%07u.dat", entries, names[i]);
+			if (fs_lookup(path, &dirent) != 0) {
+				fprintf(stderr, "fs-bench: %s not found\n", path);
+				exit(1);
+			}
+		}
+		sample_end(&sample, cached ? "lookup_hit" : "lookup_miss",
+				entries, LOOKUPS, 0);
+	}
+}
+
+static void bench_seq_read(unsigned size, unsigned chunk, const char *bench)
+{
+	char path[64];
+	struct sample_t sample;
+	unsigned reps = size >= SEQ_BYTES ? 1 : SEQ_BYTES / size, i, ops = 0;
+	int fd, n;
+
+	sprintf(path, "/s%u.dat", size);
+	sample_start(&sample);
+	for (i=0; i<reps; i++) {
+		if ((fd = fs_open(path)) < 0) {
+			fprintf(stderr, "fs-bench: cannot open %s\n", path);
+			exit(1);
+		}
+		while ((n = fs_read_fd(fd, buf, chunk)) > 0)
+			++ops;
+		fs_close(fd);
+	}
+	sample_end(&sample, bench, size, ops, (double)reps * size);
+}
+
+static void bench_rand_read(unsigned size)
+{
+	char path[64];
+	struct sample_t sample;
+	int fd, i;
+
+	sprintf(path, "/s%u.dat", size);
+	fd = fs_open(path);
+	sample_start(&sample);
+	for (i=0; i<RANDOM_READS; i++) {
+		fs_seek(fd, next_random() % (size / 4096) * 4096, FS_SEEK_SET);
+		fs_read_fd(fd, buf, 4096);
+	}
+	sample_end(&sample, "rand_read_4k", size, RANDOM_READS,
+			(double)RANDOM_READS * 4096);
+	fs_close(fd);
+}
+
+int main(int argc, char **argv)
+{
+	int arg, i;
+
+	printf("benchmark,cluster_bytes,param,ops,us_per_op,mb_per_s,"
+			"reads_per_op,blocks_per_op,model_mb_per_s\n");
+
+	for (arg=1; arg<argc; arg++) {
+		if (imagedev_open(&disk, argv[arg], NULL) != 0) {
+			fprintf(stderr, "fs-bench: cannot open %s\n", argv[arg]);
+			return 1;
+		}
+		fs_init(&disk, 0);
+
+		for (i=0; i<sizeof(dir_sizes)/sizeof(dir_sizes[0]); i++)
+			bench_lookup(dir_sizes[i]);
+		for (i=0; i<sizeof(file_sizes)/sizeof(file_sizes[0]); i++) {
+			bench_seq_read(file_sizes[i], 4096, "seq_read_4k");
+			bench_seq_read(file_sizes[i], 65536, "seq_read_64k");
+		}
+		bench_rand_read(file_sizes[3]);
+
+		imagedev_close(&disk);
+	}
+
+	return 0;
+}
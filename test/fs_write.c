@@ -0,0 +1,402 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * test/fs_write.c
+ *
+ * Tests for writing to the FAT32 filesystem
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	March 28 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * The image is copied into a RAM disk so that the tests can scribble on
+ * it without changing the image the other tests read.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#include <stdlib.h>
+
+#include <bcache.h>
+#include <blockdev.h>
+#include <errno.h>
+#include <filesystem.h>
+#include <ramdisk.h>
+#include <string.h>
+
+#include "imagedev.h"
+
+/*
+ * Private function prototypes to include in tests
+ */
+extern struct vol_t volume;
+int fs_lookup(const char *name, struct dirent_t *ret);
+
+const char *test_name = "FS_WRITE";
+
+#define RECORD_SIZE 100
+#define RECORDS 2000
+
+static unsigned char *ram;
+static struct blockdev_t disk;
+static unsigned char buf[RECORD_SIZE * RECORDS];
+
+/*
+ * Fill a record of the log with a pattern that depends on its number
+ */
+static void make_record(unsigned char *record, unsigned n)
+{
+	int i;
+
+	for (i=0; i<RECORD_SIZE; i++)
+		record[i] = (n * 7 + i) & 0xFF;
+}
+
+/*
+ * Return true if two buffers hold the same bytes
+ */
+static int same(const unsigned char *a, const unsigned char *b, unsigned size)
+{
+	unsigned i;
+
+	for (i=0; i<size; i++)
+		if (a[i] != b[i])
+			return 0;
+	return 1;
+}
+
+/*
+ * Return true if every copy of the FAT is the same
+ */
+static int fats_match()
+{
+	unsigned i, size = volume.fat_size * BLOCKDEV_BLOCK_SIZE;
+	unsigned char *fat = &ram[volume.fat_lba * BLOCKDEV_BLOCK_SIZE];
+
+	for (i=1; i<volume.num_fats; i++)
+		if (!same(fat, fat + i * size, size))
+			return 0;
+	return 1;
+}
+
+/*
+ * Count the free entries of the FAT
+ */
+static unsigned count_free()
+{
+	unsigned cluster, n = 0;
+	uint32_t *fat = (uint32_t *)&ram[volume.fat_lba * BLOCKDEV_BLOCK_SIZE];
+
+	for (cluster=2; cluster<volume.num_clusters+2; cluster++)
+		n += (fat[cluster] & 0x0FFFFFFF) == 0;
+	return n;
+}
+
+/*
+ * Free cluster count recorded in the FSInfo sector
+ */
+static unsigned fsinfo_free()
+{
+	return *(uint32_t *)&ram[volume.fsinfo_lba * BLOCKDEV_BLOCK_SIZE + 488];
+}
+
+/*
+ * Count the runs of contiguous clusters in a file
+ */
+static unsigned count_runs(const char *path)
+{
+	struct dirent_t dirent;
+	unsigned cluster, next, runs = 1;
+	uint32_t *fat = (uint32_t *)&ram[volume.fat_lba * BLOCKDEV_BLOCK_SIZE];
+
+	if (fs_lookup(path, &dirent) != 0 || dirent.cluster == 0)
+		return 0;
+	for (cluster=dirent.cluster; ; cluster=next) {
+		next = fat[cluster] & 0x0FFFFFFF;
+		if (next >= 0x0FFFFFF8)
+			return runs;
+		if (next != cluster + 1)
+			++runs;
+	}
+}
+
+/*
+ * Count the entries of a directory
+ */
+static int count_entries(const char *path)
+{
+	struct dir_t dir;
+	struct dirent_t dirent;
+	int n = 0;
+
+	if (fs_opendir(path, &dir) != 0)
+		return -1;
+	while (fs_readdir_next(&dir, &dirent))
+		++n;
+	return n;
+}
+
+/*
+ * Write operation of a RAM disk that has stopped taking writes
+ */
+static int failing_write(struct blockdev_t *dev, unsigned lba, unsigned count,
+		const void *buf)
+{
+	return -EIO;
+}
+
+const char *run_test()
+{
+	int fd, i, n;
+	char path[8 + FS_MAX_NAME];
+	unsigned char record[RECORD_SIZE];
+	struct blockdev_t image;
+	struct blockdev_ops_t failing_ops;
+	const struct blockdev_ops_t *ram_ops;
+	struct blockdev_stats_t before, after;
+	struct fs_stats_t stats;
+	struct dirent_t dirent;
+	struct dir_t dir;
+
+	if (imagedev_open(&image, getenv(IMAGEDEV_ENV), NULL) != 0)
+		return "opening disk image";
+	ram = malloc(image.num_blocks * BLOCKDEV_BLOCK_SIZE);
+	if (ram == NULL || blockdev_read(&image, 0, image.num_blocks, ram) != 0)
+		return "loading image into memory";
+	ramdisk_init(&disk, ram, image.num_blocks);
+	imagedev_close(&image);
+	fs_init(&disk, 0);
+
+	/* the free count comes from FSInfo */
+	if (volume.fsinfo_lba == 0 || volume.free_clusters != count_free())
+		return "reading free count from FSInfo";
+
+	/* append records to a new log */
+	if ((fd = fs_create("/log.txt")) < 0)
+		return "creating file";
+	blockdev_get_stats(&disk, &before);
+	for (i=0; i<RECORDS; i++) {
+		make_record(record, i);
+		if (fs_write(fd, record, RECORD_SIZE) != RECORD_SIZE)
+			return "appending to file";
+	}
+	if (fs_sync() != 0)
+		return "syncing filesystem";
+	blockdev_get_stats(&disk, &after);
+
+	/* data, FAT and directory updates leave in a few large requests */
+	n = after.blocks_written - before.blocks_written;
+	if (n < RECORD_SIZE * RECORDS / BLOCKDEV_BLOCK_SIZE ||
+			after.writes - before.writes > n / 16)
+		return "batching appends";
+	fs_get_stats(&stats);
+	if (stats.bytes_written != RECORD_SIZE * RECORDS)
+		return "counting bytes written";
+
+	if (fsinfo_free() != count_free() || volume.free_clusters != count_free())
+		return "keeping free count up to date";
+
+	/* the log reads back through the open descriptor */
+	if (fs_seek(fd, 0, FS_SEEK_SET) != 0 ||
+			fs_read_fd(fd, buf, sizeof(buf)) != sizeof(buf))
+		return "reading back file";
+	for (i=0; i<RECORDS; i++) {
+		make_record(record, i);
+		if (!same(&buf[i * RECORD_SIZE], record, RECORD_SIZE))
+			return "reading back appended records";
+	}
+	fs_close(fd);
+
+	/* and from the disk once the volume is mounted again, the first
+	 * allocation scans the FAT */
+	if (!fats_match())
+		return "mirroring FAT";
+	fs_init(&disk, FS_SCAN_DEFER);
+	if (fs_lookup("/LOG.TXT", &dirent) != 0 || dirent.size != sizeof(buf) ||
+			strcmp(dirent.long_name, "log.txt") ||
+			strcmp(dirent.short_name, "LOG     TXT"))
+		return "looking up new file";
+	memset(buf, 0, sizeof(buf));
+	if (fs_read("/log.txt", buf, 0, sizeof(buf)) != sizeof(buf))
+		return "reading file after remount";
+	for (i=0; i<RECORDS; i++) {
+		make_record(record, i);
+		if (!same(&buf[i * RECORD_SIZE], record, RECORD_SIZE))
+			return "reading back records after remount";
+	}
+
+	/* appending to an existing file */
+	if ((fd = fs_open("/log.txt")) < 0 || fs_seek(fd, 0, FS_SEEK_END) != sizeof(buf))
+		return "opening file to append";
+	if (fs_write(fd, (const unsigned char *)"tail", 4) != 4 ||
+			fs_lookup("/log.txt", &dirent) != 0 || dirent.size != sizeof(buf) + 4)
+		return "appending to existing file";
+
+	/* writing past the end leaves a gap of zeros */
+	if (fs_seek(fd, 1000, FS_SEEK_END) < 0 ||
+			fs_write(fd, (const unsigned char *)"end", 3) != 3)
+		return "writing past end of file";
+	if (fs_read("/log.txt", buf, sizeof(buf), 1007) != 1007 ||
+			strncmp((char *)buf, "tail", 4) ||
+			strncmp((char *)&buf[1004], "end", 3))
+		return "reading past old end of file";
+	for (i=4; i<1004; i++)
+		if (buf[i] != 0)
+			return "filling gap with zeros";
+
+	/* truncating frees clusters that the next file can use */
+	if (fs_truncate(fd, 1000) != 0 || fs_seek(fd, 0, FS_SEEK_END) != 1000)
+		return "truncating file";
+	if (fs_truncate(fd, 2000) != -EINVAL)
+		return "growing file by truncating";
+	if (fs_truncate(fd, 0) != 0 || fs_lookup("/log.txt", &dirent) != 0 ||
+			dirent.size != 0 || dirent.cluster != 0)
+		return "truncating file to nothing";
+	fs_close(fd);
+
+	/* large writes are given contiguous clusters */
+	memset(buf, 'x', sizeof(buf));
+	if ((fd = fs_create("/one.dat")) < 0 || fs_write(fd, buf, 65536) != 65536)
+		return "writing large file";
+	fs_close(fd);
+	if (count_runs("/one.dat") != 1)
+		return "allocating contiguous clusters for large write";
+
+	/* two files growing side by side get a run for each write */
+	if ((fd = fs_create("/two.dat")) < 0 || (n = fs_create("/three.dat")) < 0)
+		return "creating files that grow together";
+	for (i=0; i<8; i++)
+		if (fs_write(fd, buf, 8192) != 8192 || fs_write(n, buf, 8192) != 8192)
+			return "growing files together";
+	fs_close(fd);
+	fs_close(n);
+	if (count_runs("/two.dat") > 8 || count_runs("/three.dat") > 8)
+		return "allocating runs for files that grow together";
+	if (fs_sync() != 0 || fsinfo_free() != count_free())
+		return "counting freed and allocated clusters";
+
+	/* overwriting part of an existing file */
+	if ((fd = fs_open("/FS_TEST.TXT")) < 0 || fs_seek(fd, 6, FS_SEEK_SET) != 6 ||
+			fs_write(fd, (const unsigned char *)"BRILLIG", 7) != 7)
+		return "overwriting file";
+	fs_close(fd);
+	if (fs_read("/FS_TEST.TXT", buf, 0, 20) != 20 ||
+			strncmp((char *)buf, "'Twas BRILLIG, and t", 20))
+		return "reading back overwritten file";
+
+	/* creating an existing file empties it */
+	if ((fd = fs_create("/fs_test.txt")) < 0)
+		return "recreating file";
+	fs_close(fd);
+	if (fs_lookup("/FS_TEST.TXT", &dirent) != 0 || dirent.size != 0)
+		return "emptying existing file";
+
+	/* long names get an alias that does not clash */
+	if ((fd = fs_create("/long/Long file name 0001000.dat")) < 0)
+		return "creating file with long name";
+	fs_close(fd);
+	if (fs_lookup("/long/long file name 0001000.dat", &dirent) != 0 ||
+			strcmp(dirent.short_name, "LONG~301DAT"))
+		return "making alias of long name";
+	if (count_entries("/long") != 300 + 3)
+		return "listing directory after creating file";
+
+	/* the longest name takes 20 long entries and still reads back */
+	memcpy(path, "/long/", 6);
+	for (i=0; i<FS_MAX_NAME; i++)
+		path[6 + i] = 'a' + i % 26;
+	path[6 + FS_MAX_NAME] = '\0';
+	if ((fd = fs_create(path)) < 0)
+		return "creating file with longest name";
+	fs_write(fd, (const unsigned char *)"longest", 7);
+	fs_close(fd);
+	path[7] = 'B';
+	if (fs_lookup(path, &dirent) != 0 || strlen(dirent.long_name) != FS_MAX_NAME ||
+			strcmp(dirent.long_name, &path[6]) == 0 ||
+			strcasecmp(dirent.long_name, &path[6]) != 0)
+		return "looking up file with longest name";
+	if (fs_sync() != 0)
+		return "syncing file with longest name";
+	fs_init(&disk, 0);
+	if (fs_read(path, buf, 0, 32) != 7 || strncmp((char *)buf, "longest", 7))
+		return "reading file with longest name after remount";
+	if (fs_opendir("/long", &dir) != 0)
+		return "opening directory with longest name";
+	n = 0;
+	while (fs_readdir_next(&dir, &dirent))
+		n += strcasecmp(dirent.long_name, &path[6]) == 0;
+	if (n != 1)
+		return "listing file with longest name";
+	path[6 + FS_MAX_NAME] = 'x';
+	path[7 + FS_MAX_NAME] = '\0';
+	if (fs_create(path) >= 0)
+		return "creating file with name that is too long";
+
+	/* directories grow when they run out of entries */
+	n = count_entries("/deep");
+	for (i=0; i<40; i++) {
+		strncpy(path, "/deep/file.000", sizeof(path));
+		path[11] += i / 100;
+		path[12] += i / 10 % 10;
+		path[13] += i % 10;
+		if ((fd = fs_create(path)) < 0)
+			return "creating files in small directory";
+		fs_write(fd, (const unsigned char *)path, strlen(path));
+		fs_close(fd);
+	}
+	if (fs_sync() != 0 || !fats_match())
+		return "syncing after growing directory";
+	fs_init(&disk, 0);
+	if (count_entries("/deep") != n + 40)
+		return "listing grown directory";
+	if (fs_read("/deep/FILE.039", buf, 0, 32) != 14 || strncmp((char *)buf,
+				"/deep/file.039", 14))
+		return "reading file in grown directory";
+	if (fs_opendir("/deep/d0", &dir) != 0)
+		return "opening old subdirectory of grown directory";
+
+	/* a disk that stops taking writes fails the writes that cannot be
+	 * cached, and what was written is still there once it recovers */
+	if ((fd = fs_create("/stuck.dat")) < 0 || fs_sync() != 0)
+		return "creating file on failing disk";
+	ram_ops = disk.ops;
+	failing_ops = *disk.ops;
+	failing_ops.write = failing_write;
+	disk.ops = &failing_ops;
+	memset(buf, 'y', sizeof(buf));
+	for (n=0; n<=BCACHE_SIZE; n++)
+		if ((i = fs_write(fd, buf, BLOCKDEV_BLOCK_SIZE)) != BLOCKDEV_BLOCK_SIZE)
+			break;
+	if (n > BCACHE_SIZE || i != -EIO)
+		return "failing writes when the cache is full";
+	if (fs_sync() != -EIO)
+		return "failing sync on failing disk";
+	disk.ops = ram_ops;
+	if (fs_sync() != 0 || !fats_match())
+		return "syncing after disk recovers";
+	fs_close(fd);
+	fs_init(&disk, 0);
+	memset(buf, 0, sizeof(buf));
+	if (fs_lookup("/stuck.dat", &dirent) != 0 ||
+			dirent.size != n * BLOCKDEV_BLOCK_SIZE ||
+			fs_read("/stuck.dat", buf, 0, sizeof(buf)) != dirent.size)
+		return "keeping writes the disk refused";
+	for (i=0; i<dirent.size; i++)
+		if (buf[i] != 'y')
+			return "reading back writes the disk refused";
+
+	/* errors */
+	if (fs_create("/missing/file.txt") != -ENOENT)
+		return "creating file in missing directory";
+	if (fs_create("/deep") != -EISDIR)
+		return "creating file over directory";
+	if (fs_write(FS_MAX_FILES, buf, 1) != -EBADF)
+		return "writing to bad descriptor";
+
+	free(ram);
+
+	return NULL;
+}
@@ -0,0 +1,159 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * test/imagedev.c
+ *
+ * Block device backed by a host image file
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	March 14 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * Lets the host tests run the filesystem on a disk image. The image is
+ * opened once and mapped into memory so that a request of any size is a
+ * single memcpy() with no system call at all. If the image cannot be
+ * mapped every request is a single pread() or pwrite() instead. An
+ * optional latency is added to each request so that the number and size
+ * of requests shows up in wall clock time the way it would on a card.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <string.h>
+
+#include "imagedev.h"
+
+struct imagedev_t {
+	int fd;
+	unsigned char *map;	/* mapped image or NULL */
+	size_t size;		/* size of image in bytes */
+	int read_only;		/* 1 if the image could not be opened for writing */
+	struct imagedev_latency_t latency;
+};
+
+static void imagedev_delay(struct blockdev_t *dev, unsigned count)
+{
+	struct imagedev_t *image = dev->priv;
+	unsigned us = image->latency.request_us + count * image->latency.block_us;
+
+	if (us)
+		usleep(us);
+}
+
+static int imagedev_read(struct blockdev_t *dev, unsigned lba, unsigned count,
+		void *buf)
+{
+	struct imagedev_t *image = dev->priv;
+	size_t len = (size_t)count * dev->block_size;
+
+	imagedev_delay(dev, count);
+	if (image->map != NULL)
+		memcpy(buf, image->map + (size_t)lba * dev->block_size, len);
+	else if (pread(image->fd, buf, len, (off_t)lba * dev->block_size) != (ssize_t)len)
+		return -EIO;
+
+	return 0;
+}
+
+static int imagedev_write(struct blockdev_t *dev, unsigned lba, unsigned count,
+		const void *buf)
+{
+	struct imagedev_t *image = dev->priv;
+	size_t len = (size_t)count * dev->block_size;
+
+	if (image->read_only)
+		return -EIO;
+
+	imagedev_delay(dev, count);
+	if (image->map != NULL)
+		memcpy(image->map + (size_t)lba * dev->block_size, buf, len);
+	else if (pwrite(image->fd, buf, len, (off_t)lba * dev->block_size) != (ssize_t)len)
+		return -EIO;
+
+	return 0;
+}
+
+static int imagedev_flush(struct blockdev_t *dev)
+{
+	struct imagedev_t *image = dev->priv;
+
+	if (image->map != NULL && msync(image->map, image->size, MS_SYNC) < 0)
+		return -EIO;
+
+	return fsync(image->fd) == 0 ? 0 : -EIO;
+}
+
+static const struct blockdev_ops_t imagedev_ops = {
+	.read = imagedev_read,
+	.write = imagedev_write,
+	.flush = imagedev_flush,
+	.discard = NULL,
+};
+
+/*
+ * Open the image at path as a block device, latency may be NULL
+ * Note: pass getenv(IMAGEDEV_ENV) to use the image the tests were started
+ * with, a NULL path fails with -ENOENT
+ */
+int imagedev_open(struct blockdev_t *dev, const char *path,
+		const struct imagedev_latency_t *latency)
+{
+	struct imagedev_t *image;
+	struct stat st;
+	int fd, prot = PROT_READ | PROT_WRITE;
+
+	if (path == NULL)
+		return -ENOENT;
+	if ((fd = open(path, O_RDWR)) < 0) {
+		if ((fd = open(path, O_RDONLY)) < 0)
+			return -ENOENT;
+		prot = PROT_READ;
+	}
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -EIO;
+	}
+
+	image = calloc(1, sizeof(struct imagedev_t));
+	image->fd = fd;
+	image->size = st.st_size;
+	image->read_only = !(prot & PROT_WRITE);
+	image->map = mmap(NULL, image->size, prot, MAP_SHARED, fd, 0);
+	if (image->map == MAP_FAILED)
+		image->map = NULL;
+	if (latency != NULL)
+		image->latency = *latency;
+
+	memset(dev, 0, sizeof(struct blockdev_t));
+	dev->name = path;
+	dev->ops = &imagedev_ops;
+	dev->block_size = BLOCKDEV_BLOCK_SIZE;
+	dev->num_blocks = st.st_size / BLOCKDEV_BLOCK_SIZE;
+	dev->priv = image;
+
+	return 0;
+}
+
+/*
+ * Close an image opened with imagedev_open()
+ */
+void imagedev_close(struct blockdev_t *dev)
+{
+	struct imagedev_t *image = dev->priv;
+
+	if (image->map != NULL)
+		munmap(image->map, image->size);
+	close(image->fd);
+	free(image);
+	dev->priv = NULL;
+}
@@ -0,0 +1,35 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * test/imagedev.h
+ *
+ * Block device backed by a host image file
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	March 14 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#ifndef IMAGEDEV_H
+#define IMAGEDEV_H
+
+#include <blockdev.h>
+
+#define IMAGEDEV_ENV "FS_IMAGE"	/* environment variable naming the image */
+
+/*
+ * Latency added to every request to model a slow device
+ */
+struct imagedev_latency_t {
+	unsigned request_us;	/* fixed cost of a request */
+	unsigned block_us;	/* cost of each block transferred */
+};
+
+int imagedev_open(struct blockdev_t *dev, const char *path,
+		const struct imagedev_latency_t *latency);
+void imagedev_close(struct blockdev_t *dev);
+
+#endif /* IMAGEDEV_H */
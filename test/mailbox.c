@@ -0,0 +1,380 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * test/mailbox.c
+ *
+ * Tests for the VideoCore mailbox and property messages
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	May 2 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#include <errno.h>
+#include <irq.h>
+#include <mailbox.h>
+#include <string.h>
+
+#include "dummy_irq.h"
+#include "emmc_sim.h"
+#include "mailbox_sim.h"
+
+const char *test_name = "MAILBOX";
+
+#define LATENCY 500		/* us for the VideoCore to answer */
+
+/* the board facts asked for at boot */
+static const uint32_t boot_tags[] = {
+	MBOX_TAG_BOARD_REV, MBOX_TAG_MAC_ADDR, MBOX_TAG_ARM_MEMORY,
+	MBOX_TAG_VC_MEMORY, MBOX_TAG_CLOCK_RATE, MBOX_TAG_CLOCK_RATE
+};
+static const uint32_t boot_args[] = { 0, 0, 0, 0, MBOX_CLOCK_EMMC, MBOX_CLOCK_ARM };
+#define BOOT_TAGS (sizeof(boot_tags) / sizeof(boot_tags[0]))
+
+/* answers handed to done() in the order they came */
+static int done_chan[MBOX_QUEUE_LEN];
+static uint32_t done_msg[MBOX_QUEUE_LEN];
+static unsigned num_done;
+
+/*
+ * Callback for mailbox_write_async()
+ */
+static void done(int channel, uint32_t message, void *arg)
+{
+	if (arg != done_msg)
+		return;
+	done_chan[num_done] = channel;
+	done_msg[num_done++] = message;
+}
+
+/*
+ * Sleep until count answers have been handed to done()
+ */
+static void wait_done(unsigned count)
+{
+	unsigned state;
+
+	for (;;) {
+		state = irq_save();
+		if (num_done >= count) {
+			irq_restore(state);
+			return;
+		}
+		irq_wait();
+		irq_restore(state);
+	}
+}
+
+/*
+ * Add the boot tags to a message
+ */
+static int add_boot_tags(struct mailbox_prop_t *prop, int *handles)
+{
+	unsigned i;
+
+	for (i=0; i<BOOT_TAGS; i++)
+		if ((handles[i] = mailbox_prop_add(prop, boot_tags[i], &boot_args[i],
+				boot_args[i] ? 1 : 0, 8)) < 0)
+			return -1;
+	return 0;
+}
+
+const char *run_test()
+{
+	struct mailbox_prop_t prop, one;
+	struct mailbox_sim_stats_t before, after;
+	struct mailbox_stats_t start, end;
+	int handles[BOOT_TAGS];
+	unsigned i, size, batched_us, separate_us;
+	uint32_t *val, msg, id, args[3], base, rev;
+	uint8_t mac[6];
+
+	mailbox_sim_init();
+
+	/* the first lookup asks for every board fact in one message */
+	mailbox_get_stats(&start);
+	if (mailbox_board_rev(&rev) != 0 || rev != MAILBOX_SIM_BOARD_REV)
+		return "looking up board revision";
+	mailbox_get_stats(&end);
+	if (end.transactions - start.transactions != 1 ||
+			end.tags - start.tags < 6)
+		return "filling board facts in one message";
+
+	/* and the rest come from memory */
+	if (mailbox_mac_addr(mac) != 0 || mac[0] != 0xB8 || mac[5] != 0x56)
+		return "looking up MAC address";
+	if (mailbox_arm_memory(&base, &size) != 0 || base != 0 ||
+			size != MAILBOX_SIM_ARM_MEMORY)
+		return "looking up ARM memory";
+	if (mailbox_vc_memory(&base, &size) != 0 ||
+			base != MAILBOX_SIM_ARM_MEMORY || size != MAILBOX_SIM_VC_MEMORY)
+		return "looking up VideoCore memory";
+	if (mailbox_clock_on(MBOX_CLOCK_EMMC) != 1 ||
+			mailbox_clock_rate(MBOX_CLOCK_EMMC) != EMMC_SIM_CLOCK)
+		return "looking up EMMC clock";
+	if (mailbox_clock_on(0) != -EINVAL || mailbox_clock_rate(99) != 0)
+		return "looking up missing clock";
+	mailbox_get_stats(&start);
+	if (start.transactions != end.transactions)
+		return "serving board facts from memory";
+
+	/* setting a clock drops its rate, the next lookup asks again */
+	if (mailbox_set_clock_rate(MBOX_CLOCK_CORE, 200000000) != 200000000)
+		return "setting core clock";
+	if (mailbox_clock_rate(MBOX_CLOCK_CORE) != 200000000 ||
+			mailbox_clock_rate(MBOX_CLOCK_CORE) != 200000000)
+		return "looking up changed clock";
+	if (mailbox_clock_rate(MBOX_CLOCK_EMMC) != EMMC_SIM_CLOCK)
+		return "keeping other clocks";
+	mailbox_get_stats(&end);
+	if (end.transactions - start.transactions != 2)
+		return "asking again for changed clock only";
+
+	/* as does a change made some other way */
+	mailbox_prop_init(&prop);
+	args[0] = MBOX_CLOCK_CORE;
+	args[1] = 250000000;
+	args[2] = 0;
+	mailbox_prop_add(&prop, MBOX_TAG_SET_CLOCK_RATE, args, 3, 12);
+	if (mailbox_prop_send(&prop) != 0)
+		return "setting clock behind the cache";
+	mailbox_clock_invalidate(MBOX_CLOCK_CORE);
+	if (mailbox_clock_rate(MBOX_CLOCK_CORE) != 250000000)
+		return "invalidating clock";
+
+	/* a board without a MAC address still has its other facts, and the
+	 * missing one is not asked for again */
+	mailbox_sim_drop_tag(MBOX_TAG_MAC_ADDR);
+	if (mailbox_info_init() != 0)
+		return "asking for board facts without MAC address";
+	mailbox_get_stats(&start);
+	if (mailbox_mac_addr(mac) != -EIO || mailbox_mac_addr(mac) != -EIO)
+		return "looking up missing MAC address";
+	if (mailbox_board_rev(&rev) != 0 || rev != MAILBOX_SIM_BOARD_REV ||
+			mailbox_clock_on(MBOX_CLOCK_EMMC) != 1 ||
+			mailbox_clock_rate(MBOX_CLOCK_EMMC) != EMMC_SIM_CLOCK)
+		return "looking up facts next to missing MAC address";
+	mailbox_get_stats(&end);
+	if (end.transactions != start.transactions)
+		return "asking again for missing MAC address";
+
+	/* a rate that went unanswered is asked for on its own */
+	mailbox_sim_drop_tag(MBOX_TAG_CLOCK_RATE);
+	if (mailbox_info_init() != 0)
+		return "asking for board facts without clock rates";
+	mailbox_sim_drop_tag(0);
+	mailbox_get_stats(&start);
+	if (mailbox_clock_on(MBOX_CLOCK_EMMC) != 1 ||
+			mailbox_clock_rate(MBOX_CLOCK_EMMC) != EMMC_SIM_CLOCK ||
+			mailbox_clock_rate(MBOX_CLOCK_EMMC) != EMMC_SIM_CLOCK)
+		return "looking up unanswered clock rate";
+	mailbox_get_stats(&end);
+	if (end.transactions - start.transactions != 1 ||
+			mailbox_mac_addr(mac) != 0)
+		return "asking again for unanswered clock rate only";
+
+	/* a raw message comes back on its own channel */
+	if (mailbox_write(MBOX_CHAN_FB, 0x1230) != 0)
+		return "writing message";
+	if (mailbox_read(MBOX_CHAN_FB, &msg) != 0 || msg != 0)
+		return "reading framebuffer answer";
+	if (mailbox_write(MBOX_CHAN_FB, 0x1234) != -EINVAL ||
+			mailbox_write(MBOX_CHAN_MAX + 1, 0x1230) != -EINVAL)
+		return "rejecting bad message";
+
+	/* an answer on another channel is kept for its reader */
+	mailbox_write(MBOX_CHAN_FB, 0x1230);
+	mailbox_prop_init(&prop);
+	mailbox_prop_add(&prop, MBOX_TAG_BOARD_REV, NULL, 0, 4);
+	if (mailbox_prop_send(&prop) != 0)
+		return "reading past framebuffer answer";
+	if (mailbox_read(MBOX_CHAN_FB, &msg) != 0 || msg != 0)
+		return "keeping framebuffer answer";
+
+	/* every board fact in one transaction */
+	mailbox_prop_init(&prop);
+	if (add_boot_tags(&prop, handles) != 0)
+		return "adding tags";
+	mailbox_sim_get_stats(&before);
+	if (mailbox_prop_send(&prop) != 0)
+		return "sending message";
+	mailbox_sim_get_stats(&after);
+	if (after.transactions - before.transactions != 1 ||
+			after.tags - before.tags != BOOT_TAGS)
+		return "sending tags in one transaction";
+
+	/* answers are picked out by tag */
+	if ((val = mailbox_prop_value(&prop, mailbox_prop_find(&prop,
+			MBOX_TAG_BOARD_REV), &size)) == NULL || size != 4 ||
+			val[0] != MAILBOX_SIM_BOARD_REV)
+		return "finding board revision";
+	if ((val = mailbox_prop_value(&prop, mailbox_prop_find(&prop,
+			MBOX_TAG_ARM_MEMORY), NULL)) == NULL || val[0] != 0 ||
+			val[1] != MAILBOX_SIM_ARM_MEMORY)
+		return "finding ARM memory";
+	if ((val = mailbox_prop_value(&prop, mailbox_prop_find(&prop,
+			MBOX_TAG_VC_MEMORY), NULL)) == NULL ||
+			val[0] != MAILBOX_SIM_ARM_MEMORY || val[1] != MAILBOX_SIM_VC_MEMORY)
+		return "finding VideoCore memory";
+	if ((val = mailbox_prop_value(&prop, mailbox_prop_find(&prop,
+			MBOX_TAG_MAC_ADDR), &size)) == NULL || size != 6 ||
+			((uint8_t *)val)[0] != 0xB8)
+		return "finding MAC address";
+	if (mailbox_prop_find(&prop, MBOX_TAG_CLOCK_STATE) != -ENOENT)
+		return "finding tag not sent";
+
+	/* or by handle when a tag is sent twice */
+	if (mailbox_prop_find(&prop, MBOX_TAG_CLOCK_RATE) != handles[4])
+		return "finding first of repeated tag";
+	if ((val = mailbox_prop_value(&prop, handles[4], NULL)) == NULL ||
+			val[0] != MBOX_CLOCK_EMMC || val[1] != EMMC_SIM_CLOCK)
+		return "reading EMMC clock rate";
+	if ((val = mailbox_prop_value(&prop, handles[5], NULL)) == NULL ||
+			val[0] != MBOX_CLOCK_ARM || val[1] == 0)
+		return "reading ARM clock rate";
+
+	/* a tag the VideoCore does not know goes unanswered */
+	mailbox_prop_init(&prop);
+	id = mailbox_prop_add(&prop, 0x12345, NULL, 0, 4);
+	i = mailbox_prop_add(&prop, MBOX_TAG_BOARD_REV, NULL, 0, 4);
+	if (mailbox_prop_send(&prop) != 0)
+		return "sending unknown tag";
+	if (mailbox_prop_value(&prop, id, NULL) != NULL)
+		return "leaving unknown tag unanswered";
+	if (mailbox_prop_value(&prop, i, NULL) == NULL)
+		return "answering tag after unknown tag";
+
+	/* the full length of an answer too big for its buffer is given */
+	mailbox_prop_init(&prop);
+	i = mailbox_prop_add(&prop, MBOX_TAG_MAC_ADDR, NULL, 0, 4);
+	if (mailbox_prop_send(&prop) != 0 ||
+			mailbox_prop_value(&prop, i, &size) == NULL || size != 6)
+		return "truncating answer";
+
+	/* setting a clock is seen by the next message */
+	mailbox_prop_init(&prop);
+	args[0] = MBOX_CLOCK_CORE;
+	args[1] = 300000000;
+	args[2] = 0;
+	mailbox_prop_add(&prop, MBOX_TAG_SET_CLOCK_RATE, args, 3, 12);
+	i = mailbox_prop_add(&prop, MBOX_TAG_CLOCK_RATE, args, 1, 8);
+	if (mailbox_prop_send(&prop) != 0 ||
+			(val = mailbox_prop_value(&prop, i, NULL)) == NULL ||
+			val[1] != 300000000)
+		return "setting clock rate";
+
+	/* a message only holds so many tags */
+	mailbox_prop_init(&prop);
+	if (mailbox_prop_add(&prop, MBOX_TAG_CLOCK_RATE, args, 3, 8) != -EINVAL)
+		return "adding arguments bigger than value buffer";
+	for (i=0; i<MBOX_PROP_WORDS; i++)
+		if (mailbox_prop_add(&prop, MBOX_TAG_BOARD_REV, NULL, 0, 4) < 0)
+			break;
+	if (i != (MBOX_PROP_WORDS - 3) / 4 ||
+			mailbox_prop_add(&prop, MBOX_TAG_BOARD_REV, NULL, 0, 4) != -ENOSPC)
+		return "filling message";
+	if (mailbox_prop_send(&prop) != 0)
+		return "sending full message";
+
+	/* one message for every board fact costs one round trip, all of them
+	 * together cost one */
+	mailbox_sim_set_latency(LATENCY);
+	mailbox_get_stats(&start);
+	for (i=0; i<BOOT_TAGS; i++) {
+		mailbox_prop_init(&one);
+		mailbox_prop_add(&one, boot_tags[i], &boot_args[i],
+				boot_args[i] ? 1 : 0, 8);
+		if (mailbox_prop_send(&one) != 0)
+			return "sending tags one at a time";
+	}
+	mailbox_get_stats(&end);
+	separate_us = end.us - start.us;
+	if (end.transactions - start.transactions != BOOT_TAGS ||
+			separate_us < BOOT_TAGS * LATENCY)
+		return "timing separate messages";
+
+	mailbox_prop_init(&prop);
+	add_boot_tags(&prop, handles);
+	mailbox_get_stats(&start);
+	if (mailbox_prop_send(&prop) != 0)
+		return "sending tags together";
+	mailbox_get_stats(&end);
+	batched_us = end.us - start.us;
+	if (end.transactions - start.transactions != 1 ||
+			end.tags - start.tags != BOOT_TAGS ||
+			batched_us < LATENCY)
+		return "timing batched message";
+	mailbox_sim_set_latency(0);
+
+	/* from here on answers are taken by interrupt */
+	mailbox_init();
+	if (!dummy_irq_enabled(IRQ_MAILBOX))
+		return "enabling interrupt";
+
+	/* a reader sleeps until the answer comes */
+	mailbox_sim_set_latency(LATENCY);
+	mailbox_get_stats(&start);
+	mailbox_prop_init(&prop);
+	i = mailbox_prop_add(&prop, MBOX_TAG_BOARD_REV, NULL, 0, 4);
+	if (mailbox_prop_send(&prop) != 0 ||
+			(val = mailbox_prop_value(&prop, i, NULL)) == NULL ||
+			val[0] != MAILBOX_SIM_BOARD_REV)
+		return "reading by interrupt";
+	mailbox_get_stats(&end);
+	if (end.irqs == start.irqs || end.sleeps == start.sleeps)
+		return "sleeping until interrupt";
+	mailbox_sim_set_latency(0);
+
+	/* and still gets its answer among others */
+	mailbox_write(MBOX_CHAN_FB, 0x1230);
+	mailbox_write(MBOX_CHAN_PWR, 0x50);
+	if (mailbox_prop_send(&prop) != 0)
+		return "reading by interrupt past other channels";
+	if (mailbox_read(MBOX_CHAN_PWR, &msg) != 0 || msg != 0x50 ||
+			mailbox_read(MBOX_CHAN_FB, &msg) != 0 || msg != 0)
+		return "reading queued answers";
+
+	/* callbacks get the answers on their channel in order */
+	if (mailbox_write_async(MBOX_CHAN_PWR, 0x10, NULL, NULL) != -EINVAL)
+		return "rejecting missing callback";
+	for (i=0; i<MBOX_QUEUE_LEN; i++)
+		if (mailbox_write_async(MBOX_CHAN_PWR, (i + 1) << 4, done,
+				done_msg) != 0)
+			return "writing with callback";
+	if (mailbox_write_async(MBOX_CHAN_PWR, 0x10, done, done_msg) != -ENOSPC)
+		return "limiting callbacks";
+	wait_done(MBOX_QUEUE_LEN);
+	for (i=0; i<MBOX_QUEUE_LEN; i++)
+		if (done_chan[i] != MBOX_CHAN_PWR || done_msg[i] != (i + 1) << 4)
+			return "calling back in order";
+
+	mailbox_get_stats(&end);
+	if (end.dropped != 0 || end.timeouts != 0)
+		return "losing answers";
+	mailbox_sim_get_stats(&after);
+	if (after.bad_messages != 0 || after.empty_reads != 0)
+		return "driving mailbox registers";
+
+	/* a late answer to an earlier message is not taken for the next one */
+	mailbox_prop_init(&one);
+	mailbox_prop_add(&one, MBOX_TAG_CLOCK_RATE, args, 1, 8);
+	one.buf[one.len] = 0;
+	one.buf[0] = (one.len + 1) * 4;
+	one.buf[1] = 0;
+	mailbox_write(MBOX_CHAN_PROP, mailbox_sim_bus_addr(one.buf));
+	mailbox_prop_init(&prop);
+	i = mailbox_prop_add(&prop, MBOX_TAG_BOARD_REV, NULL, 0, 4);
+	mailbox_get_stats(&start);
+	if (mailbox_prop_send(&prop) != 0 ||
+			(val = mailbox_prop_value(&prop, i, NULL)) == NULL ||
+			val[0] != MAILBOX_SIM_BOARD_REV)
+		return "reading past late answer";
+	mailbox_get_stats(&end);
+	if (end.dropped - start.dropped != 1)
+		return "dropping late answer";
+
+	return NULL;
+}
@@ -0,0 +1,316 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * test/mailbox_sim.c
+ *
+ * Simulator of the VideoCore mailbox
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	May 2 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * Built with -DMAILBOX_SIM, src/mailbox.c drives these registers instead
+ * of the hardware. Each message written to WRITE is answered by the
+ * VideoCore after the latency set with mailbox_sim_set_latency(), and the
+ * answer waits in a FIFO until it is taken from READ. Property messages
+ * are answered in place from a small table of board facts, a framebuffer
+ * request always succeeds and anything else is echoed back. With the
+ * data IRQ bit set in CONFIG, the mailbox raises IRQ_MAILBOX whenever it
+ * is looked at by the dummy interrupt controller and an answer is ready.
+ *
+ * As in test/dma_sim.c, host pointers do not fit in a message so
+ * mailbox_sim_bus_addr() hands out a made up bus address for each buffer
+ * and the VideoCore looks it up again.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#include <string.h>
+#include <timer.h>
+
+#include "dummy_irq.h"
+#include "emmc_sim.h"
+#include "mailbox_sim.h"
+
+/* STATUS fields */
+#define ST_FULL		0x80000000
+#define ST_EMPTY	0x40000000
+
+/* CONFIG fields */
+#define CONFIG_DATA_IRQ	0x1
+
+#define FIFO_DEPTH	8
+#define BUS_ADDRS	64
+#define BUS_STEP	0x1000
+
+#define PROP_ANSWERED	0x80000000
+
+mailbox_reg_t mailbox_sim_reg;
+
+static struct mailbox_sim_stats_t stats;
+static unsigned latency;
+static uint32_t dropped_tag;	/* tag left unanswered, 0 for none */
+
+/* answers waiting to be read, and when each is ready */
+static uint32_t fifo[FIFO_DEPTH];
+static unsigned fifo_ready[FIFO_DEPTH];
+static unsigned fifo_head, fifo_count;
+
+/* bus addresses handed out, address i is (i + 1) * BUS_STEP */
+static volatile void *bus_addrs[BUS_ADDRS];
+static unsigned next_bus_addr;
+
+/* clock rates by clock id, changed by MBOX_TAG_SET_CLOCK_RATE */
+static const uint32_t default_rates[] = {
+	0, EMMC_SIM_CLOCK, 48000000, 700000000, 250000000
+};
+#define NUM_CLOCKS (sizeof(default_rates) / sizeof(default_rates[0]))
+static uint32_t rates[NUM_CLOCKS];
+
+static const uint8_t mac[6] = { 0xB8, 0x27, 0xEB, 0x12, 0x34, 0x56 };
+
+/*
+ * Write an answer of len bytes into a tag, as much as its value buffer
+ * holds; the VideoCore reports the full length either way
+ */
+static void sim_answer(uint32_t *t, const void *val, unsigned len)
+{
+	memcpy(&t[3], val, len < t[1] ? len : t[1]);
+	t[2] = PROP_ANSWERED | len;
+}
+
+/*
+ * Answer one tag of a property message, returns 0 if the tag is known
+ */
+static int sim_tag(uint32_t *t)
+{
+	uint32_t val[2];
+	uint32_t id = t[3];
+
+	switch (t[0]) {
+	case MBOX_TAG_BOARD_REV:
+		val[0] = MAILBOX_SIM_BOARD_REV;
+		sim_answer(t, val, 4);
+		return 0;
+	case MBOX_TAG_MAC_ADDR:
+		sim_answer(t, mac, sizeof(mac));
+		return 0;
+	case MBOX_TAG_ARM_MEMORY:
+		val[0] = 0;
+		val[1] = MAILBOX_SIM_ARM_MEMORY;
+		sim_answer(t, val, 8);
+		return 0;
+	case MBOX_TAG_VC_MEMORY:
+		val[0] = MAILBOX_SIM_ARM_MEMORY;
+		val[1] = MAILBOX_SIM_VC_MEMORY;
+		sim_answer(t, val, 8);
+		return 0;
+	case MBOX_TAG_CLOCK_STATE:
+		/* on, or bit 1 if there is no such clock */
+		val[0] = id;
+		val[1] = id > 0 && id < NUM_CLOCKS ? 1 : 2;
+		sim_answer(t, val, 8);
+		return 0;
+	case MBOX_TAG_CLOCK_RATE:
+		val[0] = id;
+		val[1] = id < NUM_CLOCKS ? rates[id] : 0;
+		sim_answer(t, val, 8);
+		return 0;
+	case MBOX_TAG_SET_CLOCK_RATE:
+		if (id > 0 && id < NUM_CLOCKS)
+			rates[id] = t[4];
+		val[0] = id;
+		val[1] = id < NUM_CLOCKS ? rates[id] : 0;
+		sim_answer(t, val, 8);
+		return 0;
+	}
+	return -1;
+}
+
+/*
+ * Answer a property message in place
+ */
+static void sim_properties(uint32_t *buf)
+{
+	unsigned words, i;
+
+	++stats.transactions;
+	words = buf[0] / 4;
+	if (buf[0] % 4 != 0 || words < 3 || buf[1] != 0 || buf[words-1] != 0) {
+		++stats.bad_messages;
+		buf[1] = MBOX_PROP_ERR;
+		return;
+	}
+
+	for (i=2; i<words && buf[i]!=0; i+=3+buf[i+1]/4) {
+		if (i + 3 + buf[i+1] / 4 >= words) {
+			++stats.bad_messages;
+			buf[1] = MBOX_PROP_ERR;
+			return;
+		}
+		++stats.tags;
+		if (buf[i] == dropped_tag || sim_tag(&buf[i]) != 0)
+			++stats.unknown_tags;
+	}
+	buf[1] = MBOX_PROP_OK;
+}
+
+/*
+ * Look up the buffer behind a bus address
+ */
+static uint32_t *sim_pointer(uint32_t bus)
+{
+	unsigned i = bus / BUS_STEP - 1;
+
+	if (bus % BUS_STEP != 0 || i >= BUS_ADDRS)
+		return NULL;
+	return (uint32_t *)bus_addrs[i];
+}
+
+/*
+ * Take a message written to the mailbox and queue the VideoCore's answer
+ */
+static void sim_message(uint32_t msg)
+{
+	unsigned chan = msg & 0xF;
+	uint32_t *buf;
+	unsigned tail;
+
+	++stats.messages;
+	if (fifo_count == FIFO_DEPTH)
+		return;
+
+	switch (chan) {
+	case MBOX_CHAN_PROP:
+		buf = sim_pointer(msg & ~0xF);
+		if (buf)
+			sim_properties(buf);
+		else
+			++stats.bad_messages;
+		break;
+	case MBOX_CHAN_FB:
+		msg = MBOX_CHAN_FB;
+		break;
+	}
+
+	tail = (fifo_head + fifo_count++) % FIFO_DEPTH;
+	fifo[tail] = msg;
+	fifo_ready[tail] = timer_read() + latency;
+}
+
+/*
+ * Return true if the answer at the head of the FIFO is ready
+ */
+static int sim_ready()
+{
+	return fifo_count > 0 && (int)(timer_read() - fifo_ready[fifo_head]) >= 0;
+}
+
+/*
+ * Interrupt while an answer is ready, if asked to
+ */
+void mailbox_sim_run()
+{
+	if ((mailbox_sim_reg.config & CONFIG_DATA_IRQ) && sim_ready())
+		dummy_irq_raise(IRQ_MAILBOX);
+}
+
+/*
+ * Start with nothing in the mailbox and the board's clocks at their
+ * defaults
+ */
+void mailbox_sim_init()
+{
+	memset(&mailbox_sim_reg, 0, sizeof(mailbox_sim_reg));
+	memset(&stats, 0, sizeof(stats));
+	memset((void *)bus_addrs, 0, sizeof(bus_addrs));
+	memcpy(rates, default_rates, sizeof(rates));
+	next_bus_addr = 0;
+	fifo_head = fifo_count = 0;
+	latency = 0;
+	dropped_tag = 0;
+	dummy_irq_add_device(mailbox_sim_run);
+}
+
+/*
+ * Set the time the VideoCore takes to answer a message
+ */
+void mailbox_sim_set_latency(unsigned us)
+{
+	latency = us;
+}
+
+/*
+ * Leave a tag unanswered as a board without the thing it asks about
+ * would, 0 to answer every tag again
+ */
+void mailbox_sim_drop_tag(uint32_t tag)
+{
+	dropped_tag = tag;
+}
+
+/*
+ * Hand out a bus address for a host pointer
+ */
+uint32_t mailbox_sim_bus_addr(const volatile void *addr)
+{
+	unsigned i;
+
+	for (i=0; i<BUS_ADDRS; i++)
+		if (bus_addrs[i] == addr)
+			return (i + 1) * BUS_STEP;
+
+	i = next_bus_addr++ % BUS_ADDRS;
+	bus_addrs[i] = (volatile void *)addr;
+	return (i + 1) * BUS_STEP;
+}
+
+/*
+ * Read a register of the simulated mailbox
+ */
+uint32_t mailbox_sim_read(volatile uint32_t *reg)
+{
+	uint32_t val;
+
+	if (reg == &mailbox_sim_reg.status) {
+		val = sim_ready() ? 0 : ST_EMPTY;
+		if (fifo_count == FIFO_DEPTH)
+			val |= ST_FULL;
+		return val;
+	}
+
+	if (reg == &mailbox_sim_reg.read) {
+		if (!sim_ready()) {
+			++stats.empty_reads;
+			return 0;
+		}
+		val = fifo[fifo_head];
+		fifo_head = (fifo_head + 1) % FIFO_DEPTH;
+		--fifo_count;
+		return val;
+	}
+
+	return *reg;
+}
+
+/*
+ * Write a register of the simulated mailbox
+ */
+void mailbox_sim_write(volatile uint32_t *reg, uint32_t val)
+{
+	if (reg == &mailbox_sim_reg.write)
+		sim_message(val);
+	else
+		*reg = val;
+}
+
+/*
+ * Copy out what the VideoCore was asked to do
+ */
+void mailbox_sim_get_stats(struct mailbox_sim_stats_t *ret)
+{
+	memcpy(ret, &stats, sizeof(struct mailbox_sim_stats_t));
+}
@@ -0,0 +1,52 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * test/mailbox_sim.h
+ *
+ * Simulator of the VideoCore mailbox
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	May 2 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#ifndef MAILBOX_SIM_H
+#define MAILBOX_SIM_H
+
+#include <mailbox.h>
+#include <platform.h>
+#include <types.h>
+
+/* what the simulated board reports */
+#define MAILBOX_SIM_BOARD_REV	0x000E
+#define MAILBOX_SIM_ARM_MEMORY	0x1C000000
+#define MAILBOX_SIM_VC_MEMORY	0x04000000
+
+/*
+ * What the VideoCore was asked to do
+ */
+struct mailbox_sim_stats_t {
+	unsigned messages;	/* messages written, on any channel */
+	unsigned transactions;	/* property messages answered */
+	unsigned tags;		/* tags they carried */
+	unsigned unknown_tags;	/* tags left unanswered */
+	unsigned bad_messages;	/* property messages that could not be read */
+	unsigned empty_reads;	/* READ register read with nothing waiting */
+};
+
+extern mailbox_reg_t mailbox_sim_reg;
+
+/* Function prototypes */
+void mailbox_sim_init();
+void mailbox_sim_set_latency(unsigned us);
+void mailbox_sim_drop_tag(uint32_t tag);
+uint32_t mailbox_sim_bus_addr(const volatile void *addr);
+uint32_t mailbox_sim_read(volatile uint32_t *reg);
+void mailbox_sim_write(volatile uint32_t *reg, uint32_t val);
+void mailbox_sim_run();
+void mailbox_sim_get_stats(struct mailbox_sim_stats_t *stats);
+
+#endif /* MAILBOX_SIM_H */
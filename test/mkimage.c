@@ -0,0 +1,690 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * test/mkimage.c
+ *
+ * FAT32 test image generator
+ *
+ * Author:	Daniel Kudrow (dkudrow@cs.ucsb.edu)
+ * Date:	February 21 2015
+ *
+ * Copyright (c) 2014, Daniel Kudrow
+ * All rights reserved, see LICENSE.txt for details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ *
+ * Builds a partitioned FAT32 disk image for the host filesystem tests so
+ * that they do not depend on a physical SD card. The image is laid out the
+ * way mkfs.fat would lay out a card: an MBR with one partition at LBA 2048
+ * holding a FAT32 volume with two FATs. Files are described on the
+ * command line:
+ *
+ *	/PATH=HOSTFILE	copy HOSTFILE into the image at PATH
+ *	/PATH=#SIZE	synthetic file of SIZE bytes (see IMAGE_PATTERN)
+ *	/PATH/		empty directory
+ *
+ * and two shorthands build the shapes that are tedious to spell out:
+ *
+ *	-w /DIR:N[:SIZE[:PREFIX]]
+ *				directory holding N synthetic files named
+ *				PREFIXNNNNNNN.dat, PREFIX defaults to 'f'
+ *	-t /DIR:DEPTH		chain of DEPTH nested directories, the
+ *				innermost holding a synthetic file
+ *	-x /PATH		write the long name of PATH with a bad
+ *				checksum, the way it would look after a
+ *				driver without long name support renamed it
+ *
+ * Names that are not valid upper case 8.3 names get long name entries
+ * and a NAME~N.EXT alias, exactly like a real FAT driver would create.
+ * Clusters are handed out first fit in the order entries appear on the
+ * command line so the output is byte for byte reproducible. With -f each
+ * cluster of a chain has the given percent chance of skipping ahead a few
+ * clusters, leaving holes that later chains fill in, which is what an
+ * aged card looks like. The skips come from a generator seeded with -r so
+ * a fragmented image is just as reproducible.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ *
+ */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#define SECTOR		512
+#define PART_LBA	2048
+#define RESERVED	32
+#define NUM_FATS	2
+#define DIRENT		32
+
+#define ATTR_DIR	0x10
+#define ATTR_ARCHIVE	0x20
+#define ATTR_LONG	0x0F
+
+/*
+ * A file or directory in the image
+ */
+struct node_t {
+	char name[256];		/* long name */
+	char short_name[11];	/* 8.3 name on disk */
+	int is_dir;
+	int needs_long;		/* 1 if name needs long name entries */
+	int case_flags;		/* lower case flags for short only names */
+	int orphan;		/* 1 to write long name with a bad checksum */
+	const char *host;	/* host file to copy or NULL */
+	unsigned size;		/* size in bytes (files) */
+	unsigned *chain;	/* clusters occupied by node */
+	unsigned nclusters;
+	struct node_t *parent;
+	struct node_t *child;	/* first child */
+	struct node_t *next;	/* next sibling */
+	char last_basis[9];	/* basis of the last alias made in directory */
+	int last_tail;		/* numeric tail of that alias */
+};
+
+static unsigned spc = 1;		/* sectors per cluster */
+static unsigned size_mb = 64;		/* size of image */
+static unsigned total_clusters;
+static unsigned first_free = 2;		/* no free cluster below this */
+static unsigned frag_percent;		/* chance of a gap before a cluster */
+static unsigned seed = 1;		/* fragmentation random seed */
+static unsigned fat_size;		/* sectors per FAT */
+static uint32_t *fat;
+static struct node_t root = { .is_dir = 1 };
+static int fd;
+
+static void die(const char *msg, const char *arg)
+{
+	fprintf(stderr, "mkimage: %s%s%s\n", msg, arg ? " " : "", arg ? arg : "");
+	exit(1);
+}
+
+#define CLUSTER_BYTES (spc * SECTOR)
+#define CLUSTER_OFF(c) (((off_t)PART_LBA + RESERVED + NUM_FATS * fat_size + \
+			((off_t)(c) - 2) * spc) * SECTOR)
+
+/*
+ * Return 1 if c may appear in a short name
+ */
+static int valid_short_char(int c)
+{
+	return isupper(c) || isdigit(c) || (c & 0x80) ||
+		strchr("!#$%&'()-@^_`{}~", c) != NULL;
+}
+
+/*
+ * Fill in the short name for node, creating an alias if it needs a
+ * long name
+ */
+static void make_short_name(struct node_t *node)
+{
+	const char *dot = strrchr(node->name, '.');
+	size_t base_len = dot ? (size_t)(dot - node->name) : strlen(node->name);
+	size_t ext_len = dot ? strlen(dot + 1) : 0;
+	char basis[9], ext[4], tail[12];
+	struct node_t *sib;
+	size_t i, n;
+	int num;
+
+	memset(node->short_name, ' ', 11);
+	node->needs_long = base_len == 0 || base_len > 8 || ext_len > 3 ||
+		strchr(node->name, '.') != dot;
+	for (i=0; !node->needs_long && node->name[i]; i++)
+		if (node->name[i] != '.' &&
+				!valid_short_char(toupper((unsigned char)node->name[i])))
+			node->needs_long = 1;
+
+	/*
+	 * an all lower case base or extension is kept in the NT case flags,
+	 * mixed case needs a long name
+	 */
+	for (i=0; !node->needs_long && i<base_len+ext_len+(dot != NULL); i++) {
+		int c = (unsigned char)node->name[i];
+		int lower = i < base_len ? 0x08 : 0x10;
+		int upper = lower << 8;
+
+		if (i == base_len)
+			continue;
+		if (islower(c))
+			node->case_flags |= lower;
+		else if (isupper(c))
+			node->case_flags |= upper;
+		if ((node->case_flags & lower) && (node->case_flags & upper))
+			node->needs_long = 1;
+		node->short_name[i < base_len ? i : i - base_len - 1 + 8] = toupper(c);
+	}
+	node->case_flags &= 0x18;
+	if (!node->needs_long)
+		return;
+	node->case_flags = 0;
+
+	/* build the basis name from the valid characters of the long name */
+	for (i=0, n=0; i<base_len && n<8; i++) {
+		int c = toupper((unsigned char)node->name[i]);
+		if (c != ' ' && c != '.')
+			basis[n++] = valid_short_char(c) ? c : '_';
+	}
+	basis[n] = '\0';
+	for (i=0, n=0; dot && dot[1+i] && n<3; i++) {
+		int c = toupper((unsigned char)dot[1+i]);
+		if (c != ' ')
+			ext[n++] = valid_short_char(c) ? c : '_';
+	}
+	ext[n] = '\0';
+
+	/*
+	 * append the first free numeric tail, files made in a row usually
+	 * share a basis so pick up where the last one left off
+	 */
+	num = strcmp(basis, node->parent->last_basis) ? 1 : node->parent->last_tail + 1;
+	for (; ; num++) {
+		int tail_len = snprintf(tail, sizeof(tail), "~%d", num);
+		size_t keep = strlen(basis);
+		if (keep + tail_len > 8)
+			keep = 8 - tail_len;
+		memset(node->short_name, ' ', 11);
+		memcpy(node->short_name, basis, keep);
+		memcpy(node->short_name + keep, tail, tail_len);
+		memcpy(node->short_name + 8, ext, strlen(ext));
+		for (sib=node->parent->child; sib; sib=sib->next)
+			if (sib != node && !memcmp(sib->short_name, node->short_name, 11))
+				break;
+		if (sib == NULL) {
+			strcpy(node->parent->last_basis, basis);
+			node->parent->last_tail = num;
+			return;
+		}
+	}
+}
+
+/*
+ * Find or create the child of dir called name
+ */
+static struct node_t *add_child(struct node_t *dir, const char *name, int is_dir)
+{
+	struct node_t *node, **link;
+
+	if (!dir->is_dir)
+		die("not a directory:", dir->name);
+	if (strlen(name) > 255)
+		die("name too long:", name);
+
+	for (link=&dir->child; *link; link=&(*link)->next) {
+		if (!strcasecmp((*link)->name, name)) {
+			if ((*link)->is_dir != is_dir)
+				die("type conflict:", name);
+			return *link;
+		}
+	}
+
+	node = calloc(1, sizeof(*node));
+	strcpy(node->name, name);
+	node->is_dir = is_dir;
+	node->parent = dir;
+	*link = node;
+	make_short_name(node);
+
+	return node;
+}
+
+/*
+ * Create every component of path, returning the last
+ */
+static struct node_t *add_path(const char *path, int is_dir)
+{
+	char buf[4096], *comp, *next;
+	struct node_t *node = &root;
+
+	if (strlen(path) >= sizeof(buf))
+		die("path too long:", path);
+	strcpy(buf, path);
+
+	for (comp=buf; *comp == '/'; comp++)
+		;
+	while (*comp) {
+		next = strchr(comp, '/');
+		if (next) {
+			*next++ = '\0';
+			while (*next == '/')
+				++next;
+		}
+		node = add_child(node, comp, next && *next ? 1 : is_dir);
+		comp = next ? next : comp + strlen(comp);
+	}
+
+	return node;
+}
+
+/*
+ * Parse a single /PATH=SOURCE or /PATH/ argument
+ */
+static void add_entry(const char *arg)
+{
+	char path[4096];
+	const char *eq = strchr(arg, '=');
+	struct node_t *node;
+	struct stat st;
+
+	if (eq == NULL) {
+		add_path(arg, 1);
+		return;
+	}
+
+	snprintf(path, sizeof(path), "%.*s", (int)(eq - arg), arg);
+	node = add_path(path, 0);
+	if (eq[1] == '#') {
+		node->size = strtoul(eq + 2, NULL, 0);
+	} else {
+		if (stat(eq + 1, &st) < 0)
+			die("cannot stat", eq + 1);
+		node->host = eq + 1;
+		node->size = st.st_size;
+	}
+}
+
+/*
+ * Count the directory entries needed to describe node
+ */
+static unsigned dirent_count(struct node_t *node)
+{
+	return node->needs_long ? 1 + (strlen(node->name) + 12) / 13 : 1;
+}
+
+/*
+ * Reproducible pseudo random numbers for fragmentation
+ */
+static unsigned next_random()
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7FFF;
+}
+
+/*
+ * Find the first free cluster at or after cluster
+ */
+static unsigned find_free(unsigned cluster, const char *name)
+{
+	while (cluster < total_clusters + 2 && fat[cluster] != 0)
+		++cluster;
+	if (cluster >= total_clusters + 2)
+		die("image full allocating", name);
+	return cluster;
+}
+
+/*
+ * Hand out clusters to node
+ */
+static void alloc_chain(struct node_t *node, unsigned bytes)
+{
+	unsigned i, cluster;
+
+	node->nclusters = bytes ? (bytes + CLUSTER_BYTES - 1) / CLUSTER_BYTES : 0;
+	if (node->is_dir && node->nclusters == 0)
+		node->nclusters = 1;
+	node->chain = calloc(node->nclusters + 1, sizeof(unsigned));
+
+	for (i=0; i<node->nclusters; i++) {
+		if (i == 0)
+			cluster = first_free;
+		else if (frag_percent && next_random() % 100 < frag_percent)
+			cluster = node->chain[i-1] + 2 + next_random() % 8;
+		else
+			cluster = node->chain[i-1] + 1;
+		if (cluster >= total_clusters + 2)
+			cluster = first_free;
+		node->chain[i] = cluster = find_free(cluster, node->name);
+		fat[cluster] = 0x0FFFFFFF;
+		if (cluster == first_free)
+			first_free = cluster + 1;
+	}
+	for (i=0; i<node->nclusters; i++)
+		fat[node->chain[i]] = i+1 < node->nclusters ? node->chain[i+1] : 0x0FFFFFFF;
+}
+
+/*
+ * Allocate clusters depth first in command line order
+ */
+static void alloc_tree(struct node_t *node)
+{
+	struct node_t *child;
+	unsigned entries = node == &root ? 0 : 2;
+
+	if (!node->is_dir) {
+		alloc_chain(node, node->size);
+		return;
+	}
+
+	for (child=node->child; child; child=child->next)
+		entries += dirent_count(child);
+	/* leave room for the end of directory marker */
+	alloc_chain(node, (entries + 1) * DIRENT);
+
+	for (child=node->child; child; child=child->next)
+		alloc_tree(child);
+}
+
+static void write_at(off_t off, const void *buf, size_t len)
+{
+	if (pwrite(fd, buf, len, off) != (ssize_t)len)
+		die("write failed", NULL);
+}
+
+/*
+ * Write len bytes at byte offset pos of node's cluster chain
+ */
+static void write_node(struct node_t *node, unsigned pos, const void *buf, unsigned len)
+{
+	const unsigned char *p = buf;
+	unsigned n;
+
+	while (len) {
+		n = CLUSTER_BYTES - pos % CLUSTER_BYTES;
+		if (n > len)
+			n = len;
+		write_at(CLUSTER_OFF(node->chain[pos / CLUSTER_BYTES]) +
+				pos % CLUSTER_BYTES, p, n);
+		p += n;
+		pos += n;
+		len -= n;
+	}
+}
+
+static void put16(unsigned char *p, unsigned v) { p[0] = v; p[1] = v >> 8; }
+static void put32(unsigned char *p, unsigned v) { put16(p, v); put16(p+2, v >> 16); }
+
+/*
+ * Short name checksum stored in each long name entry
+ */
+static unsigned char short_checksum(const char *short_name)
+{
+	unsigned char sum = 0;
+	int i;
+
+	for (i=0; i<11; i++)
+		sum = ((sum & 1) << 7) + (sum >> 1) + (unsigned char)short_name[i];
+
+	return sum;
+}
+
+static void short_entry(unsigned char *e, const char *name, int attr,
+		unsigned cluster, unsigned size)
+{
+	memset(e, 0, DIRENT);
+	memcpy(e, name, 11);
+	e[11] = attr;
+	put16(e + 20, cluster >> 16);
+	put16(e + 26, cluster & 0xFFFF);
+	put32(e + 28, size);
+}
+
+/*
+ * Write the entries for node into its parent at entry index idx and
+ * return the index of the next free entry
+ */
+static unsigned write_dirents(struct node_t *node, unsigned idx)
+{
+	static const int char_off[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+	unsigned char e[DIRENT];
+	unsigned len = strlen(node->name);
+	unsigned nlong = dirent_count(node) - 1, seq, i, c;
+	unsigned char sum = short_checksum(node->short_name) + node->orphan;
+
+	/* long name entries are stored last piece first */
+	for (seq=nlong; seq>=1; seq--) {
+		memset(e, 0, DIRENT);
+		e[0] = seq | (seq == nlong ? 0x40 : 0);
+		e[11] = ATTR_LONG;
+		e[13] = sum;
+		for (i=0; i<13; i++) {
+			unsigned pos = (seq - 1) * 13 + i;
+			c = pos < len ? (unsigned char)node->name[pos] : pos == len ? 0 : 0xFFFF;
+			put16(e + char_off[i], c);
+		}
+		write_node(node->parent, idx++ * DIRENT, e, DIRENT);
+	}
+
+	short_entry(e, node->short_name, node->is_dir ? ATTR_DIR : ATTR_ARCHIVE,
+			node->nclusters ? node->chain[0] : 0, node->is_dir ? 0 : node->size);
+	e[12] = node->case_flags;
+	write_node(node->parent, idx++ * DIRENT, e, DIRENT);
+
+	return idx;
+}
+
+/*
+ * Write node's contents
+ */
+static void write_tree(struct node_t *node)
+{
+	unsigned char buf[65536];
+	struct node_t *child;
+	unsigned idx = 0, pos, n;
+	int host_fd;
+
+	if (node->is_dir) {
+		if (node != &root) {
+			short_entry(buf, ".          ", ATTR_DIR, node->chain[0], 0);
+			write_node(node, idx++ * DIRENT, buf, DIRENT);
+			short_entry(buf, "..         ", ATTR_DIR, node->parent == &root ?
+					0 : node->parent->chain[0], 0);
+			write_node(node, idx++ * DIRENT, buf, DIRENT);
+		}
+		for (child=node->child; child; child=child->next) {
+			idx = write_dirents(child, idx);
+			write_tree(child);
+		}
+		return;
+	}
+
+	if (node->host && (host_fd = open(node->host, O_RDONLY)) < 0)
+		die("cannot open", node->host);
+
+	for (pos=0; pos<node->size; pos+=n) {
+		n = node->size - pos < sizeof(buf) ? node->size - pos : sizeof(buf);
+		if (node->host) {
+			if (read(host_fd, buf, n) != (ssize_t)n)
+				die("short read from", node->host);
+		} else {
+			unsigned i;
+			for (i=0; i<n; i++)
+				buf[i] = IMAGE_PATTERN(pos + i);
+		}
+		write_node(node, pos, buf, n);
+	}
+
+	if (node->host)
+		close(host_fd);
+}
+
+/*
+ * Build a directory with count synthetic files
+ */
+static void add_wide(const char *arg)
+{
+	char dir[4096], prefix[240] = "f", path[4400];
+	unsigned count = 0, size = 0, i;
+
+	if (sscanf(arg, "%4095[^:]:%u:%u:%239[^:]", dir, &count, &size, prefix) < 2)
+		die("bad -w argument", arg);
+	add_path(dir, 1);
+	for (i=0; i<count; i++) {
+		snprintf(path, sizeof(path), "%s/%s%07u.dat", dir, prefix, i);
+		add_path(path, 0)->size = size;
+	}
+}
+
+/*
+ * Build a chain of depth nested directories
+ */
+static void add_deep(const char *arg)
+{
+	char path[4096];
+	unsigned depth = 0, i;
+	size_t len;
+
+	if (sscanf(arg, "%4000[^:]:%u", path, &depth) < 2)
+		die("bad -t argument", arg);
+	for (i=0; i<depth; i++) {
+		len = strlen(path);
+		if (len + 8 >= sizeof(path))
+			die("tree too deep", arg);
+		snprintf(path + len, sizeof(path) - len, "/d%u", i);
+	}
+	len = strlen(path);
+	snprintf(path + len, sizeof(path) - len, "/leaf.dat");
+	add_path(path, 0)->size = 1000;
+}
+
+/*
+ * Give path's long name a checksum that does not match its short name
+ */
+static void add_orphan(const char *arg)
+{
+	struct node_t *node = add_path(arg, 0);
+
+	if (!node->needs_long)
+		die("no long name to orphan:", arg);
+	node->orphan = 1;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: mkimage [-c sectors_per_cluster] [-s size_mb] "
+			"[-f fragment_percent] [-r seed] "
+			"[-w /dir:n[:size[:prefix]]] [-t /dir:depth] [-x /path] -o image "
+			"[/path=hostfile | /path=#size | /path/]...\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned char sector[SECTOR];
+	const char *out = NULL, *wide[16], *deep[16], *orphan[16];
+	unsigned total, data_sectors, free_clusters, nwide = 0, ndeep = 0, norphan = 0, i;
+	int opt, arg;
+
+	while ((opt = getopt(argc, argv, "c:s:w:t:x:f:r:o:")) != -1) {
+		switch (opt) {
+			case 'c':
+				spc = strtoul(optarg, NULL, 0);
+				if (spc == 0 || spc > 128 || (spc & (spc - 1)))
+					die("bad cluster size", optarg);
+				break;
+			case 's':
+				size_mb = strtoul(optarg, NULL, 0);
+				break;
+			case 'f':
+				frag_percent = strtoul(optarg, NULL, 0);
+				if (frag_percent > 100)
+					die("bad fragmentation percentage", optarg);
+				break;
+			case 'r':
+				seed = strtoul(optarg, NULL, 0);
+				break;
+			case 'w':
+				if (nwide == 16)
+					die("too many -w options", NULL);
+				wide[nwide++] = optarg;
+				break;
+			case 't':
+				if (ndeep == 16)
+					die("too many -t options", NULL);
+				deep[ndeep++] = optarg;
+				break;
+			case 'x':
+				if (norphan == 16)
+					die("too many -x options", NULL);
+				orphan[norphan++] = optarg;
+				break;
+			case 'o':
+				out = optarg;
+				break;
+			default:
+				usage();
+		}
+	}
+	if (out == NULL)
+		usage();
+	for (arg=optind; arg<argc; arg++)
+		add_entry(argv[arg]);
+	for (i=0; i<nwide; i++)
+		add_wide(wide[i]);
+	for (i=0; i<ndeep; i++)
+		add_deep(deep[i]);
+	for (i=0; i<norphan; i++)
+		add_orphan(orphan[i]);
+
+	/* size the FAT so that it covers every data cluster */
+	total = size_mb * 2048 - PART_LBA;
+	data_sectors = total - RESERVED;
+	fat_size = 1;
+	while (1) {
+		total_clusters = (data_sectors - NUM_FATS * fat_size) / spc;
+		if ((total_clusters + 2) * 4 <= fat_size * SECTOR)
+			break;
+		++fat_size;
+	}
+	fat = calloc(fat_size * SECTOR / 4, 4);
+	fat[0] = 0x0FFFFFF8;
+	fat[1] = 0x0FFFFFFF;
+
+	alloc_tree(&root);
+
+	fd = open(out, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || ftruncate(fd, (off_t)size_mb * 1024 * 1024) < 0)
+		die("cannot create", out);
+
+	/* MBR with a single FAT32 (LBA) partition */
+	memset(sector, 0, SECTOR);
+	sector[446 + 4] = 0x0C;
+	put32(sector + 446 + 8, PART_LBA);
+	put32(sector + 446 + 12, total);
+	put16(sector + 510, 0xAA55);
+	write_at(0, sector, SECTOR);
+
+	/* boot sector and BIOS parameter block */
+	memset(sector, 0, SECTOR);
+	memcpy(sector, "\xEB\x58\x90" "mkimage ", 11);
+	put16(sector + 11, SECTOR);
+	sector[13] = spc;
+	put16(sector + 14, RESERVED);
+	sector[16] = NUM_FATS;
+	sector[21] = 0xF8;
+	put32(sector + 28, PART_LBA);
+	put32(sector + 32, total);
+	put32(sector + 36, fat_size);
+	put32(sector + 44, root.chain[0]);
+	put16(sector + 48, 1);
+	put16(sector + 50, 6);
+	sector[66] = 0x29;
+	memcpy(sector + 71, "SLICE TEST FAT32   ", 19);
+	put16(sector + 510, 0xAA55);
+	write_at((off_t)PART_LBA * SECTOR, sector, SECTOR);
+	write_at((off_t)(PART_LBA + 6) * SECTOR, sector, SECTOR);
+
+	/* FSInfo sector */
+	memset(sector, 0, SECTOR);
+	put32(sector, 0x41615252);
+	put32(sector + 484, 0x61417272);
+	for (i=2, free_clusters=0; i<total_clusters+2; i++)
+		free_clusters += fat[i] == 0;
+	put32(sector + 488, free_clusters);
+	put32(sector + 492, find_free(first_free, "FSInfo"));
+	put32(sector + 508, 0xAA550000);
+	write_at((off_t)(PART_LBA + 1) * SECTOR, sector, SECTOR);
+
+	/* FATs */
+	for (i=0; i<NUM_FATS; i++)
+		write_at(((off_t)PART_LBA + RESERVED + i * fat_size) * SECTOR, fat,
+				fat_size * SECTOR);
+
+	write_tree(&root);
+	close(fd);
+
+	return 0;
+}
@@ -3,7 +3,12 @@
 #ifndef TEST_H
 #define TEST_H
 
+/*
+ * Contents of byte i of a synthetic file in a test image built by
+ * test/mkimage.c -- depends on the sector too so misplaced sectors show
+ */
+#define IMAGE_PATTERN(i) ((unsigned char)((i) + ((i) >> 9) * 7))
+
 char *dummy_console_reset();
 
 #endif /* TEST_H */
-